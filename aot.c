@@ -0,0 +1,140 @@
+#include "chip8.h"
+
+// Runtime side of ROMs compiled ahead of time by chip8-recompile. The
+// generated code chains its blocks itself and only comes back here at
+// whatever it can't follow statically: returns into code the walk never
+// reached, computed Bnnn jumps, idle loops and the end of the budget. Those
+// run one instruction at a time on the interpreter until pc is at a block
+// start again.
+//
+// The compiled code is only right while memory holds the bytes it was
+// compiled from. Every store to them flushes the block cache, which marks
+// the program stale; it is checked against the ROM before running again,
+// and while the ROM has rewritten its code the block engine runs instead.
+
+// programs linked into this binary, see chip8_aot_register()
+static struct chip8_aot_program *chip8_aot_programs;
+
+static inline int chip8_aot_test(const uint8_t *bitmap, unsigned int addr)
+{
+    return (bitmap[addr >> 3] >> (addr & 7)) & 1;
+}
+
+// Called by each generated translation unit before main()
+void chip8_aot_register(struct chip8_aot_program *program)
+{
+    program->next = chip8_aot_programs;
+    chip8_aot_programs = program;
+}
+
+// The program compiled from this ROM, or NULL
+const struct chip8_aot_program *chip8_aot_lookup(const uint8_t *rom, size_t len)
+{
+    for (const struct chip8_aot_program *program = chip8_aot_programs; program != NULL; program = program->next)
+    {
+        if (program->rom_len == len && memcmp(program->rom, rom, len) == 0)
+        {
+            return program;
+        }
+    }
+
+    return NULL;
+}
+
+// Whether memory still holds the code the program was compiled from. If
+// it does, the code's bytes go back in the block cache's bitmap so the
+// next store to one of them is seen.
+static int chip8_aot_check(struct chip8_data *chip)
+{
+    const struct chip8_aot_program *program = chip->aot;
+
+    for (size_t i = 0; i < program->rom_len; i++)
+    {
+        unsigned int addr = ROM_OFFSET + i;
+        if (chip8_aot_test(program->code, addr) && chip->mem[addr] != program->rom[i])
+        {
+            return 0;
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(chip->bcache.code); i++)
+    {
+        chip->bcache.code[i] |= program->code[i];
+    }
+
+    chip->aot_stale = 0;
+    return 1;
+}
+
+// Runs one instruction the generated code leaves to the interpreter, with
+// pc already pointing past it
+void chip8_aot_exec(struct chip8_data *chip, uint16_t opcode)
+{
+    const struct chip8_insn *in = &chip8_insn_table[opcode];
+    chip->opcode = opcode;
+
+    switch (chip->quirks)
+    {
+#define X(name, label, quirks)              \
+    case CHIP8_QUIRKS_##name:               \
+        chip8_exec_insn<(quirks)>(chip, in); \
+        break;
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+    default:
+        chip8_exec_insn<0>(chip, in);
+        break;
+    }
+}
+
+// Generated code keeps count of the instructions it ran and ticks the
+// timers for them in one go, before anything that reads or sets them
+void chip8_aot_timers(struct chip8_data *chip, unsigned long long n)
+{
+    chip8_timers_advance(chip, n);
+}
+
+template <unsigned int Q>
+void chip8_run_aot(struct chip8_data *chip, unsigned long long cycles)
+{
+    const struct chip8_aot_program *program = chip->aot;
+
+    // nothing compiled from this ROM, or not under this profile
+    if (program == NULL || program->quirks != chip->quirks)
+    {
+        chip8_run_block<Q>(chip, cycles);
+        return;
+    }
+
+    while (cycles > 0)
+    {
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+            continue;
+        }
+
+        if (chip->aot_stale && !chip8_aot_check(chip))
+        {
+            chip8_run_block<Q>(chip, cycles);
+            return;
+        }
+
+        unsigned long long ran = 0;
+        if (chip->pc <= 0xFFE && chip8_aot_test(program->entries, chip->pc))
+        {
+            ran = program->run(chip, cycles);
+        }
+
+        if (ran == 0)
+        {
+            const struct chip8_insn *in = chip8_fetch_insn(chip);
+            chip8_exec_insn<Q>(chip, in);
+            chip8_tick_timers(chip);
+            cycles--;
+            continue;
+        }
+
+        cycles -= ran;
+    }
+}
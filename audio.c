@@ -0,0 +1,135 @@
+#include "chip8.h"
+
+// The emulation thread pushes the sound timer's state once per 60 Hz frame
+// into a single-producer single-consumer ring, and the audio callback turns
+// each entry into a frame's worth of square wave. Neither side ever waits
+// on the other: a full ring drops the new frame, an empty one keeps playing
+// the last, so late emulation stretches a tone instead of clicking.
+
+const unsigned int CHIP8_AUDIO_TONE_HZ = 440;
+const int16_t CHIP8_AUDIO_AMPLITUDE = 3000;
+
+// frames queued beyond this are skipped to hold latency down
+const unsigned int AUDIO_MAX_QUEUED = 2;
+
+int chip8_audio_init(struct chip8_audio *audio, unsigned int sample_rate, unsigned int buffer_samples)
+{
+    memset(audio, 0, sizeof(*audio));
+
+    if (sample_rate < 60 || buffer_samples == 0)
+    {
+        fprintf(stderr, "Invalid audio format, %u Hz with %u sample buffer\n", sample_rate, buffer_samples);
+        return -1;
+    }
+
+    audio->sample_rate = sample_rate;
+    audio->buffer_samples = buffer_samples;
+    audio->phase_step = (uint32_t)(((uint64_t)CHIP8_AUDIO_TONE_HZ << 32) / sample_rate);
+
+    return 0;
+}
+
+// Producer side, called once per emulated frame
+void chip8_audio_push(struct chip8_audio *audio, const struct chip8_data *chip)
+{
+    unsigned int head = audio->head;
+    unsigned int tail = __atomic_load_n(&audio->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == CHIP8_AUDIO_RING)
+    {
+        audio->dropped++;
+        return;
+    }
+
+    struct chip8_audio_frame *frame = &audio->ring[head % CHIP8_AUDIO_RING];
+    frame->tone = chip->sfxTime > 0;
+    frame->pushed_ns = time_nanos();
+
+    // publishes the entry written above
+    __atomic_store_n(&audio->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Starts the next frame's samples from the ring, or repeats the last
+// frame if emulation hasn't produced one yet. offset is where in the
+// current output buffer the new frame begins.
+static void chip8_audio_next_frame(struct chip8_audio *audio, unsigned int offset)
+{
+    unsigned int tail = audio->tail;
+    unsigned int head = __atomic_load_n(&audio->head, __ATOMIC_ACQUIRE);
+
+    // frames span sample_rate / 60 samples, spread the remainder
+    audio->frame_acc += audio->sample_rate;
+    audio->frame_left = audio->frame_acc / 60;
+    audio->frame_acc %= 60;
+
+    if (head == tail)
+    {
+        audio->starved++;
+        return;
+    }
+
+    if (head - tail > AUDIO_MAX_QUEUED)
+    {
+        audio->skipped += head - tail - AUDIO_MAX_QUEUED;
+        tail = head - AUDIO_MAX_QUEUED;
+    }
+
+    audio->current = audio->ring[tail % CHIP8_AUDIO_RING];
+    __atomic_store_n(&audio->tail, tail + 1, __ATOMIC_RELEASE);
+    audio->played++;
+
+    // the sample just started reaches the speaker once everything ahead of
+    // it in this buffer and the one the device is playing has drained
+    long long latency = time_nanos() - audio->current.pushed_ns +
+                        (long long)(offset + audio->buffer_samples) * 1000000000ll / audio->sample_rate;
+    audio->latency_ns += latency;
+    if (latency > audio->max_latency_ns)
+    {
+        audio->max_latency_ns = latency;
+    }
+}
+
+// Consumer side, fills samples of signed 16-bit mono
+void chip8_audio_render(struct chip8_audio *audio, int16_t *out, unsigned int samples)
+{
+    for (unsigned int i = 0; i < samples; i++)
+    {
+        if (audio->frame_left == 0)
+        {
+            chip8_audio_next_frame(audio, i);
+        }
+        audio->frame_left--;
+
+        // keep the phase running through silence so tones start cleanly
+        out[i] = !audio->current.tone ? 0 : (audio->phase & 0x80000000u) ? CHIP8_AUDIO_AMPLITUDE : -CHIP8_AUDIO_AMPLITUDE;
+        audio->phase += audio->phase_step;
+    }
+}
+
+// Headless stand-in for the device: one frame in, one frame of samples out
+int chip8_audio_write_pcm(struct chip8_audio *audio, const struct chip8_data *chip, FILE *out)
+{
+    int16_t samples[4096];
+    unsigned int count = (audio->frame_acc + audio->sample_rate) / 60;
+
+    chip8_audio_push(audio, chip);
+    while (count > 0)
+    {
+        unsigned int chunk = count < 4096 ? count : 4096;
+        chip8_audio_render(audio, samples, chunk);
+        if (fwrite(samples, sizeof(samples[0]), chunk, out) != chunk)
+        {
+            return -1;
+        }
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+void chip8_audio_report(const struct chip8_audio *audio, FILE *out)
+{
+    fprintf(out, "audio_frames=%llu audio_starved=%llu audio_skipped=%llu audio_dropped=%llu audio_latency_ms=%.2f audio_max_latency_ms=%.2f\n",
+            audio->played, audio->starved, audio->skipped, audio->dropped,
+            audio->played > 0 ? audio->latency_ns / 1e6 / audio->played : 0.0, audio->max_latency_ns / 1e6);
+}
@@ -0,0 +1,361 @@
+#include "headless.h"
+#include <pthread.h>
+#include <unistd.h>
+
+// A jobs file has one job per line, fields separated by tabs:
+//   <cycles>\t<rom_file_bin>[\t<input_script>]
+// An input script has one key event per line:
+//   <cycle> <key> <0|1>
+// where <key> is the hex keypad digit and the event is applied before the
+// instruction at <cycle> executes.
+
+struct batch_input_event
+{
+    unsigned long long cycle;
+    uint8_t key;
+    uint8_t down;
+};
+
+struct batch_job
+{
+    unsigned long long cycles;
+    char *rom_filename;
+    char *input_filename;
+
+    // results
+    int status;
+    unsigned long long executed;
+    long long elapsed;
+    uint64_t vid_hash;
+    uint64_t mem_hash;
+};
+
+// Per-worker job queue. The owner pops from the bottom, thieves take from
+// the top, so a worker keeps running the jobs it was dealt until it runs
+// dry and only then starts stealing.
+struct batch_deque
+{
+    pthread_mutex_t lock;
+    int *jobs;
+    int top;
+    int bottom;
+};
+
+struct batch_pool
+{
+    struct batch_job *jobs;
+    int num_jobs;
+    int engine;
+    unsigned int ips;
+    uint64_t seed;
+
+    struct batch_deque *deques;
+    int num_workers;
+};
+
+struct batch_worker
+{
+    pthread_t thread;
+    struct batch_pool *pool;
+    int id;
+    unsigned long long steals;
+};
+
+static int batch_load_input(const char *filename, struct batch_input_event **events)
+{
+    *events = NULL;
+    if (filename == NULL)
+    {
+        return 0;
+    }
+
+    FILE *input_file = fopen(filename, "r");
+    if (input_file == NULL)
+    {
+        fprintf(stderr, "Could not open input script '%s'\n", filename);
+        return -1;
+    }
+
+    int num_events = 0;
+    int cap_events = 0;
+    unsigned long long cycle;
+    unsigned int key, down;
+
+    while (fscanf(input_file, "%llu %x %u", &cycle, &key, &down) == 3)
+    {
+        if (num_events == cap_events)
+        {
+            cap_events = cap_events ? cap_events * 2 : 64;
+            *events = (struct batch_input_event *)realloc(*events, cap_events * sizeof(**events));
+        }
+
+        (*events)[num_events].cycle = cycle;
+        (*events)[num_events].key = key & 0xF;
+        (*events)[num_events].down = down != 0;
+        num_events++;
+    }
+
+    fclose(input_file);
+    return num_events;
+}
+
+static void batch_run_job(struct batch_job *job, int engine, unsigned int ips, uint64_t seed)
+{
+    struct batch_input_event *events;
+    int num_events = batch_load_input(job->input_filename, &events);
+    if (num_events < 0)
+    {
+        job->status = CHIP8_IO_ERROR;
+        return;
+    }
+
+    struct chip8_data *chip = chip8_create();
+    long long start_time = time_nanos();
+
+    int status = chip8_load_rom(chip, job->rom_filename);
+    if (status == CHIP8_OK)
+    {
+        chip->engine = engine;
+        chip->ips = ips;
+        chip8_seed(chip, seed);
+
+        int next_event = 0;
+        while (job->executed < job->cycles)
+        {
+            while (next_event < num_events && events[next_event].cycle <= job->executed)
+            {
+                chip->keys[events[next_event].key] = events[next_event].down;
+                next_event++;
+            }
+
+            // run straight through to the next key event
+            unsigned long long run = job->cycles - job->executed;
+            if (next_event < num_events && events[next_event].cycle - job->executed < run)
+            {
+                run = events[next_event].cycle - job->executed;
+            }
+
+            status = chip8_step(chip, run);
+            if (status != CHIP8_OK)
+            {
+                break;
+            }
+            job->executed += run;
+        }
+    }
+
+    job->status = status;
+    job->elapsed = time_nanos() - start_time;
+    job->vid_hash = chip8_display_hash(chip);
+    job->mem_hash = chip8_hash(chip->mem, sizeof(chip->mem));
+
+    chip8_destroy(chip);
+    free(events);
+}
+
+static int batch_pop(struct batch_deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom)
+    {
+        job = deque->jobs[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return job;
+}
+
+static int batch_steal(struct batch_deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom)
+    {
+        job = deque->jobs[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return job;
+}
+
+static void *batch_worker_main(void *arg)
+{
+    struct batch_worker *worker = (struct batch_worker *)arg;
+    struct batch_pool *pool = worker->pool;
+
+    for (;;)
+    {
+        int job = batch_pop(&pool->deques[worker->id]);
+
+        // jobs are never added once the pool starts, so a full sweep over
+        // every other queue that finds nothing means we are done
+        for (int i = 1; job < 0 && i < pool->num_workers; i++)
+        {
+            job = batch_steal(&pool->deques[(worker->id + i) % pool->num_workers]);
+            if (job >= 0)
+            {
+                worker->steals++;
+            }
+        }
+
+        if (job < 0)
+        {
+            return NULL;
+        }
+
+        batch_run_job(&pool->jobs[job], pool->engine, pool->ips, pool->seed);
+    }
+}
+
+static int batch_load_jobs(const char *filename, struct batch_job **jobs)
+{
+    FILE *jobs_file = fopen(filename, "r");
+    if (jobs_file == NULL)
+    {
+        fprintf(stderr, "Could not open jobs file '%s'\n", filename);
+        return -1;
+    }
+
+    int num_jobs = 0;
+    int cap_jobs = 0;
+    char line[4096];
+    *jobs = NULL;
+
+    while (fgets(line, sizeof(line), jobs_file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        char *cycles_field = strtok(line, "\t");
+        char *rom_field = strtok(NULL, "\t");
+        char *input_field = strtok(NULL, "\t");
+        if (rom_field == NULL)
+        {
+            fprintf(stderr, "Malformed job line %d in '%s'\n", num_jobs + 1, filename);
+            continue;
+        }
+
+        if (num_jobs == cap_jobs)
+        {
+            cap_jobs = cap_jobs ? cap_jobs * 2 : 64;
+            *jobs = (struct batch_job *)realloc(*jobs, cap_jobs * sizeof(**jobs));
+        }
+
+        struct batch_job *job = &(*jobs)[num_jobs++];
+        memset(job, 0, sizeof(*job));
+        job->cycles = strtoull(cycles_field, NULL, 10);
+        job->rom_filename = strdup(rom_field);
+        job->input_filename = input_field ? strdup(input_field) : NULL;
+    }
+
+    fclose(jobs_file);
+    return num_jobs;
+}
+
+int batch_main(const char *jobs_filename, int num_threads, int engine, unsigned int ips, uint64_t seed)
+{
+    if (ips == 0)
+    {
+        fprintf(stderr, "Batch runs need at least 1 instruction per second\n");
+        return 1;
+    }
+
+    struct batch_pool pool;
+    pool.engine = engine;
+    pool.ips = ips;
+    pool.seed = seed;
+
+    pool.num_jobs = batch_load_jobs(jobs_filename, &pool.jobs);
+    if (pool.num_jobs < 0)
+    {
+        return 1;
+    }
+
+    if (num_threads <= 0)
+    {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads > pool.num_jobs)
+    {
+        num_threads = pool.num_jobs > 0 ? pool.num_jobs : 1;
+    }
+
+    // deal the jobs out in contiguous runs, stealing evens out the rest
+    pool.num_workers = num_threads;
+    pool.deques = (struct batch_deque *)calloc(num_threads, sizeof(struct batch_deque));
+    for (int w = 0; w < num_threads; w++)
+    {
+        struct batch_deque *deque = &pool.deques[w];
+        int first = (int)((long long)pool.num_jobs * w / num_threads);
+        int last = (int)((long long)pool.num_jobs * (w + 1) / num_threads);
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = (int *)malloc((last - first + 1) * sizeof(int));
+        deque->top = 0;
+        deque->bottom = 0;
+
+        // pushed in reverse so the owner pops them in file order
+        for (int j = last - 1; j >= first; j--)
+        {
+            deque->jobs[deque->bottom++] = j;
+        }
+    }
+
+    struct batch_worker *workers = (struct batch_worker *)calloc(num_threads, sizeof(struct batch_worker));
+    long long start_time = time_nanos();
+
+    for (int w = 0; w < num_threads; w++)
+    {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+        pthread_create(&workers[w].thread, NULL, batch_worker_main, &workers[w]);
+    }
+
+    unsigned long long total_steals = 0;
+    for (int w = 0; w < num_threads; w++)
+    {
+        pthread_join(workers[w].thread, NULL);
+        total_steals += workers[w].steals;
+    }
+
+    long long elapsed = time_nanos() - start_time;
+    unsigned long long total_cycles = 0;
+    int failed = 0;
+
+    for (int j = 0; j < pool.num_jobs; j++)
+    {
+        struct batch_job *job = &pool.jobs[j];
+        double seconds = job->elapsed / 1e9;
+
+        printf("job=%d status=%d cycles=%llu ips=%.0f vid_hash=%016llx mem_hash=%016llx rom=%s\n",
+               j, job->status, job->executed, seconds > 0 ? job->executed / seconds : 0.0,
+               (unsigned long long)job->vid_hash, (unsigned long long)job->mem_hash, job->rom_filename);
+
+        total_cycles += job->executed;
+        failed += job->status != 0;
+
+        free(job->rom_filename);
+        free(job->input_filename);
+    }
+
+    double seconds = elapsed / 1e9;
+    printf("jobs=%d failed=%d threads=%d steals=%llu seed=%llu\n", pool.num_jobs, failed, num_threads, total_steals, (unsigned long long)seed);
+    printf("cycles=%llu seconds=%.6f ips=%.0f\n", total_cycles, seconds, seconds > 0 ? total_cycles / seconds : 0.0);
+
+    for (int w = 0; w < num_threads; w++)
+    {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].jobs);
+    }
+    free(pool.deques);
+    free(workers);
+    free(pool.jobs);
+
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,248 @@
+#include "chip8.h"
+
+// longest run of entries cached as one block
+const unsigned int BCACHE_MAX_BLOCK = 32;
+
+void chip8_bcache_flush(struct chip8_data *chip)
+{
+    memset(chip->bcache.block_len, 0, sizeof(chip->bcache.block_len));
+    memset(chip->bcache.code, 0, sizeof(chip->bcache.code));
+
+    if (chip->jit != NULL)
+    {
+        chip8_jit_flush(chip->jit);
+    }
+
+    // everything that can change code comes through here
+    chip->aot_stale = 1;
+}
+
+// Called after every store to memory. Rewriting a byte that a cached block
+// was decoded from drops the whole cache; ROMs rarely do it, so a coarse
+// flush keeps the common path down to a bit test.
+void chip8_bcache_write(struct chip8_data *chip, uint16_t addr, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; i++)
+    {
+        uint16_t byte = (addr + i) & 0xFFF;
+        if (chip->bcache.code[byte >> 3] & (1 << (byte & 7)))
+        {
+            chip8_bcache_flush(chip);
+            return;
+        }
+    }
+}
+
+static inline unsigned int chip8_insn_cycles(uint8_t op)
+{
+    switch (op)
+    {
+    case CHIP8_OP_Annn_Dxyn:
+    case CHIP8_OP_7xkk_3xkk:
+    case CHIP8_OP_Fx07_3xkk:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+// Anything that may leave the straight-line path ends a block, as do stores
+// that could rewrite the rest of it.
+static inline int chip8_insn_ends_block(uint8_t op)
+{
+    switch (op)
+    {
+    case CHIP8_OP_invalid:
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_1nnn:
+    case CHIP8_OP_2nnn:
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_Bnnn:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+    case CHIP8_OP_Fx0A:
+    case CHIP8_OP_00FD:
+    case CHIP8_OP_Fx33:
+    case CHIP8_OP_Fx55:
+    case CHIP8_OP_7xkk_3xkk:
+    case CHIP8_OP_Fx07_3xkk:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline uint16_t chip8_bcache_opcode(struct chip8_data *chip, uint16_t addr)
+{
+    return (chip->mem[addr] << 8) | chip->mem[addr + 1];
+}
+
+// Merges in with the instruction after it when the pair has a fused form.
+static void chip8_bcache_fuse(struct chip8_insn *in, const struct chip8_insn *next)
+{
+    if (in->op == CHIP8_OP_Annn && next->op == CHIP8_OP_Dxyn)
+    {
+        in->op = CHIP8_OP_Annn_Dxyn;
+        in->x = next->x;
+        in->y = next->y;
+        in->n = next->n;
+    }
+    else if (in->op == CHIP8_OP_7xkk && next->op == CHIP8_OP_3xkk)
+    {
+        in->op = CHIP8_OP_7xkk_3xkk;
+        in->y = next->x;
+        in->nnn = next->kk;
+    }
+    else if (in->op == CHIP8_OP_Fx07 && next->op == CHIP8_OP_3xkk)
+    {
+        in->op = CHIP8_OP_Fx07_3xkk;
+        in->y = next->x;
+        in->kk = next->kk;
+    }
+}
+
+static void chip8_bcache_build(struct chip8_data *chip, uint16_t start)
+{
+    struct chip8_bcache *bc = &chip->bcache;
+    unsigned int len = 0;
+    unsigned int cycles = 0;
+    uint16_t addr = start;
+
+    while (len < BCACHE_MAX_BLOCK && addr + 2 <= 0x1000)
+    {
+        struct chip8_insn *in = &bc->insns[addr];
+        *in = chip8_insn_table[chip8_bcache_opcode(chip, addr)];
+
+        if (addr + 4 <= 0x1000)
+        {
+            chip8_bcache_fuse(in, &chip8_insn_table[chip8_bcache_opcode(chip, addr + 2)]);
+        }
+
+        unsigned int width = 2 * chip8_insn_cycles(in->op);
+        for (unsigned int i = 0; i < width; i++)
+        {
+            bc->code[(addr + i) >> 3] |= 1 << ((addr + i) & 7);
+        }
+
+        len++;
+        cycles += chip8_insn_cycles(in->op);
+        addr += width;
+
+        if (chip8_insn_ends_block(in->op))
+        {
+            break;
+        }
+    }
+
+    bc->block_len[start] = len;
+    bc->block_cycles[start] = cycles;
+}
+
+template <unsigned int Q>
+static inline void chip8_exec_insn(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    switch (in->op)
+    {
+#define X(name)                       \
+    case CHIP8_OP_##name:             \
+        chip8_op_##name<Q>(chip, in); \
+        break;
+        CHIP8_OPCODES(X)
+#undef X
+    }
+}
+
+template <unsigned int Q>
+void chip8_run_block(struct chip8_data *chip, unsigned long long cycles)
+{
+    struct chip8_bcache *bc = &chip->bcache;
+    const struct chip8_insn *in;
+    unsigned int remaining;
+
+#if defined(__GNUC__)
+    static void *const op_labels[CHIP8_OP_COUNT] = {
+#define X(name) &&op_##name,
+        CHIP8_OPCODES(X)
+#undef X
+    };
+#endif
+
+next_block:
+    while (cycles > 0)
+    {
+        // everything that parks ends its block, so this is the first
+        // chance to see it
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+            continue;
+        }
+
+        uint16_t start = chip->pc;
+
+        if (start <= 0xFFE && bc->block_len[start] == 0)
+        {
+            chip8_bcache_build(chip, start);
+        }
+
+        // past the end of memory, or not enough budget left for the whole
+        // block: fall back to one instruction at a time
+        if (start > 0xFFE || bc->block_len[start] == 0 || bc->block_cycles[start] > cycles)
+        {
+            in = chip8_fetch_insn(chip);
+            chip8_exec_insn<Q>(chip, in);
+            chip8_tick_timers(chip);
+            cycles--;
+            continue;
+        }
+
+        remaining = bc->block_len[start];
+        cycles -= bc->block_cycles[start];
+        in = &bc->insns[start];
+
+        // only the last entry can look at pc or opcode, so both can be
+        // set up front for where the block ends
+        uint16_t end = start + 2 * bc->block_cycles[start];
+        chip->pc = end;
+        chip->opcode = chip8_bcache_opcode(chip, end - 2);
+
+#if defined(__GNUC__)
+        goto *op_labels[in->op];
+
+        // entries sit at their own address, so a fused pair steps over the
+        // slot of its second opcode
+#define X(name)                                                        \
+    op_##name:                                                         \
+        chip8_op_##name<Q>(chip, in);                                  \
+        chip8_tick_timers(chip);                                       \
+        if (chip8_insn_cycles(CHIP8_OP_##name) == 2)                   \
+            chip8_tick_timers(chip);                                   \
+        if (--remaining == 0)                                          \
+            goto next_block;                                           \
+        in += 2 * chip8_insn_cycles(CHIP8_OP_##name);                  \
+        goto *op_labels[in->op];
+        CHIP8_OPCODES(X)
+#undef X
+#else
+        for (;;)
+        {
+            unsigned int in_cycles = chip8_insn_cycles(in->op);
+
+            chip8_exec_insn<Q>(chip, in);
+            for (unsigned int t = in_cycles; t > 0; t--)
+            {
+                chip8_tick_timers(chip);
+            }
+
+            if (--remaining == 0)
+            {
+                break;
+            }
+            in += 2 * in_cycles;
+        }
+#endif
+    }
+}
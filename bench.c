@@ -0,0 +1,470 @@
+#include "headless.h"
+#include <math.h>
+
+static const char *const bench_engine_names[] = {"switch", "table", "block", "jit", "aot"};
+const int BENCH_NUM_ENGINES = sizeof(bench_engine_names) / sizeof(bench_engine_names[0]);
+
+struct bench_result
+{
+    int status;
+    double ips;
+    double fps;
+    uint64_t vid_hash;
+    uint64_t mem_hash;
+};
+
+// Runs one ROM from a fixed RNG seed so every engine sees the same program.
+static void bench_run(const char *rom_filename, int engine, unsigned long long cycles, unsigned int ips, struct bench_result *result)
+{
+    struct chip8_data *chip = chip8_create();
+    long long elapsed = 0;
+
+    int status = chip8_load_rom(chip, rom_filename);
+    if (status == CHIP8_OK)
+    {
+        chip->engine = engine;
+        chip->ips = ips;
+        chip8_seed(chip, 1);
+
+        long long start_time = time_nanos();
+        status = chip8_step(chip, cycles);
+        if (status == CHIP8_OK)
+        {
+            elapsed = time_nanos() - start_time;
+        }
+    }
+
+    result->status = status;
+    result->ips = elapsed > 0 ? cycles / (elapsed / 1e9) : 0.0;
+    result->fps = elapsed > 0 ? chip->frames / (elapsed / 1e9) : 0.0;
+    result->vid_hash = chip8_display_hash(chip);
+    result->mem_hash = chip8_hash(chip->mem, sizeof(chip->mem));
+
+    chip8_destroy(chip);
+}
+
+int bench_engines_main(unsigned long long cycles, unsigned int ips, char **rom_filenames, int num_roms)
+{
+    struct bench_result results[BENCH_NUM_ENGINES];
+    double total_ips[BENCH_NUM_ENGINES] = {0};
+    int num_measured = 0;
+    int mismatches = 0;
+
+    printf("%-6s %-5s", "status", "match");
+    for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+    {
+        printf(" %9s", bench_engine_names[e]);
+    }
+    printf("  rom\n");
+
+    for (int r = 0; r < num_roms; r++)
+    {
+        for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+        {
+            bench_run(rom_filenames[r], chip8_parse_engine(bench_engine_names[e]), cycles, ips, &results[e]);
+        }
+
+        if (results[0].status != 0)
+        {
+            printf("%-6s %-5s", "fault", "-");
+            for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+            {
+                printf(" %9s", "-");
+            }
+            printf("  %s\n", rom_filenames[r]);
+            continue;
+        }
+
+        // the switch engine is the reference every other engine must match
+        int match = 1;
+        for (int e = 1; e < BENCH_NUM_ENGINES; e++)
+        {
+            match &= results[e].status == results[0].status &&
+                     results[e].vid_hash == results[0].vid_hash &&
+                     results[e].mem_hash == results[0].mem_hash;
+        }
+
+        printf("%-6s %-5s", "ok", match ? "yes" : "NO");
+        for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+        {
+            printf(" %8.1fM", results[e].ips / 1e6);
+            total_ips[e] += results[e].ips;
+        }
+        printf("  %s\n", rom_filenames[r]);
+
+        num_measured++;
+        mismatches += !match;
+    }
+
+    if (num_measured > 0)
+    {
+        printf("mean:");
+        for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+        {
+            printf(" %s=%.1fM (%.2fx)", bench_engine_names[e], total_ips[e] / num_measured / 1e6, total_ips[e] / total_ips[0]);
+        }
+        printf(" mismatches=%d\n", mismatches);
+    }
+
+    return mismatches ? 2 : 0;
+}
+
+// runs per ROM in a suite, the fastest counts so one descheduling doesn't
+// read as a regression
+const int SUITE_REPEATS = 3;
+
+struct suite_baseline_entry
+{
+    char *rom_filename;
+    int status;
+    double mips;
+    uint64_t vid_hash;
+    uint64_t mem_hash;
+};
+
+struct suite_baseline
+{
+    unsigned long long cycles;
+    unsigned int ips;
+    char engine[16];
+
+    struct suite_baseline_entry *entries;
+    int num_entries;
+};
+
+// A baseline is a header line followed by one line per ROM:
+//   # cycles=<n> ips=<n> engine=<name>
+//   <status> <mips> <vid_hash> <mem_hash> <rom_file_bin>
+static int suite_load_baseline(const char *filename, struct suite_baseline *baseline)
+{
+    memset(baseline, 0, sizeof(*baseline));
+
+    FILE *baseline_file = fopen(filename, "r");
+    if (baseline_file == NULL)
+    {
+        fprintf(stderr, "Could not open baseline '%s', run with --update-baseline to create it\n", filename);
+        return -1;
+    }
+
+    char line[4096];
+    if (fgets(line, sizeof(line), baseline_file) == NULL ||
+        sscanf(line, "# cycles=%llu ips=%u engine=%15s", &baseline->cycles, &baseline->ips, baseline->engine) != 3)
+    {
+        fprintf(stderr, "Baseline '%s' has no header\n", filename);
+        fclose(baseline_file);
+        return -1;
+    }
+
+    int cap_entries = 0;
+    while (fgets(line, sizeof(line), baseline_file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        struct suite_baseline_entry entry;
+        unsigned long long vid_hash, mem_hash;
+        int rom_offset;
+        if (sscanf(line, "%d %lf %llx %llx %n", &entry.status, &entry.mips, &vid_hash, &mem_hash, &rom_offset) != 4)
+        {
+            continue;
+        }
+
+        if (baseline->num_entries == cap_entries)
+        {
+            cap_entries = cap_entries ? cap_entries * 2 : 64;
+            baseline->entries = (struct suite_baseline_entry *)realloc(baseline->entries, cap_entries * sizeof(entry));
+        }
+
+        entry.vid_hash = vid_hash;
+        entry.mem_hash = mem_hash;
+        entry.rom_filename = strdup(line + rom_offset);
+        baseline->entries[baseline->num_entries++] = entry;
+    }
+
+    fclose(baseline_file);
+    return 0;
+}
+
+static const struct suite_baseline_entry *suite_find(const struct suite_baseline *baseline, const char *rom_filename)
+{
+    for (int i = 0; i < baseline->num_entries; i++)
+    {
+        if (strcmp(baseline->entries[i].rom_filename, rom_filename) == 0)
+        {
+            return &baseline->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Runs every ROM for a fixed budget from a fixed seed and checks the
+// results against a baseline. Hash or status changes are drift and always
+// fail; a drop in mean throughput beyond tolerance_pct fails as a
+// regression. Per-ROM speed changes are flagged but too noisy to fail on.
+int bench_suite_main(const char *baseline_filename, int update_baseline, double tolerance_pct,
+                     unsigned long long cycles, unsigned int ips, int engine, char **rom_filenames, int num_roms)
+{
+    struct suite_baseline baseline;
+    int have_baseline = 0;
+
+    if (!update_baseline)
+    {
+        if (suite_load_baseline(baseline_filename, &baseline) < 0)
+        {
+            return 1;
+        }
+        if (baseline.cycles != cycles || baseline.ips != ips)
+        {
+            fprintf(stderr, "Baseline was taken with cycles=%llu ips=%u, not cycles=%llu ips=%u\n",
+                    baseline.cycles, baseline.ips, cycles, ips);
+            return 1;
+        }
+        have_baseline = 1;
+    }
+
+    // only the same engine's numbers say anything about speed
+    int compare_speed = have_baseline && strcmp(baseline.engine, bench_engine_names[engine]) == 0;
+
+    FILE *new_baseline = NULL;
+    if (update_baseline)
+    {
+        new_baseline = fopen(baseline_filename, "w");
+        if (new_baseline == NULL)
+        {
+            fprintf(stderr, "Could not create baseline '%s'\n", baseline_filename);
+            return 1;
+        }
+        fprintf(new_baseline, "# cycles=%llu ips=%u engine=%s\n", cycles, ips, bench_engine_names[engine]);
+    }
+
+    printf("%-6s %-5s %-5s %9s %11s %-16s %-16s  %s\n", "status", "hash", "speed", "mips", "fps", "vid_hash", "mem_hash", "rom");
+
+    double log_ratio_sum = 0.0;
+    int num_compared = 0;
+    int drifted = 0;
+
+    for (int r = 0; r < num_roms; r++)
+    {
+        struct bench_result result;
+        struct bench_result best;
+
+        for (int i = 0; i < SUITE_REPEATS; i++)
+        {
+            bench_run(rom_filenames[r], engine, cycles, ips, &result);
+            if (i == 0 || result.ips > best.ips)
+            {
+                best = result;
+            }
+        }
+
+        double mips = best.ips / 1e6;
+        const char *hash_flag = "-";
+        const char *speed_flag = "-";
+
+        const struct suite_baseline_entry *entry = have_baseline ? suite_find(&baseline, rom_filenames[r]) : NULL;
+        if (have_baseline && entry == NULL)
+        {
+            hash_flag = "NEW";
+        }
+        else if (entry != NULL)
+        {
+            int same = entry->status == best.status && entry->vid_hash == best.vid_hash && entry->mem_hash == best.mem_hash;
+            hash_flag = same ? "ok" : "DRIFT";
+            drifted += !same;
+
+            if (compare_speed && best.status == 0 && entry->mips > 0 && mips > 0)
+            {
+                double ratio = mips / entry->mips;
+                log_ratio_sum += log(ratio);
+                num_compared++;
+
+                speed_flag = ratio < 1.0 - tolerance_pct / 100 ? "SLOW" : ratio > 1.0 + tolerance_pct / 100 ? "fast" : "ok";
+            }
+        }
+
+        printf("%-6d %-5s %-5s %9.2f %11.0f %016llx %016llx  %s\n", best.status, hash_flag, speed_flag, mips, best.fps,
+               (unsigned long long)best.vid_hash, (unsigned long long)best.mem_hash, rom_filenames[r]);
+
+        if (new_baseline != NULL)
+        {
+            fprintf(new_baseline, "%d %.2f %016llx %016llx %s\n", best.status, mips,
+                    (unsigned long long)best.vid_hash, (unsigned long long)best.mem_hash, rom_filenames[r]);
+        }
+    }
+
+    int regressed = 0;
+    if (num_compared > 0)
+    {
+        double speedup = exp(log_ratio_sum / num_compared);
+        regressed = speedup < 1.0 - tolerance_pct / 100;
+        printf("speed vs baseline: %.3fx over %d roms (geometric mean, tolerance %.0f%%)%s\n",
+               speedup, num_compared, tolerance_pct, regressed ? " REGRESSION" : "");
+    }
+    if (have_baseline)
+    {
+        printf("drifted=%d of %d roms\n", drifted, num_roms);
+
+        for (int i = 0; i < baseline.num_entries; i++)
+        {
+            free(baseline.entries[i].rom_filename);
+        }
+        free(baseline.entries);
+    }
+
+    if (new_baseline != NULL)
+    {
+        fclose(new_baseline);
+        printf("wrote baseline '%s'\n", baseline_filename);
+    }
+
+    if (drifted)
+    {
+        return 2;
+    }
+
+    return regressed ? 3 : 0;
+}
+
+// what --bench-scaler times, every kernel on each
+struct bench_scale_mode
+{
+    int filter;
+    int factor;
+    int scanlines;
+};
+
+static const struct bench_scale_mode bench_scale_modes[] = {
+    {CHIP8_SCALE_NEAREST, 1, 0},
+    {CHIP8_SCALE_NEAREST, 4, 0},
+    {CHIP8_SCALE_NEAREST, 10, 0},
+    {CHIP8_SCALE_NEAREST, 10, 1},
+    {CHIP8_SCALE_SCALE2X, 2, 0},
+    {CHIP8_SCALE_SCALE2X, 10, 0},
+    {CHIP8_SCALE_SCALE3X, 3, 0},
+    {CHIP8_SCALE_SCALE3X, 9, 1},
+};
+const int BENCH_NUM_SCALE_MODES = sizeof(bench_scale_modes) / sizeof(bench_scale_modes[0]);
+const int BENCH_NUM_SCALE_KERNELS = CHIP8_SCALE_KERNEL_AVX2 + 1;
+
+// Runs every ROM for frames 60 Hz frames and scales each one with every
+// mode and kernel, so the display is whatever the ROM draws. Kernels
+// this CPU lacks are skipped, and all the others have to agree.
+int bench_scaler_main(unsigned long long frames, unsigned int ips, char **rom_filenames, int num_roms)
+{
+    double mode_pixels[BENCH_NUM_SCALE_MODES];
+    long long mode_ns[BENCH_NUM_SCALE_MODES][BENCH_NUM_SCALE_KERNELS];
+    unsigned long long mode_frames = 0;
+    long long emulate_ns = 0;
+    int mismatches = 0;
+
+    memset(mode_pixels, 0, sizeof(mode_pixels));
+    memset(mode_ns, 0, sizeof(mode_ns));
+
+    size_t max_pixels = (size_t)VIDEO_MAX_WIDTH * VIDEO_MAX_HEIGHT * CHIP8_SCALE_MAX_FACTOR * CHIP8_SCALE_MAX_FACTOR;
+    uint32_t *first_pixels = (uint32_t *)malloc(max_pixels * sizeof(uint32_t));
+    uint32_t *pixels = (uint32_t *)malloc(max_pixels * sizeof(uint32_t));
+
+    // faulted in up front so no kernel's time includes it
+    memset(first_pixels, 0, max_pixels * sizeof(uint32_t));
+    memset(pixels, 0, max_pixels * sizeof(uint32_t));
+
+    for (int r = 0; r < num_roms; r++)
+    {
+        struct chip8_data *chip = chip8_create();
+        if (chip8_load_rom(chip, rom_filenames[r]) != CHIP8_OK)
+        {
+            chip8_destroy(chip);
+            continue;
+        }
+        chip->ips = ips;
+        chip8_seed(chip, 1);
+
+        for (unsigned long long frame = 0; frame < frames; frame++)
+        {
+            long long start_time = time_nanos();
+            if (chip8_run_frame(chip) != CHIP8_OK)
+            {
+                break;
+            }
+            emulate_ns += time_nanos() - start_time;
+            mode_frames++;
+
+            for (int m = 0; m < BENCH_NUM_SCALE_MODES; m++)
+            {
+                const struct bench_scale_mode *mode = &bench_scale_modes[m];
+                struct chip8_scaler scaler;
+                chip8_scaler_init(&scaler, mode->filter, mode->factor, mode->scanlines);
+
+                int width = chip->vid_width * mode->factor;
+                int height = chip->vid_height * mode->factor;
+                uint32_t *out = first_pixels;
+
+                for (int k = 0; k < BENCH_NUM_SCALE_KERNELS; k++)
+                {
+                    if (chip8_scaler_set_kernel(&scaler, k) < 0)
+                    {
+                        continue;
+                    }
+
+                    start_time = time_nanos();
+                    chip8_scale(&scaler, chip, out, width * sizeof(uint32_t));
+                    mode_ns[m][k] += time_nanos() - start_time;
+
+                    // every kernel after the first is checked against it
+                    if (out == pixels)
+                    {
+                        mismatches += memcmp(pixels, first_pixels, (size_t)width * height * sizeof(uint32_t)) != 0;
+                    }
+                    out = pixels;
+                }
+
+                mode_pixels[m] += (double)width * height;
+            }
+        }
+
+        chip8_destroy(chip);
+    }
+
+    free(first_pixels);
+    free(pixels);
+
+    if (mode_frames == 0)
+    {
+        fprintf(stderr, "No frames to scale\n");
+        return 1;
+    }
+
+    // kernels in megapixels per second, us/frame for the one
+    // chip8_scaler_init() picks
+    printf("%-8s %6s %-9s", "filter", "factor", "scanlines");
+    for (int k = 0; k < BENCH_NUM_SCALE_KERNELS; k++)
+    {
+        printf(" %9s", chip8_scale_kernel_name(k));
+    }
+    printf(" %8s %9s\n", "speedup", "us/frame");
+
+    for (int m = 0; m < BENCH_NUM_SCALE_MODES; m++)
+    {
+        const struct bench_scale_mode *mode = &bench_scale_modes[m];
+        struct chip8_scaler scaler;
+        chip8_scaler_init(&scaler, mode->filter, mode->factor, mode->scanlines);
+
+        printf("%-8s %6d %-9s", chip8_scale_filter_name(mode->filter), mode->factor, mode->scanlines ? "yes" : "no");
+        for (int k = 0; k < BENCH_NUM_SCALE_KERNELS; k++)
+        {
+            if (mode_ns[m][k] > 0)
+            {
+                printf(" %8.0fM", mode_pixels[m] / (mode_ns[m][k] / 1e9) / 1e6);
+            }
+            else
+            {
+                printf(" %9s", "-");
+            }
+        }
+        printf(" %7.2fx %9.1f\n", (double)mode_ns[m][CHIP8_SCALE_KERNEL_SCALAR] / mode_ns[m][scaler.kernel],
+               mode_ns[m][scaler.kernel] / 1e3 / mode_frames);
+    }
+
+    printf("frames=%llu emulate_us/frame=%.1f mismatches=%d\n", mode_frames, emulate_ns / 1e3 / mode_frames, mismatches);
+    return mismatches ? 2 : 0;
+}
@@ -0,0 +1,512 @@
+#include "chip8.h"
+
+// Frames reach the encoder through a ring of display snapshots. The
+// emulation thread fills the slot at head in place and publishes it, the
+// encoder scales and encodes the slot at tail in place and frees it. A
+// snapshot is the 1 KB display, so scaled frames never leave the encoder
+// thread, and the emulation side costs the same at any capture size.
+
+static int capture_format_for(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext != NULL && strcmp(ext, ".y4m") == 0)
+    {
+        return CHIP8_CAPTURE_Y4M;
+    }
+
+    if (ext != NULL && strcmp(ext, ".gif") == 0)
+    {
+        return CHIP8_CAPTURE_GIF;
+    }
+
+    return CHIP8_CAPTURE_RAW;
+}
+
+// a failed write is remembered for chip8_capture_close() and the rest
+// are skipped, the encoder keeps draining so the emulation never waits
+static void capture_write(struct chip8_capture *capture, const void *data, size_t len)
+{
+    if (!capture->error && fwrite(data, 1, len, capture->file) != len)
+    {
+        capture->error = 1;
+    }
+    capture->bytes += len;
+}
+
+static void capture_write_u16(struct chip8_capture *capture, unsigned int value)
+{
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    capture_write(capture, bytes, sizeof(bytes));
+}
+
+// Scales a frame into the middle of the canvas, clearing the borders
+// whenever a new display mode changes their size
+static void capture_render(struct chip8_capture *capture, const struct chip8_capture_frame *frame)
+{
+    int factor = chip8_scale_fit(capture->filter, frame->vid_width, frame->vid_height, capture->width, capture->height);
+    int scaled_width = frame->vid_width * factor;
+    int scaled_height = frame->vid_height * factor;
+
+    if (scaled_width != capture->scaled_width || scaled_height != capture->scaled_height)
+    {
+        chip8_scaler_init(&capture->scaler, capture->filter, factor, capture->scanlines);
+        capture->scaled_width = scaled_width;
+        capture->scaled_height = scaled_height;
+
+        for (int i = 0; i < capture->width * capture->height; i++)
+        {
+            capture->canvas[i] = capture->scaler.off_color;
+        }
+    }
+
+    int x = (capture->width - scaled_width) / 2;
+    int y = (capture->height - scaled_height) / 2;
+    chip8_scale_display(&capture->scaler, frame->vid, frame->vid_right, frame->vid_width, frame->vid_height,
+                        capture->canvas + y * capture->width + x, capture->width * sizeof(uint32_t));
+}
+
+static void capture_encode_raw(struct chip8_capture *capture)
+{
+    int pixels = capture->width * capture->height;
+
+    for (int i = 0; i < pixels; i++)
+    {
+        uint32_t color = capture->canvas[i];
+        capture->encoded[4 * i] = color >> 24;
+        capture->encoded[4 * i + 1] = color >> 16;
+        capture->encoded[4 * i + 2] = color >> 8;
+        capture->encoded[4 * i + 3] = color;
+    }
+
+    capture_write(capture, capture->encoded, pixels * 4);
+}
+
+static uint8_t capture_clamp(int value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+// full range BT.601, what C420jpeg means, chroma from each 2x2 block
+static void capture_encode_y4m(struct chip8_capture *capture)
+{
+    int width = capture->width;
+    int height = capture->height;
+    uint8_t *luma = capture->encoded;
+    uint8_t *cb = luma + width * height;
+    uint8_t *cr = cb + width * height / 4;
+
+    for (int i = 0; i < width * height; i++)
+    {
+        uint32_t color = capture->canvas[i];
+        luma[i] = (77 * (color >> 24) + 150 * ((color >> 16) & 0xFF) + 29 * ((color >> 8) & 0xFF) + 128) >> 8;
+    }
+
+    for (int y = 0; y < height; y += 2)
+    {
+        for (int x = 0; x < width; x += 2)
+        {
+            int r = 0, g = 0, b = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                uint32_t color = capture->canvas[(y + i / 2) * width + x + i % 2];
+                r += color >> 24;
+                g += (color >> 16) & 0xFF;
+                b += (color >> 8) & 0xFF;
+            }
+
+            int block = (y / 2) * (width / 2) + x / 2;
+            cb[block] = capture_clamp(128 + ((-43 * r - 85 * g + 128 * b) / 4 >> 8));
+            cr[block] = capture_clamp(128 + ((128 * r - 107 * g - 21 * b) / 4 >> 8));
+        }
+    }
+
+    capture_write(capture, "FRAME\n", 6);
+    capture_write(capture, capture->encoded, width * height * 3 / 2);
+}
+
+// GIF's LZW output, codes packed LSB first into sub-blocks of at most
+// 255 bytes each behind a length byte
+struct capture_lzw
+{
+    uint8_t *out;
+    size_t len;
+    size_t block_start;
+    uint32_t bits;
+    int num_bits;
+};
+
+static void capture_lzw_byte(struct capture_lzw *lzw, uint8_t byte)
+{
+    if (lzw->len == lzw->block_start + 256)
+    {
+        lzw->out[lzw->block_start] = 255;
+        lzw->block_start = lzw->len++;
+    }
+    lzw->out[lzw->len++] = byte;
+}
+
+static void capture_lzw_code(struct capture_lzw *lzw, unsigned int code, int size)
+{
+    lzw->bits |= code << lzw->num_bits;
+    lzw->num_bits += size;
+
+    while (lzw->num_bits >= 8)
+    {
+        capture_lzw_byte(lzw, lzw->bits & 0xFF);
+        lzw->bits >>= 8;
+        lzw->num_bits -= 8;
+    }
+}
+
+// Compresses 2-bit palette indexes into out, ending with the empty
+// sub-block. Returns the bytes written.
+static size_t capture_gif_lzw(const uint8_t *indexes, size_t count, uint8_t *out)
+{
+    const unsigned int GIF_CLEAR = 4;
+    const unsigned int GIF_END = 5;
+    const int GIF_MIN_CODE_SIZE = 3;
+
+    // the dictionary as a trie, next[code][index] is code's string plus
+    // index, 0 where that isn't in it yet
+    uint16_t next[4096][4];
+    struct capture_lzw lzw = {out, 1, 0, 0, 0};
+    int size = GIF_MIN_CODE_SIZE;
+    unsigned int max_code = GIF_END;
+
+    memset(next, 0, sizeof(next));
+    capture_lzw_code(&lzw, GIF_CLEAR, size);
+
+    unsigned int code = indexes[0];
+    for (size_t i = 1; i < count; i++)
+    {
+        if (next[code][indexes[i]] != 0)
+        {
+            code = next[code][indexes[i]];
+            continue;
+        }
+
+        capture_lzw_code(&lzw, code, size);
+        next[code][indexes[i]] = ++max_code;
+        if (max_code >= (1u << size))
+        {
+            size++;
+        }
+
+        // a full dictionary starts over
+        if (max_code == 4095)
+        {
+            capture_lzw_code(&lzw, GIF_CLEAR, size);
+            memset(next, 0, sizeof(next));
+            size = GIF_MIN_CODE_SIZE;
+            max_code = GIF_END;
+        }
+
+        code = indexes[i];
+    }
+
+    capture_lzw_code(&lzw, code, size);
+    capture_lzw_code(&lzw, GIF_END, size);
+    if (lzw.num_bits > 0)
+    {
+        capture_lzw_byte(&lzw, lzw.bits);
+    }
+
+    // close the last sub-block, dropping it if it never got a byte
+    if (lzw.len == lzw.block_start + 1)
+    {
+        lzw.len--;
+    }
+    else
+    {
+        lzw.out[lzw.block_start] = lzw.len - lzw.block_start - 1;
+    }
+    lzw.out[lzw.len++] = 0;
+
+    return lzw.len;
+}
+
+// palette order the GIF header writes: off, on, then their scanline shades
+static void capture_gif_palette(const struct chip8_scaler *scaler, uint32_t colors[4])
+{
+    colors[0] = scaler->off_color;
+    colors[1] = scaler->on_color;
+    colors[2] = scale_dim(scaler->off_color);
+    colors[3] = scale_dim(scaler->on_color);
+}
+
+static void capture_gif_header(struct chip8_capture *capture)
+{
+    // 4 color global table, 2 bits of color resolution
+    capture_write(capture, "GIF89a", 6);
+    capture_write_u16(capture, capture->width);
+    capture_write_u16(capture, capture->height);
+    capture_write(capture, "\x91\x00\x00", 3);
+
+    uint32_t colors[4];
+    capture_gif_palette(&capture->scaler, colors);
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t rgb[3] = {(uint8_t)(colors[i] >> 24), (uint8_t)(colors[i] >> 16), (uint8_t)(colors[i] >> 8)};
+        capture_write(capture, rgb, sizeof(rgb));
+    }
+
+    // loop forever
+    capture_write(capture, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+}
+
+static void capture_gif_write(struct chip8_capture *capture, const struct chip8_capture_frame *frame, unsigned int delay_cs)
+{
+    capture_render(capture, frame);
+
+    uint32_t colors[4];
+    capture_gif_palette(&capture->scaler, colors);
+
+    int pixels = capture->width * capture->height;
+    for (int i = 0; i < pixels; i++)
+    {
+        uint32_t color = capture->canvas[i];
+        capture->gif_indexes[i] = color == colors[1] ? 1 : color == colors[0] ? 0 : color == colors[3] ? 3 : 2;
+    }
+
+    // graphic control: left in place, delay_cs hundredths of a second
+    capture_write(capture, "\x21\xF9\x04\x04", 4);
+    capture_write_u16(capture, delay_cs);
+    capture_write(capture, "\x00\x00", 2);
+
+    // the whole canvas, no local palette, LZW from 2-bit codes
+    capture_write(capture, "\x2C\x00\x00\x00\x00", 5);
+    capture_write_u16(capture, capture->width);
+    capture_write_u16(capture, capture->height);
+    capture_write(capture, "\x00\x02", 2);
+
+    capture_write(capture, capture->encoded, capture_gif_lzw(capture->gif_indexes, pixels, capture->encoded));
+}
+
+static int capture_same_display(const struct chip8_capture_frame *a, const struct chip8_capture_frame *b)
+{
+    return a->vid_width == b->vid_width && a->vid_height == b->vid_height &&
+           memcmp(a->vid, b->vid, sizeof(a->vid)) == 0 && memcmp(a->vid_right, b->vid_right, sizeof(a->vid_right)) == 0;
+}
+
+// hundredths of a second from the start to 60 Hz frame n
+static unsigned long long capture_gif_cs(unsigned long long n)
+{
+    return n * 100 / 60;
+}
+
+// GIF delays count hundredths of a second and players stretch any under
+// 2 to a tenth, so 60 fps can't be shown as it is. A picture is held
+// until the display changes and written with the time it stayed up; one
+// that would be up for less than 2 hundredths gives way to the next.
+static void capture_encode_gif(struct chip8_capture *capture, const struct chip8_capture_frame *frame)
+{
+    if (capture->gif_have_pending)
+    {
+        if (capture_same_display(frame, &capture->gif_pending))
+        {
+            return;
+        }
+
+        unsigned long long shown = capture_gif_cs(capture->frames) - capture_gif_cs(capture->gif_pending_start);
+        if (shown >= 2)
+        {
+            capture_gif_write(capture, &capture->gif_pending, shown);
+            capture->gif_pending_start = capture->frames;
+        }
+    }
+    else
+    {
+        capture->gif_pending_start = capture->frames;
+    }
+
+    capture->gif_pending = *frame;
+    capture->gif_have_pending = 1;
+}
+
+static void capture_encode(struct chip8_capture *capture, const struct chip8_capture_frame *frame)
+{
+    switch (capture->format)
+    {
+    case CHIP8_CAPTURE_Y4M:
+        capture_render(capture, frame);
+        capture_encode_y4m(capture);
+        break;
+    case CHIP8_CAPTURE_GIF:
+        capture_encode_gif(capture, frame);
+        break;
+    default:
+        capture_render(capture, frame);
+        capture_encode_raw(capture);
+        break;
+    }
+}
+
+static void *capture_encoder_main(void *arg)
+{
+    struct chip8_capture *capture = (struct chip8_capture *)arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&capture->lock);
+        while (capture->head == capture->tail && !capture->closing)
+        {
+            pthread_cond_wait(&capture->changed, &capture->lock);
+        }
+        int drained = capture->head == capture->tail;
+        pthread_mutex_unlock(&capture->lock);
+
+        if (drained)
+        {
+            break;
+        }
+
+        long long start_time = time_nanos();
+        capture_encode(capture, &capture->queue[capture->tail % CHIP8_CAPTURE_QUEUE]);
+        capture->encode_ns += time_nanos() - start_time;
+        capture->frames++;
+
+        pthread_mutex_lock(&capture->lock);
+        capture->tail++;
+        pthread_cond_signal(&capture->changed);
+        pthread_mutex_unlock(&capture->lock);
+    }
+
+    return NULL;
+}
+
+// Output frames are scale times the largest display mode, the format
+// comes from the file name, see enum chip8_capture_format
+int chip8_capture_open(struct chip8_capture *capture, const char *filename, int filter, int scale, int scanlines)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->format = capture_format_for(filename);
+    capture->width = VIDEO_MAX_WIDTH * scale;
+    capture->height = VIDEO_MAX_HEIGHT * scale;
+    capture->filter = filter;
+    capture->scanlines = scanlines;
+
+    // the widest display mode has to fit at the filter's own factor
+    int widest_factor = chip8_scale_fit(filter, VIDEO_MAX_WIDTH, VIDEO_MAX_HEIGHT, capture->width, capture->height);
+    if (chip8_scaler_init(&capture->scaler, filter, widest_factor, scanlines) < 0)
+    {
+        return -1;
+    }
+    if (scale < 1 || scale > CHIP8_SCALE_MAX_FACTOR || widest_factor > scale)
+    {
+        fprintf(stderr, "Capture scale %d is outside %d to %d for %s\n", scale, widest_factor, CHIP8_SCALE_MAX_FACTOR,
+                chip8_scale_filter_name(filter));
+        return -1;
+    }
+
+    capture->file = fopen(filename, "wb");
+    if (capture->file == NULL)
+    {
+        fprintf(stderr, "Could not create capture file '%s'\n", filename);
+        return -1;
+    }
+
+    size_t pixels = (size_t)capture->width * capture->height;
+    capture->canvas = (uint32_t *)malloc(pixels * sizeof(uint32_t));
+    capture->encoded = (uint8_t *)malloc(pixels * 4);
+    if (capture->format == CHIP8_CAPTURE_GIF)
+    {
+        capture->gif_indexes = (uint8_t *)malloc(pixels);
+        capture_gif_header(capture);
+    }
+    else if (capture->format == CHIP8_CAPTURE_Y4M)
+    {
+        char header[64];
+        int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", capture->width, capture->height);
+        capture_write(capture, header, len);
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->changed, NULL);
+    pthread_create(&capture->thread, NULL, capture_encoder_main, capture);
+
+    return 0;
+}
+
+// Queues the display as one frame, once per 60 Hz frame. Waits only if
+// the encoder is a whole queue behind.
+void chip8_capture_push(struct chip8_capture *capture, const struct chip8_data *chip)
+{
+    pthread_mutex_lock(&capture->lock);
+    if (capture->head - capture->tail == CHIP8_CAPTURE_QUEUE)
+    {
+        long long start_time = time_nanos();
+        capture->stalls++;
+        while (capture->head - capture->tail == CHIP8_CAPTURE_QUEUE)
+        {
+            pthread_cond_wait(&capture->changed, &capture->lock);
+        }
+        capture->stall_ns += time_nanos() - start_time;
+    }
+    pthread_mutex_unlock(&capture->lock);
+
+    // the slot at head is this thread's until head moves past it
+    struct chip8_capture_frame *frame = &capture->queue[capture->head % CHIP8_CAPTURE_QUEUE];
+    memcpy(frame->vid, chip->vid, sizeof(frame->vid));
+    memcpy(frame->vid_right, chip->vid_right, sizeof(frame->vid_right));
+    frame->vid_width = chip->vid_width;
+    frame->vid_height = chip->vid_height;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head++;
+    if (capture->head - capture->tail > capture->max_queued)
+    {
+        capture->max_queued = capture->head - capture->tail;
+    }
+    pthread_cond_signal(&capture->changed);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+// Waits for the encoder to finish every queued frame, then closes the file
+int chip8_capture_close(struct chip8_capture *capture)
+{
+    if (capture->file == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&capture->lock);
+    capture->closing = 1;
+    pthread_cond_signal(&capture->changed);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->thread, NULL);
+
+    if (capture->format == CHIP8_CAPTURE_GIF)
+    {
+        if (capture->gif_have_pending)
+        {
+            unsigned long long shown = capture_gif_cs(capture->frames) - capture_gif_cs(capture->gif_pending_start);
+            capture_gif_write(capture, &capture->gif_pending, shown < 2 ? 2 : shown);
+        }
+        capture_write(capture, "\x3B", 1);
+    }
+
+    int ok = !capture->error;
+    ok &= fclose(capture->file) == 0;
+    capture->file = NULL;
+
+    pthread_mutex_destroy(&capture->lock);
+    pthread_cond_destroy(&capture->changed);
+    free(capture->canvas);
+    free(capture->encoded);
+    free(capture->gif_indexes);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write the capture file\n");
+    }
+
+    return ok ? 0 : -1;
+}
+
+void chip8_capture_report(const struct chip8_capture *capture, FILE *out)
+{
+    fprintf(out, "capture_frames=%llu capture_bytes=%llu capture_stalls=%llu capture_stall_ms=%.2f capture_max_queued=%u capture_encode_us=%.1f\n",
+            capture->frames, capture->bytes, capture->stalls, capture->stall_ns / 1e6, capture->max_queued,
+            capture->frames > 0 ? capture->encode_ns / 1e3 / capture->frames : 0.0);
+}
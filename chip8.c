@@ -1,91 +1,397 @@
 #include "chip8.h"
 
-void chip8_init()
+// Power-on reset: everything but memory, which keeps the fonts and ROM,
+// and the quirk profile the ROM was loaded with
+void chip8_init(struct chip8_data *chip)
 {
-    extern const unsigned int ROM_OFFSET;
-    g_chip8_data.pc = ROM_OFFSET;
+    memset(chip->regs, 0, sizeof(chip->regs));
+    memset(chip->stk, 0, sizeof(chip->stk));
+    memset(chip->keys, 0, sizeof(chip->keys));
+    memset(chip->vid, 0, sizeof(chip->vid));
+    memset(chip->vid_right, 0, sizeof(chip->vid_right));
+    memset(chip->rpl, 0, sizeof(chip->rpl));
+    chip->idx = 0;
+    chip->sp = 0;
+    chip->delTime = 0;
+    chip->sfxTime = 0;
+    chip->opcode = 0;
+    chip->parked = 0;
+    chip->pc = ROM_OFFSET;
+    chip->ips = CHIP8_DEFAULT_IPS;
+    chip->timer_acc = 0;
+    chip->frames = 0;
+    chip->vid_width = VIDEO_WIDTH;
+    chip->vid_height = VIDEO_HEIGHT;
+    chip->vid_dirty = 1;
+    chip->status = CHIP8_OK;
+    chip8_bcache_flush(chip);
+    chip8_seed(chip, time(NULL));
 
-    srand(time(NULL));
+#ifdef CHIP8_PROFILE
+    chip8_profile_init(chip);
+#endif
 }
 
-void chip8_print_state()
+// Same seed, same Cxkk results, whatever else the host is doing
+void chip8_seed(struct chip8_data *chip, uint64_t seed)
+{
+    chip->rng = seed;
+}
+
+// Switches to another CHIP8_QUIRKS_* profile. Cached and compiled code was
+// built for the old one, so it all goes.
+void chip8_set_quirks(struct chip8_data *chip, int quirks)
+{
+    chip->quirks = quirks;
+    chip8_bcache_flush(chip);
+}
+
+void chip8_print_state(struct chip8_data *chip)
 {
     for (int i = 0; i < 16; i++)
     {
-        printf("V%d=0x%x\n", i, g_chip8_data.regs[i]);
+        printf("V%d=0x%x\n", i, chip->regs[i]);
     }
 
-    printf("PC=0x%x\n", g_chip8_data.pc);
-    printf("ID=0x%x\n", g_chip8_data.idx);
-    printf("SP=0x%x\n", g_chip8_data.sp);
-    printf("OP=0x%x\n", g_chip8_data.opcode);
+    printf("PC=0x%x\n", chip->pc);
+    printf("ID=0x%x\n", chip->idx);
+    printf("SP=0x%x\n", chip->sp);
+    printf("OP=0x%x\n", chip->opcode);
 }
 
-void chip8_cycle()
+const char *chip8_status_name(int status)
 {
-    g_chip8_data.opcode = (g_chip8_data.mem[g_chip8_data.pc] << 8) | g_chip8_data.mem[g_chip8_data.pc + 1];
-    g_chip8_data.pc += 2;
+    switch (status)
+    {
+    case CHIP8_OK:
+        return "OK";
+    case CHIP8_INVALID_OPCODE:
+        return "Invalid opcode";
+    case CHIP8_STACK_OVERFLOW:
+        return "Stack overflow";
+    case CHIP8_STACK_UNDERFLOW:
+        return "Invalid SP during RET";
+    case CHIP8_ROM_TOO_LARGE:
+        return "ROM too large";
+    case CHIP8_IO_ERROR:
+        return "Could not read file";
+    default:
+        return "Unknown status";
+    }
+}
 
-    chip8_decode_execute();
+// Stops a machine that cannot continue. chip8_step() arms fault_jmp to
+// get control back; a bare chip8_run() leaves it NULL and the process
+// exits. Either way a trace gets the faulting instruction first.
+void chip8_fault(struct chip8_data *chip, int status)
+{
+    chip->status = status;
+    if (chip->trace != NULL)
+    {
+        chip8_trace_fault(chip);
+    }
 
-    if (g_chip8_data.delTime > 0)
+    if (chip->fault_jmp != NULL)
     {
-        g_chip8_data.delTime--;
+        longjmp(*chip->fault_jmp, status);
     }
 
-    if (g_chip8_data.sfxTime > 0)
+    fprintf(stderr, "Aborting!\n%s\n", chip8_status_name(status));
+    chip8_print_state(chip);
+    exit(-1);
+}
+
+// Zeroed machine with fonts in memory, ready for a ROM
+struct chip8_data *chip8_create()
+{
+    struct chip8_data *chip = (struct chip8_data *)calloc(1, sizeof(struct chip8_data));
+    if (chip == NULL)
+    {
+        return NULL;
+    }
+
+    chip8_load_fonts(chip);
+    chip8_init(chip);
+    return chip;
+}
+
+void chip8_destroy(struct chip8_data *chip)
+{
+    if (chip != NULL)
     {
-        g_chip8_data.sfxTime--;
+        chip8_free(chip);
+        free(chip);
     }
 }
 
-long long time_millis()
+// chip8_run() with faults returned instead of ending the process. A
+// machine that has faulted stays stopped and returns the same status.
+int chip8_step(struct chip8_data *chip, unsigned long long cycles)
 {
-    struct timeval tv;
+    if (chip->status != CHIP8_OK)
+    {
+        return chip->status;
+    }
+
+    jmp_buf fault_jmp;
+    jmp_buf *outer_jmp = chip->fault_jmp;
+
+    int status = setjmp(fault_jmp);
+    if (status == 0)
+    {
+        chip->fault_jmp = &fault_jmp;
+        chip8_run(chip, cycles);
+    }
 
-    gettimeofday(&tv, NULL);
-    return (((long long)tv.tv_sec) * 1000) + (tv.tv_usec / 1000);
+    chip->fault_jmp = outer_jmp;
+    return status;
 }
 
-int main(int argc, char **argv)
+// Runs up to the next 60 Hz timer tick
+int chip8_run_frame(struct chip8_data *chip)
 {
-    if (argc != 4)
+    return chip8_step(chip, chip8_cycles_to_frame(chip));
+}
+
+// splitmix64, any seed including zero gives a full-period sequence
+static inline uint8_t chip8_random(struct chip8_data *chip)
+{
+    uint64_t z = (chip->rng += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31)) >> 56;
+}
+
+// One 60 Hz frame of emulated time has passed
+static inline void chip8_timer_frame(struct chip8_data *chip, unsigned long long n)
+{
+    chip->delTime = chip->delTime > n ? chip->delTime - n : 0;
+    chip->sfxTime = chip->sfxTime > n ? chip->sfxTime - n : 0;
+    chip->frames += n;
+}
+
+// Advances emulated time by one instruction. Timers tick once every
+// ips / 60 instructions, carrying the remainder so the rate is exact.
+// Forced inline: with an engine per quirk profile GCC runs out of
+// inlining budget and would otherwise call it per instruction.
+__attribute__((always_inline)) static inline void chip8_tick_timers(struct chip8_data *chip)
+{
+    chip->timer_acc += 60;
+    if (chip->timer_acc >= chip->ips)
+    {
+        chip->timer_acc -= chip->ips;
+        chip8_timer_frame(chip, 1);
+
+        // below 60 instructions per second one instruction spans frames
+        while (chip->timer_acc >= chip->ips)
+        {
+            chip->timer_acc -= chip->ips;
+            chip8_timer_frame(chip, 1);
+        }
+    }
+}
+
+// Same as n calls to chip8_tick_timers()
+static inline void chip8_timers_advance(struct chip8_data *chip, unsigned long long n)
+{
+    unsigned long long acc = chip->timer_acc + 60 * n;
+
+    // most calls stay inside the current frame, so keep the divide off
+    // the common path
+    if (acc < chip->ips)
     {
-        fprintf(stderr, "Usage: chip8-emu <video_scale> <delay_ms> <rom_file_bin>\n");
-        return 1;
+        chip->timer_acc = acc;
+        return;
     }
 
-    int video_scale = atoi(argv[1]);
-    int cycle_delay_ms = atoi(argv[2]);
-    const char *rom_filename = argv[3];
+    chip->timer_acc = acc % chip->ips;
+    chip8_timer_frame(chip, acc / chip->ips);
+}
 
-    platform_init("CHIP-8 Emulator", VIDEO_WIDTH * video_scale, VIDEO_HEIGHT * video_scale, VIDEO_WIDTH, VIDEO_HEIGHT);
+// Skips as much of the idle loop at pc as can't change anything but the
+// timers, leaving the machine exactly as executing it would. Returns the
+// instructions skipped, at most cycles.
+//
+// Two kinds of loop park the machine. Fx0A with no key held, 00FD and a
+// 1nnn jumping to itself repeat one instruction until the keys change,
+// which they can't during one chip8_run(), so the whole budget goes. A
+// delay poll
+//   A:   Fx07
+//   A+2: 3xkk
+//   A+4: 1nnn to A
+// runs three instructions a turn until the delay timer reads kk, so the
+// turns before that one are skipped in one go.
+static unsigned long long chip8_unpark(struct chip8_data *chip, unsigned long long cycles)
+{
+    const uint8_t *loop = &chip->mem[chip->pc & 0xFFF];
 
-    chip8_load_fonts();
-    chip8_load_rom(rom_filename);
-    chip8_init();
+    chip->parked = 0;
+    if (chip->pc > 0xFFA || (loop[0] & 0xF0) != 0xF0 || loop[1] != 0x07)
+    {
+        chip8_timers_advance(chip, cycles);
+        chip->idle_cycles += cycles;
+        return cycles;
+    }
 
-    int video_pitch = sizeof(g_chip8_data.vid[0]) * VIDEO_WIDTH;
-    long long last_cycle_time = time_millis();
-    int quit = 0;
+    uint8_t x = loop[0] & 0x0F;
+    uint8_t kk = loop[3];
+    unsigned long long turns = cycles / 3;
 
-    while (!quit)
+    // the turn whose Fx07 first reads kk exits, it and the rest run normally.
+    // At kk that's this turn. Past it, timer_acc is below ips as every tick
+    // leaves it, but a state load or debugger write could break that, so
+    // the count is taken signed and goes no lower than 0.
+    if (chip->delTime == kk)
     {
-        quit = process_input(g_chip8_data.keys);
+        return 0;
+    }
 
-        long long cur_time = time_millis();
-        long long delta = cur_time - last_cycle_time;
-        if (delta > cycle_delay_ms)
+    if (chip->delTime > kk)
+    {
+        long long until_kk = ((chip->delTime - kk) * (long long)chip->ips - (long long)chip->timer_acc + 179) / 180;
+        if (until_kk < 0)
         {
-            last_cycle_time = cur_time;
-            chip8_cycle();
-            platform_update(g_chip8_data.vid, video_pitch);
+            until_kk = 0;
         }
+        if ((unsigned long long)until_kk < turns)
+        {
+            turns = until_kk;
+        }
+    }
+
+    if (turns == 0)
+    {
+        return 0;
+    }
+
+    // Vx holds what the last skipped turn read
+    unsigned long long read_frames = (chip->timer_acc + 180 * (turns - 1)) / chip->ips;
+    chip->regs[x] = read_frames < chip->delTime ? chip->delTime - read_frames : 0;
+
+    chip8_timers_advance(chip, 3 * turns);
+    chip->idle_cycles += 3 * turns;
+    return 3 * turns;
+}
+
+// Instructions left until the timers next tick
+unsigned long long chip8_cycles_to_frame(const struct chip8_data *chip)
+{
+    return (chip->ips - chip->timer_acc + 59) / 60;
+}
+
+// Instructions left until the frame counter reaches frame
+unsigned long long chip8_cycles_until_frame(const struct chip8_data *chip, uint64_t frame)
+{
+    if (frame <= chip->frames)
+    {
+        return 0;
+    }
+
+    return ((frame - chip->frames) * chip->ips - chip->timer_acc + 59) / 60;
+}
+
+template <unsigned int Q>
+void chip8_cycle(struct chip8_data *chip)
+{
+#ifdef CHIP8_PROFILE
+    uint16_t pc = chip->pc;
+    long long start_time = time_nanos();
+#endif
+
+    chip->opcode = (chip->mem[chip->pc & 0xFFF] << 8) | chip->mem[(chip->pc + 1) & 0xFFF];
+    chip->pc += 2;
+
+    chip8_decode_execute<Q>(chip);
+
+#ifdef CHIP8_PROFILE
+    chip8_profile_insn(chip, pc, time_nanos() - start_time);
+#endif
+
+    chip8_tick_timers(chip);
+}
+
+// Releases host-side resources; the machine state itself is left alone
+void chip8_free(struct chip8_data *chip)
+{
+    if (chip->jit != NULL)
+    {
+        chip8_jit_free(chip->jit);
+        chip->jit = NULL;
+    }
+
+#ifdef CHIP8_PROFILE
+    chip8_profile_free(chip);
+#endif
+}
+
+// 64-bit FNV-1a, used to fingerprint machine state
+uint64_t chip8_hash(const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Fingerprints the rows of the display the current mode uses. A 64x32
+// display hashes exactly as it did before the hires modes existed.
+uint64_t chip8_display_hash(const struct chip8_data *chip)
+{
+    uint64_t hash = chip8_hash(chip->vid, chip->vid_height * sizeof(chip->vid[0]));
+
+    if (chip->vid_width > 64)
+    {
+        hash = hash * 31 + chip8_hash(chip->vid_right, chip->vid_height * sizeof(chip->vid_right[0]));
     }
 
-    return 0;
+    return hash;
+}
+
+// Converts the 1-bit display into RGBA8888 pixels, vid_width per row
+void chip8_expand_framebuffer(const struct chip8_data *chip, uint32_t *pixels)
+{
+    for (int row = 0; row < chip->vid_height; row++)
+    {
+        for (int col = 0; col < chip->vid_width; col++)
+        {
+            uint64_t bits = col < 64 ? chip->vid[row] : chip->vid_right[row];
+            pixels[row * chip->vid_width + col] = (bits & (0x8000000000000000ull >> (col & 63))) ? 0xFFFFFFFF : 0;
+        }
+    }
+}
+
+long long time_nanos()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000000ll) + ts.tv_nsec;
 }
 
 #include "instructions.c"
+#include "dispatch.c"
+#include "bcache.c"
+#include "jit.c"
+#include "aot.c"
 #include "mem.c"
-#include "video.c"
\ No newline at end of file
+#include "sched.c"
+#include "state.c"
+#include "rewind.c"
+#include "inputlog.c"
+#include "audio.c"
+#include "romdb.c"
+#include "scale.c"
+#include "capture.c"
+#include "trace.c"
+#include "debug.c"
+#include "gdb.c"
+#ifdef CHIP8_PROFILE
+#include "profile.c"
+#endif
@@ -2,12 +2,192 @@
 #define CHIP8_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
-#include <SDL2/SDL.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+// The emulator core, built as libchip8 from chip8.c and the sources it
+// includes. The SDL and headless frontends are clients of it like any
+// other program; chip8.hpp wraps it for C++ callers.
+
+// every instruction the interpreter knows, X(name) per chip8_op_<name>
+#define CHIP8_OPCODES(X) \
+    X(invalid)           \
+    X(0E00)              \
+    X(00EE)              \
+    X(1nnn)              \
+    X(2nnn)              \
+    X(3xkk)              \
+    X(4xkk)              \
+    X(5xy0)              \
+    X(6xkk)              \
+    X(7xkk)              \
+    X(8xy0)              \
+    X(8xy1)              \
+    X(8xy2)              \
+    X(8xy3)              \
+    X(8xy4)              \
+    X(8xy5)              \
+    X(8xy6)              \
+    X(8xy7)              \
+    X(8xyE)              \
+    X(9xy0)              \
+    X(Annn)              \
+    X(Bnnn)              \
+    X(Cxkk)              \
+    X(Dxyn)              \
+    X(Ex9E)              \
+    X(ExA1)              \
+    X(Fx07)              \
+    X(Fx0A)              \
+    X(Fx15)              \
+    X(Fx18)              \
+    X(Fx1E)              \
+    X(Fx29)              \
+    X(Fx33)              \
+    X(Fx55)              \
+    X(Fx65)              \
+    X(00Cn)              \
+    X(00FB)              \
+    X(00FC)              \
+    X(00FD)              \
+    X(00FE)              \
+    X(00FF)              \
+    X(Fx30)              \
+    X(Fx75)              \
+    X(Fx85)              \
+    X(Annn_Dxyn)         \
+    X(7xkk_3xkk)         \
+    X(Fx07_3xkk)
+
+enum chip8_op
+{
+#define X(name) CHIP8_OP_##name,
+    CHIP8_OPCODES(X)
+#undef X
+    CHIP8_OP_COUNT
+};
+
+// an opcode with its operand fields pulled out ahead of time
+struct chip8_insn
+{
+    // CHIP8_OP_* handler
+    uint8_t op;
+
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t kk;
+    uint16_t nnn;
+};
+
+// Behaviour that differs between interpreters, one bit each. A set of them
+// is a template parameter of every handler and engine, so each profile
+// compiles to its own interpreter with no quirk tests left at runtime.
+enum chip8_quirk
+{
+    // 8xy6/8xyE shift Vy into Vx rather than shifting Vx in place
+    CHIP8_QUIRK_SHIFT_VY = 1 << 0,
+
+    // Bxnn jumps to xnn + Vx rather than Bnnn to nnn + V0
+    CHIP8_QUIRK_JUMP_VX = 1 << 1,
+
+    // Fx55/Fx65 leave I past the last register, I + x + 1
+    CHIP8_QUIRK_LOAD_STORE_I = 1 << 2,
+
+    // Fx55/Fx65 leave I at I + x, CHIP-48's off by one
+    CHIP8_QUIRK_LOAD_STORE_I_X = 1 << 3,
+
+    // 8xy1/8xy2/8xy3 clear VF
+    CHIP8_QUIRK_VF_RESET = 1 << 4,
+};
+
+// interpreters ROMs were written for, X(name, label, quirks) per
+// CHIP8_QUIRKS_<name>. Sprites clip at the display edges in all of them.
+#define CHIP8_QUIRK_PROFILES(X)                                                                              \
+    X(MODERN, "modern", 0)                                                                                   \
+    X(VIP, "vip", CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_LOAD_STORE_I | CHIP8_QUIRK_VF_RESET)                    \
+    X(CHIP48, "chip48", CHIP8_QUIRK_JUMP_VX | CHIP8_QUIRK_LOAD_STORE_I_X)                                     \
+    X(SCHIP, "schip", CHIP8_QUIRK_JUMP_VX)
+
+enum chip8_quirks
+{
+#define X(name, label, quirks) CHIP8_QUIRKS_##name,
+    CHIP8_QUIRK_PROFILES(X)
+#undef X
+    CHIP8_QUIRKS_COUNT
+};
+
+// What chip8_step() and the ROM loaders return. A fault stops the machine
+// where it happened and sticks until chip8_init() resets it or a state
+// load replaces it.
+enum chip8_status
+{
+    CHIP8_OK,
+
+    // opcode with no handler
+    CHIP8_INVALID_OPCODE,
+
+    // 2nnn with the stack full
+    CHIP8_STACK_OVERFLOW,
+
+    // 00EE with the stack empty
+    CHIP8_STACK_UNDERFLOW,
+
+    // ROM longer than the memory above ROM_OFFSET
+    CHIP8_ROM_TOO_LARGE,
+
+    // ROM or other input file could not be read
+    CHIP8_IO_ERROR,
+};
+
+// how chip8_run() executes instructions
+enum chip8_engine
+{
+    // nested switch in chip8_decode_execute()
+    CHIP8_ENGINE_SWITCH,
+
+    // predecoded opcode table with threaded dispatch
+    CHIP8_ENGINE_TABLE,
+
+    // cached basic blocks with fused instruction pairs
+    CHIP8_ENGINE_BLOCK,
+
+    // basic blocks translated to x86-64 machine code
+    CHIP8_ENGINE_JIT,
+
+    // the ROM compiled to C++ ahead of time by chip8-recompile, see aot.c
+    CHIP8_ENGINE_AOT,
+};
+
+struct chip8_jit;
+struct chip8_aot_program;
+struct chip8_profile;
+struct chip8_trace;
+struct chip8_debug;
+
+// Predecoded basic blocks keyed by start address. Entries are a pure
+// function of the bytes in memory, so they stay valid until one of the
+// bytes they were decoded from is written.
+struct chip8_bcache
+{
+    // instruction starting at each address, fused with the next if possible
+    struct chip8_insn insns[4096];
+
+    // entries in insns[] making up the block starting here, 0 if not built
+    uint8_t block_len[4096];
+
+    // instructions the block starting here retires
+    uint8_t block_cycles[4096];
+
+    // one bit per byte decoded into a cached block
+    uint8_t code[4096 / 8];
+};
 
 struct chip8_data
 {
@@ -32,6 +212,18 @@ struct chip8_data
     // sound timer
     uint8_t sfxTime;
 
+    // emulated instructions per second, at least 1: the timers divide by it
+    uint32_t ips;
+
+    // 60 per instruction, timers tick each time this reaches ips
+    uint32_t timer_acc;
+
+    // 60 Hz timer ticks since reset
+    uint64_t frames;
+
+    // Cxkk generator state, see chip8_seed()
+    uint64_t rng;
+
     // keypad state
     uint8_t keys[16];
 
@@ -41,26 +233,631 @@ struct chip8_data
     // 0x000 to 0xFFF memory (4096 bytes)
     uint8_t mem[4096];
 
-    // display memory
-    uint32_t vid[64 * 32];
-} g_chip8_data;
+    // display memory, one bit per pixel with bit 63 of each row leftmost.
+    // vid holds columns 0-63 and vid_right columns 64-127 of 128x64 hires,
+    // rows past vid_height are always clear
+    uint64_t vid[64];
+    uint64_t vid_right[64];
+
+    // current display mode: 64x32, 64x64 (VIP hires) or 128x64 (SUPER-CHIP)
+    uint8_t vid_width;
+    uint8_t vid_height;
+
+    // SUPER-CHIP RPL user flags, Fx75 and Fx85
+    uint8_t rpl[16];
+
+    // CHIP8_QUIRKS_* profile the ROM runs under, see chip8_set_quirks()
+    uint8_t quirks;
+
+    // set when vid changes, cleared by whoever presents it
+    uint8_t vid_dirty;
+
+    // everything above is machine state and is what a state file holds,
+    // everything below belongs to the host
+
+    // where chip8_fault() returns to, or NULL to terminate the process.
+    // chip8_step() arms it for the length of each call.
+    jmp_buf *fault_jmp;
+
+    // CHIP8_OK, or the chip8_status of the fault that stopped the machine
+    uint8_t status;
+
+    // CHIP8_ENGINE_* used by chip8_run()
+    uint8_t engine;
+
+    // set by an instruction that left the machine in an idle loop, see
+    // chip8_unpark()
+    uint8_t parked;
+
+    // instructions chip8_unpark() skipped rather than executed
+    unsigned long long idle_cycles;
+
+    // CHIP8_ENGINE_BLOCK state, its code bitmap also covers JIT blocks
+    struct chip8_bcache bcache;
+
+    // CHIP8_ENGINE_JIT state, created on first use
+    struct chip8_jit *jit;
+
+    // CHIP8_ENGINE_AOT program compiled from the loaded ROM, NULL if none
+    // was linked in
+    const struct chip8_aot_program *aot;
+
+    // set when memory may no longer hold the code aot was compiled from
+    uint8_t aot_stale;
+
+    // when set, chip8_run() records every instruction here, see trace.c.
+    // Owned by whoever set it.
+    struct chip8_trace *trace;
+
+    // breakpoints and watchpoints chip8_run() stops at, see debug.c. Owned
+    // by whoever set it.
+    struct chip8_debug *debug;
+
+#ifdef CHIP8_PROFILE
+    struct chip8_profile *profile;
+#endif
+};
+
+// bytes of chip8_data saved in a state file
+const size_t CHIP8_STATE_SIZE = offsetof(struct chip8_data, fault_jmp);
+
+struct chip8_state_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+
+    // chip8_hash() of the chip8_data bytes that follow
+    uint64_t checksum;
+};
+
+struct chip8_rewind_entry
+{
+    size_t offset;
+    uint32_t len;
+    uint8_t keyframe;
+};
+
+// ring of delta-compressed snapshots, one per frame
+struct chip8_rewind
+{
+    // encoded records, allocated once by chip8_rewind_init()
+    uint8_t *arena;
+    size_t arena_size;
+    size_t head;
+
+    // ring of record descriptors, oldest at first
+    struct chip8_rewind_entry *entries;
+    unsigned int max_entries;
+    unsigned int first;
+    unsigned int num_entries;
+
+    // decoded newest keyframe that deltas are taken against
+    uint8_t *keyframe;
+    unsigned int since_keyframe;
+    int force_keyframe;
+
+    uint8_t *scratch;
+
+    // stats
+    size_t stored_bytes;
+    unsigned long long pushes;
+    unsigned long long pops;
+    unsigned long long push_bytes;
+    long long push_ns;
+    long long max_push_ns;
+};
+
+struct chip8_input_event
+{
+    uint64_t frame;
+    uint8_t key;
+    uint8_t down;
+};
+
+struct chip8_inputlog_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ips;
+
+    // machine the session started from, with the same ROM or state loaded
+    uint64_t rng;
+    uint64_t start_frame;
+};
+
+// key transitions stamped with the frame they happened on
+struct chip8_inputlog
+{
+    struct chip8_inputlog_header header;
+
+    // recording
+    FILE *file;
+    uint64_t last_frame;
+    uint8_t keys[16];
+
+    // replaying
+    struct chip8_input_event *events;
+    uint64_t end_frame;
+    size_t next_event;
+
+    size_t num_events;
+};
+
+// paces a loop at a fixed frame rate on the monotonic clock
+struct chip8_sched
+{
+    unsigned int hz;
+
+    // time and frame count deadlines are measured from
+    long long start;
+    unsigned long long frames;
+
+    // stats since chip8_sched_init()
+    unsigned long long total_frames;
+    unsigned long long late_frames;
+    long long max_late_ns;
+};
+
+// 60 Hz frames the audio ring holds
+const unsigned int CHIP8_AUDIO_RING = 8;
+
+// one frame of sound timer state on its way to the audio callback
+struct chip8_audio_frame
+{
+    uint8_t tone;
+    long long pushed_ns;
+};
+
+// Sound output. The emulation thread only writes head and the audio
+// callback only writes tail, so the two never lock against each other.
+struct chip8_audio
+{
+    unsigned int sample_rate;
+    unsigned int buffer_samples;
+
+    struct chip8_audio_frame ring[CHIP8_AUDIO_RING];
+    unsigned int head;
+    unsigned int tail;
+
+    // callback side: frame being played and square wave phase
+    struct chip8_audio_frame current;
+    unsigned int frame_left;
+    unsigned int frame_acc;
+    uint32_t phase;
+    uint32_t phase_step;
+
+    // stats, dropped is counted by the producer and the rest by the consumer
+    unsigned long long played;
+    unsigned long long starved;
+    unsigned long long skipped;
+    unsigned long long dropped;
+    long long latency_ns;
+    long long max_latency_ns;
+};
+
+// Upscaling filters, every one an integer factor in both directions
+enum chip8_scale_filter
+{
+    // each pixel becomes a factor by factor block
+    CHIP8_SCALE_NEAREST,
+
+    // Scale2x/Scale3x edge smoothing, then nearest up to the factor
+    CHIP8_SCALE_SCALE2X,
+    CHIP8_SCALE_SCALE3X,
+};
+
+// loops chip8_scale() can turn bits into pixels with
+enum chip8_scale_kernel
+{
+    CHIP8_SCALE_KERNEL_SCALAR,
+    CHIP8_SCALE_KERNEL_SSE2,
+    CHIP8_SCALE_KERNEL_AVX2,
+};
+
+const int CHIP8_SCALE_MAX_FACTOR = 16;
+
+// CPU upscaler from the 1-bit display to RGBA8888, see scale.c
+struct chip8_scaler
+{
+    int filter;
+    int factor;
+
+    // darken the last output row of every display row
+    int scanlines;
+
+    // picked by chip8_scaler_init() as the fastest this CPU runs
+    int kernel;
+
+    uint32_t on_color;
+    uint32_t off_color;
+};
+
+// capture file formats, chosen by the file name's extension
+enum chip8_capture_format
+{
+    // .rgba or anything else: RGBA bytes, frame after frame, no header
+    CHIP8_CAPTURE_RAW,
+
+    // .y4m: YUV4MPEG2, 4:2:0 at 60 fps
+    CHIP8_CAPTURE_Y4M,
+
+    // .gif: animated, looping
+    CHIP8_CAPTURE_GIF,
+};
+
+// display snapshots waiting for the encoder, about a second of frames
+const unsigned int CHIP8_CAPTURE_QUEUE = 64;
+
+// one 60 Hz frame of the display, laid out as in chip8_data
+struct chip8_capture_frame
+{
+    uint64_t vid[64];
+    uint64_t vid_right[64];
+    uint8_t vid_width;
+    uint8_t vid_height;
+};
+
+// Records every frame of the display to a file. The emulation thread
+// writes each frame's display straight into a queue slot and an encoder
+// thread scales, encodes and writes it from there. A full queue makes the
+// emulation wait rather than lose a frame.
+struct chip8_capture
+{
+    FILE *file;
+    int format;
+
+    // output frames are width by height, each display mode scaled by
+    // chip8_scale_fit() and centred
+    int width;
+    int height;
+    int filter;
+    int scanlines;
+
+    struct chip8_capture_frame queue[CHIP8_CAPTURE_QUEUE];
+    unsigned int head;
+    unsigned int tail;
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+
+    // encoder thread state, the display is scaled to scaled_width by
+    // scaled_height in the middle of canvas
+    struct chip8_scaler scaler;
+    int scaled_width;
+    int scaled_height;
+    uint32_t *canvas;
+    uint8_t *encoded;
+    uint8_t *gif_indexes;
+    int error;
+
+    // GIF frames are written once their length is known, see capture.c
+    struct chip8_capture_frame gif_pending;
+    unsigned long long gif_pending_start;
+    int gif_have_pending;
+
+    // stats, stalls by the emulation thread and the rest by the encoder
+    unsigned long long frames;
+    unsigned long long stalls;
+    long long stall_ns;
+    unsigned int max_queued;
+    unsigned long long bytes;
+    long long encode_ns;
+};
+
+// One executed instruction, as it left the machine. Which registers it
+// wrote follows from the opcode, see chip8_insn_writes(); of those only Vx
+// and VF keep their values.
+struct chip8_trace_entry
+{
+    // address the instruction was fetched from
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t idx;
+
+    // V register the opcode's x field names, and VF
+    uint8_t vx;
+    uint8_t vf;
+
+    uint8_t sp;
+    uint8_t delay;
+};
+
+struct chip8_trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+
+    // instructions traced in all, the file holds the last count of them
+    uint64_t total;
+    uint64_t count;
+
+    // chip8_status the machine had when saved, the last entry is the
+    // instruction that faulted if it isn't CHIP8_OK
+    uint32_t status;
+    uint32_t quirks;
+};
+
+// Ring of the most recent instructions. Only the emulation thread writes
+// it and it never waits: an entry is filled in and then published by
+// bumping head, and readers check head again after copying to drop any
+// entries that were overwritten meanwhile.
+struct chip8_trace
+{
+    // a power of two entries
+    struct chip8_trace_entry *ring;
+    uint64_t mask;
+
+    // entries ever published, the newest is ring[(head - 1) & mask]
+    uint64_t head;
+
+    // chip8_fault() saves the trace here before stopping, if set
+    const char *fault_filename;
+};
+
+// what a chip8_debug stops at, and why chip8_run() stopped early
+enum chip8_debug_kind
+{
+    // fetching the instruction at the address
+    CHIP8_DEBUG_BREAK = 1 << 0,
+
+    // an instruction reading or writing memory at the address
+    CHIP8_DEBUG_READ = 1 << 1,
+    CHIP8_DEBUG_WRITE = 1 << 2,
+};
+
+// One bit per address for each CHIP8_DEBUG_* kind. chip8_run() only runs
+// the checking interpreter while some bit is set, with none armed the
+// usual engines run untouched.
+struct chip8_debug
+{
+    uint64_t breakpoints[4096 / 64];
+    uint64_t reads[4096 / 64];
+    uint64_t writes[4096 / 64];
+
+    // bits set across all three
+    unsigned int armed;
+
+    // set by whoever resumes from a stop, so the instruction at pc runs
+    // before its breakpoint is checked again
+    uint8_t resume;
+
+    // CHIP8_DEBUG_* kind that made chip8_run() return early, 0 if none, and
+    // the address it hit. Cleared by whoever handles the stop.
+    uint8_t stop;
+    uint16_t stop_addr;
+};
+
+// largest packet the GDB stub takes
+const unsigned int CHIP8_GDB_PACKET_SIZE = 4096;
+
+// GDB remote serial protocol server for one machine, see gdb.c
+struct chip8_gdb
+{
+    int listen_fd;
+    int fd;
+
+    // unix socket to remove on close, empty for TCP
+    char path[108];
+
+    // packet being received
+    char in[CHIP8_GDB_PACKET_SIZE];
+    size_t in_len;
+    int in_state;
+    char in_checksum[2];
+
+    // last reply, resent if GDB asks
+    char out[2 * CHIP8_GDB_PACKET_SIZE + 8];
+    size_t out_len;
+    int no_ack;
+
+    // set from a c packet until the stop is reported
+    int running;
+
+    struct chip8_debug debug;
+};
+
+// A ROM chip8-recompile translated to C++. The generated translation unit
+// registers one of these when linked into a program, and loading the same
+// ROM picks it up.
+struct chip8_aot_program
+{
+    const char *name;
+
+    // ROM it was compiled from, and the CHIP8_QUIRKS_* profile it behaves as
+    const uint8_t *rom;
+    size_t rom_len;
+    int quirks;
+
+    // one bit per address a compiled block starts at, and one per byte of
+    // memory the compiled code was translated from
+    const uint8_t *entries;
+    const uint8_t *code;
+
+    // Runs compiled blocks from chip->pc, starting with one at an entry,
+    // for at most cycles instructions. Returns how many ran, 0 if the
+    // first block needs more than that.
+    unsigned long long (*run)(struct chip8_data *chip, unsigned long long cycles);
+
+    struct chip8_aot_program *next;
+};
+
+// library functions, chip8_create() gives an initialised machine with
+// fonts loaded and chip8_destroy() releases it
+struct chip8_data *chip8_create();
+void chip8_destroy(struct chip8_data *chip);
+int chip8_step(struct chip8_data *chip, unsigned long long cycles);
+int chip8_run_frame(struct chip8_data *chip);
+const char *chip8_status_name(int status);
 
 // debug functions
-void chip8_print_state();
+void chip8_print_state(struct chip8_data *chip);
+void chip8_fault(struct chip8_data *chip, int status);
+
+// memory functions, the loaders return a chip8_status and the file one
+// prints why it failed
+int chip8_load_rom(struct chip8_data *chip, const char *filename);
+int chip8_load_rom_buffer(struct chip8_data *chip, const uint8_t *rom, size_t len);
+void chip8_load_fonts(struct chip8_data *chip);
+
+// instruction functions, Q is the CHIP8_QUIRK_* set they behave as
+void chip8_decode_operands(uint16_t opcode, struct chip8_insn *in);
+void chip8_decode(uint16_t opcode, struct chip8_insn *in);
+template <unsigned int Q>
+void chip8_decode_execute(struct chip8_data *chip);
+#define X(name)             \
+    template <unsigned int Q> \
+    void chip8_op_##name(struct chip8_data *chip, const struct chip8_insn *in);
+CHIP8_OPCODES(X)
+#undef X
+
+// emulation functions
+void chip8_init(struct chip8_data *chip);
+void chip8_seed(struct chip8_data *chip, uint64_t seed);
+void chip8_set_quirks(struct chip8_data *chip, int quirks);
+template <unsigned int Q>
+void chip8_cycle(struct chip8_data *chip);
+void chip8_free(struct chip8_data *chip);
+void chip8_run(struct chip8_data *chip, unsigned long long cycles);
+template <unsigned int Q>
+void chip8_run_block(struct chip8_data *chip, unsigned long long cycles);
+void chip8_bcache_flush(struct chip8_data *chip);
+void chip8_bcache_write(struct chip8_data *chip, uint16_t addr, unsigned int len);
+template <unsigned int Q>
+void chip8_run_jit(struct chip8_data *chip, unsigned long long cycles);
+void chip8_jit_flush(struct chip8_jit *jit);
+void chip8_jit_free(struct chip8_jit *jit);
+int chip8_parse_engine(const char *name);
+int chip8_parse_quirks(const char *name);
+const char *chip8_quirks_name(int quirks);
+unsigned int chip8_quirk_bits(int quirks);
+unsigned long long chip8_cycles_to_frame(const struct chip8_data *chip);
+unsigned long long chip8_cycles_until_frame(const struct chip8_data *chip, uint64_t frame);
+uint64_t chip8_hash(const void *data, size_t len);
+uint64_t chip8_display_hash(const struct chip8_data *chip);
+void chip8_expand_framebuffer(const struct chip8_data *chip, uint32_t *pixels);
+
+// scaling functions, init returns -1 after printing why the filter and
+// factor don't go together
+int chip8_scaler_init(struct chip8_scaler *scaler, int filter, int factor, int scanlines);
+int chip8_scaler_set_kernel(struct chip8_scaler *scaler, int kernel);
+int chip8_scale_fit(int filter, int width, int height, int max_width, int max_height);
+void chip8_scale(const struct chip8_scaler *scaler, const struct chip8_data *chip, void *pixels, int pitch);
+void chip8_scale_display(const struct chip8_scaler *scaler, const uint64_t *vid, const uint64_t *vid_right, int width, int height,
+                         void *pixels, int pitch);
+int chip8_parse_scale_filter(const char *name);
+const char *chip8_scale_filter_name(int filter);
+const char *chip8_scale_kernel_name(int kernel);
 
-// memory functions
-void chip8_load_rom(const char *filename);
-void chip8_load_fonts();
+// capture functions, open and close return -1 after printing why
+int chip8_capture_open(struct chip8_capture *capture, const char *filename, int filter, int scale, int scanlines);
+void chip8_capture_push(struct chip8_capture *capture, const struct chip8_data *chip);
+int chip8_capture_close(struct chip8_capture *capture);
+void chip8_capture_report(const struct chip8_capture *capture, FILE *out);
 
-// instruction functions
-void chip8_decode_execute();
+// trace functions, init, save and load return -1 after printing why
+int chip8_trace_init(struct chip8_trace *trace, unsigned int entries, const char *fault_filename);
+void chip8_trace_free(struct chip8_trace *trace);
+template <unsigned int Q>
+void chip8_run_trace(struct chip8_data *chip, unsigned long long cycles);
+void chip8_trace_fault(struct chip8_data *chip);
+size_t chip8_trace_snapshot(const struct chip8_trace *trace, struct chip8_trace_entry *entries, uint64_t *first);
+int chip8_trace_save(const struct chip8_trace *trace, const struct chip8_data *chip, const char *filename);
+int chip8_trace_load(const char *filename, struct chip8_trace_header *header, struct chip8_trace_entry **entries);
+void chip8_disassemble(uint16_t opcode, int quirks, char *text, size_t len);
+unsigned int chip8_insn_writes(uint16_t opcode, int quirks);
 
-// SDL functions
+// debugging functions, chip8_gdb_open() returns -1 after printing why and
+// chip8_gdb_poll() -1 once the session is over
+int chip8_debug_set(struct chip8_debug *debug, int kinds, uint16_t addr, unsigned int len, int on);
+template <unsigned int Q>
+void chip8_run_debug(struct chip8_data *chip, unsigned long long cycles);
+int chip8_gdb_open(struct chip8_gdb *gdb, const char *address);
+int chip8_gdb_accept(struct chip8_gdb *gdb);
+int chip8_gdb_poll(struct chip8_gdb *gdb, struct chip8_data *chip, int timeout_ms);
+void chip8_gdb_run(struct chip8_gdb *gdb, struct chip8_data *chip, unsigned long long cycles);
+void chip8_gdb_close(struct chip8_gdb *gdb);
+
+// ahead-of-time compiled ROMs, chip8_aot_exec() and chip8_aot_timers()
+// are what generated code calls back into the core with
+void chip8_aot_register(struct chip8_aot_program *program);
+const struct chip8_aot_program *chip8_aot_lookup(const uint8_t *rom, size_t len);
+template <unsigned int Q>
+void chip8_run_aot(struct chip8_data *chip, unsigned long long cycles);
+void chip8_aot_exec(struct chip8_data *chip, uint16_t opcode);
+void chip8_aot_timers(struct chip8_data *chip, unsigned long long n);
+
+// ROM database functions, chip8_romdb_lookup() gives the CHIP8_QUIRKS_*
+// profile of a known ROM or -1
+void chip8_sha1(const void *data, size_t len, uint8_t digest[20]);
+int chip8_romdb_lookup(const uint8_t *rom, size_t len);
+
+// state functions, 0 on success or -1 after printing why not
+int chip8_state_save(const struct chip8_data *chip, const char *filename);
+int chip8_state_load(struct chip8_data *chip, const char *filename);
+
+// rewind functions
+int chip8_rewind_init(struct chip8_rewind *rw, unsigned int seconds, size_t budget);
+void chip8_rewind_free(struct chip8_rewind *rw);
+void chip8_rewind_push(struct chip8_rewind *rw, const struct chip8_data *chip);
+int chip8_rewind_pop(struct chip8_rewind *rw, struct chip8_data *chip);
+void chip8_rewind_report(const struct chip8_rewind *rw, FILE *out);
+
+// input log functions
+int chip8_inputlog_create(struct chip8_inputlog *log, const char *filename, const struct chip8_data *chip);
+void chip8_inputlog_record(struct chip8_inputlog *log, const struct chip8_data *chip);
+void chip8_inputlog_close(struct chip8_inputlog *log, uint64_t end_frame);
+int chip8_inputlog_load(struct chip8_inputlog *log, const char *filename);
+unsigned long long chip8_inputlog_replay(struct chip8_inputlog *log, struct chip8_data *chip, uint64_t end_frame);
+void chip8_inputlog_free(struct chip8_inputlog *log);
+
+// audio functions
+int chip8_audio_init(struct chip8_audio *audio, unsigned int sample_rate, unsigned int buffer_samples);
+void chip8_audio_push(struct chip8_audio *audio, const struct chip8_data *chip);
+void chip8_audio_render(struct chip8_audio *audio, int16_t *out, unsigned int samples);
+int chip8_audio_write_pcm(struct chip8_audio *audio, const struct chip8_data *chip, FILE *out);
+void chip8_audio_report(const struct chip8_audio *audio, FILE *out);
+
+// profiling functions, only built with -DCHIP8_PROFILE
+#ifdef CHIP8_PROFILE
+void chip8_profile_init(struct chip8_data *chip);
+void chip8_profile_free(struct chip8_data *chip);
+void chip8_profile_insn(struct chip8_data *chip, uint16_t pc, long long ns);
+void chip8_profile_read(struct chip8_data *chip, uint16_t addr, unsigned int len);
+void chip8_profile_write(struct chip8_data *chip, uint16_t addr, unsigned int len);
+int chip8_profile_dump(const struct chip8_data *chip, const char *format, FILE *out);
+#define CHIP8_PROFILE_READ(chip, addr, len) chip8_profile_read(chip, addr, len)
+#define CHIP8_PROFILE_WRITE(chip, addr, len) chip8_profile_write(chip, addr, len)
+#else
+#define CHIP8_PROFILE_READ(chip, addr, len) ((void)0)
+#define CHIP8_PROFILE_WRITE(chip, addr, len) ((void)0)
+#endif
+
+// timing functions
+long long time_nanos();
+void chip8_sched_init(struct chip8_sched *sched, unsigned int hz);
+long long chip8_sched_deadline(const struct chip8_sched *sched);
+int chip8_sched_wait(struct chip8_sched *sched);
+void chip8_sched_report(const struct chip8_sched *sched, FILE *out);
+
+// machine constants
 const int VIDEO_WIDTH = 64;
 const int VIDEO_HEIGHT = 32;
+const int VIDEO_MAX_WIDTH = 128;
+const int VIDEO_MAX_HEIGHT = 64;
+const unsigned int ROM_OFFSET = 0x200u;
+const unsigned int MAX_ROM_SZ = 0xD00u;
 const unsigned int FONTSET_SZ = 80;
 const unsigned int FONT_OFFSET = 80;
-void platform_init(const char *title, int window_width, int window_height, int texture_width, int texture_height);
-void platform_update(void *buffer, int pitch);
-int process_input(uint8_t *keys);
-#endif
\ No newline at end of file
+const unsigned int BIG_FONTSET_SZ = 160;
+const unsigned int BIG_FONT_OFFSET = FONT_OFFSET + FONTSET_SZ;
+const unsigned int CHIP8_DEFAULT_IPS = 700;
+const unsigned int CHIP8_REWIND_DEFAULT_SECONDS = 60;
+const size_t CHIP8_REWIND_DEFAULT_BUDGET = 16 << 20;
+const unsigned int CHIP8_AUDIO_RATE = 44100;
+const unsigned int CHIP8_AUDIO_DEFAULT_BUFFER = 512;
+const unsigned int CHIP8_TRACE_DEFAULT_ENTRIES = 1 << 16;
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef CHIP8_HPP
+#define CHIP8_HPP
+
+#include "chip8.h"
+#include <new>
+
+// C++ face of libchip8. A Machine owns one chip8_data; everything it hands
+// out is a read-only view into it, valid while the Machine lives. Faults
+// come back as a Status and never end the process.
+namespace chip8
+{
+
+enum class Status
+{
+    ok = CHIP8_OK,
+    invalid_opcode = CHIP8_INVALID_OPCODE,
+    stack_overflow = CHIP8_STACK_OVERFLOW,
+    stack_underflow = CHIP8_STACK_UNDERFLOW,
+    rom_too_large = CHIP8_ROM_TOO_LARGE,
+    io_error = CHIP8_IO_ERROR,
+};
+
+inline const char *status_name(Status status)
+{
+    return chip8_status_name((int)status);
+}
+
+// The display in its current mode, vid_width by vid_height pixels
+class Framebuffer
+{
+public:
+    explicit Framebuffer(const chip8_data &chip) : chip_(chip) {}
+
+    int width() const { return chip_.vid_width; }
+    int height() const { return chip_.vid_height; }
+
+    bool pixel(int x, int y) const
+    {
+        uint64_t bits = x < 64 ? chip_.vid[y] : chip_.vid_right[y];
+        return (bits >> (63 - (x & 63))) & 1;
+    }
+
+    // columns 0-63 of row y with bit 63 leftmost, row_right() has 64-127
+    uint64_t row(int y) const { return chip_.vid[y]; }
+    uint64_t row_right(int y) const { return chip_.vid_right[y]; }
+
+    // RGBA8888, width() pixels per row
+    void expand(uint32_t *pixels) const { chip8_expand_framebuffer(&chip_, pixels); }
+
+    uint64_t hash() const { return chip8_display_hash(&chip_); }
+
+private:
+    const chip8_data &chip_;
+};
+
+class Registers
+{
+public:
+    explicit Registers(const chip8_data &chip) : chip_(chip) {}
+
+    uint8_t v(int x) const { return chip_.regs[x & 0xF]; }
+    uint16_t i() const { return chip_.idx; }
+    uint16_t pc() const { return chip_.pc; }
+    uint8_t sp() const { return chip_.sp; }
+    uint16_t stack(int level) const { return chip_.stk[level & 0xF]; }
+    uint8_t delay_timer() const { return chip_.delTime; }
+    uint8_t sound_timer() const { return chip_.sfxTime; }
+
+    // last opcode fetched, the faulting one after a Status::invalid_opcode
+    uint16_t opcode() const { return chip_.opcode; }
+
+private:
+    const chip8_data &chip_;
+};
+
+class Machine
+{
+public:
+    Machine() : chip_(chip8_create())
+    {
+        if (chip_ == NULL)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~Machine() { chip8_destroy(chip_); }
+
+    Machine(const Machine &) = delete;
+    Machine &operator=(const Machine &) = delete;
+
+    Status load_rom(const uint8_t *rom, size_t len) { return (Status)chip8_load_rom_buffer(chip_, rom, len); }
+    Status load_rom(const char *filename) { return (Status)chip8_load_rom(chip_, filename); }
+
+    Status step(unsigned long long cycles) { return (Status)chip8_step(chip_, cycles); }
+    Status run_frame() { return (Status)chip8_run_frame(chip_); }
+    Status status() const { return (Status)chip_->status; }
+
+    // picked from the ROM database on load, this overrides it
+    void set_quirks(chip8_quirks quirks) { chip8_set_quirks(chip_, quirks); }
+    chip8_quirks quirks() const { return (chip8_quirks)chip_->quirks; }
+
+    void set_engine(chip8_engine engine) { chip_->engine = engine; }
+
+    // false, leaving the rate as it was, for 0
+    bool set_ips(unsigned int ips)
+    {
+        if (ips == 0)
+        {
+            return false;
+        }
+        chip_->ips = ips;
+        return true;
+    }
+
+    void seed(uint64_t seed) { chip8_seed(chip_, seed); }
+    void set_key(int key, bool down) { chip_->keys[key & 0xF] = down; }
+
+    Framebuffer framebuffer() const { return Framebuffer(*chip_); }
+    Registers registers() const { return Registers(*chip_); }
+    const uint8_t *memory() const { return chip_->mem; }
+    uint64_t frames() const { return chip_->frames; }
+
+    // for the rest of the C API: state files, rewind, input logs, audio
+    chip8_data *get() { return chip_; }
+    const chip8_data *get() const { return chip_; }
+
+private:
+    chip8_data *chip_;
+};
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "chip8.h"
+
+// Breakpoints and watchpoints. While any are armed chip8_run() runs the
+// switch interpreter below, which checks the breakpoint bitmap before
+// each instruction and the watch bitmaps against the memory it is about
+// to touch. With none armed the fast engines run as if debugging didn't
+// exist, the only cost is one test per chip8_run().
+
+static inline int chip8_debug_test(const uint64_t *bitmap, uint16_t addr)
+{
+    return (bitmap[(addr & 0xFFF) >> 6] >> (addr & 63)) & 1;
+}
+
+// Arms or clears len addresses from addr for each CHIP8_DEBUG_* kind in
+// kinds. Returns -1 if the range runs past memory.
+int chip8_debug_set(struct chip8_debug *debug, int kinds, uint16_t addr, unsigned int len, int on)
+{
+    if (addr + len > 4096)
+    {
+        return -1;
+    }
+
+    uint64_t *bitmaps[3] = {debug->breakpoints, debug->reads, debug->writes};
+    for (int kind = 0; kind < 3; kind++)
+    {
+        if (!(kinds & (1 << kind)))
+        {
+            continue;
+        }
+
+        for (unsigned int a = addr; a < addr + len; a++)
+        {
+            uint64_t bit = 1ull << (a & 63);
+            uint64_t *word = &bitmaps[kind][a >> 6];
+
+            if (on && !(*word & bit))
+            {
+                *word |= bit;
+                debug->armed++;
+            }
+            else if (!on && (*word & bit))
+            {
+                *word &= ~bit;
+                debug->armed--;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// The memory the instruction about to run touches, as a CHIP8_DEBUG_READ
+// or CHIP8_DEBUG_WRITE kind, or 0 for none. Dxyn counts every row of its
+// sprite, including rows clipped off the bottom of the display.
+static int chip8_debug_access(const struct chip8_data *chip, uint16_t opcode, uint16_t *addr, unsigned int *len)
+{
+    struct chip8_insn in;
+    chip8_decode(opcode, &in);
+    *addr = chip->idx;
+
+    switch (in.op)
+    {
+    case CHIP8_OP_Dxyn:
+        *len = in.n ? in.n : 32;
+        return CHIP8_DEBUG_READ;
+    case CHIP8_OP_Fx33:
+        *len = 3;
+        return CHIP8_DEBUG_WRITE;
+    case CHIP8_OP_Fx55:
+        *len = in.x + 1;
+        return CHIP8_DEBUG_WRITE;
+    case CHIP8_OP_Fx65:
+        *len = in.x + 1;
+        return CHIP8_DEBUG_READ;
+    default:
+        return 0;
+    }
+}
+
+template <unsigned int Q>
+void chip8_run_debug(struct chip8_data *chip, unsigned long long cycles)
+{
+    struct chip8_debug *debug = chip->debug;
+
+    while (cycles-- > 0)
+    {
+        uint16_t pc = chip->pc & 0xFFF;
+
+        if (debug->resume)
+        {
+            debug->resume = 0;
+        }
+        else if (chip8_debug_test(debug->breakpoints, pc))
+        {
+            debug->stop = CHIP8_DEBUG_BREAK;
+            debug->stop_addr = pc;
+            return;
+        }
+
+        uint16_t addr;
+        unsigned int len;
+        int access = chip8_debug_access(chip, (chip->mem[pc] << 8) | chip->mem[(pc + 1) & 0xFFF], &addr, &len);
+
+        chip8_cycle<Q>(chip);
+
+        // idle loops run instruction by instruction, a breakpoint in one
+        // still has to hit
+        chip->parked = 0;
+
+        // like a hardware watchpoint, the stop comes after the access
+        const uint64_t *watched = access == CHIP8_DEBUG_READ ? debug->reads : debug->writes;
+        for (unsigned int i = 0; access && i < len; i++)
+        {
+            if (chip8_debug_test(watched, addr + i))
+            {
+                debug->stop = access;
+                debug->stop_addr = (addr + i) & 0xFFF;
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,421 @@
+#include "chip8.h"
+
+void chip8_decode_operands(uint16_t opcode, struct chip8_insn *in)
+{
+    in->op = CHIP8_OP_invalid;
+    in->x = (opcode & 0x0F00) >> 8;
+    in->y = (opcode & 0x00F0) >> 4;
+    in->n = opcode & 0x000F;
+    in->kk = opcode & 0x00FF;
+    in->nnn = opcode & 0x0FFF;
+}
+
+// Same opcode map as chip8_decode_execute(), but records which handler to
+// run instead of running it.
+void chip8_decode(uint16_t opcode, struct chip8_insn *in)
+{
+    chip8_decode_operands(opcode, in);
+
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+        switch (opcode & 0x00FF)
+        {
+        case 0x00E0:
+            in->op = CHIP8_OP_0E00;
+            break;
+        case 0x00EE:
+            in->op = CHIP8_OP_00EE;
+            break;
+        case 0x0030:
+            if (opcode == 0x0230)
+            {
+                in->op = CHIP8_OP_0E00;
+            }
+            break;
+        case 0x00FB:
+            in->op = CHIP8_OP_00FB;
+            break;
+        case 0x00FC:
+            in->op = CHIP8_OP_00FC;
+            break;
+        case 0x00FD:
+            in->op = CHIP8_OP_00FD;
+            break;
+        case 0x00FE:
+            in->op = CHIP8_OP_00FE;
+            break;
+        case 0x00FF:
+            in->op = CHIP8_OP_00FF;
+            break;
+        default:
+            if ((opcode & 0x00F0) == 0x00C0)
+            {
+                in->op = CHIP8_OP_00Cn;
+            }
+            break;
+        }
+        break;
+    case 0x1000:
+        in->op = CHIP8_OP_1nnn;
+        break;
+    case 0x2000:
+        in->op = CHIP8_OP_2nnn;
+        break;
+    case 0x3000:
+        in->op = CHIP8_OP_3xkk;
+        break;
+    case 0x4000:
+        in->op = CHIP8_OP_4xkk;
+        break;
+    case 0x5000:
+        in->op = CHIP8_OP_5xy0;
+        break;
+    case 0x6000:
+        in->op = CHIP8_OP_6xkk;
+        break;
+    case 0x7000:
+        in->op = CHIP8_OP_7xkk;
+        break;
+    case 0x8000:
+        switch (opcode & 0x000F)
+        {
+        case 0x0000:
+            in->op = CHIP8_OP_8xy0;
+            break;
+        case 0x0001:
+            in->op = CHIP8_OP_8xy1;
+            break;
+        case 0x0002:
+            in->op = CHIP8_OP_8xy2;
+            break;
+        case 0x0003:
+            in->op = CHIP8_OP_8xy3;
+            break;
+        case 0x0004:
+            in->op = CHIP8_OP_8xy4;
+            break;
+        case 0x0005:
+            in->op = CHIP8_OP_8xy5;
+            break;
+        case 0x0006:
+            in->op = CHIP8_OP_8xy6;
+            break;
+        case 0x0007:
+            in->op = CHIP8_OP_8xy7;
+            break;
+        case 0x000E:
+            in->op = CHIP8_OP_8xyE;
+            break;
+        }
+        break;
+    case 0x9000:
+        in->op = CHIP8_OP_9xy0;
+        break;
+    case 0xA000:
+        in->op = CHIP8_OP_Annn;
+        break;
+    case 0xB000:
+        in->op = CHIP8_OP_Bnnn;
+        break;
+    case 0xC000:
+        in->op = CHIP8_OP_Cxkk;
+        break;
+    case 0xD000:
+        in->op = CHIP8_OP_Dxyn;
+        break;
+    case 0xE000:
+        switch (opcode & 0x00FF)
+        {
+        case 0x009E:
+            in->op = CHIP8_OP_Ex9E;
+            break;
+        case 0x00A1:
+            in->op = CHIP8_OP_ExA1;
+            break;
+        }
+        break;
+    case 0xF000:
+        switch (opcode & 0x00FF)
+        {
+        case 0x0007:
+            in->op = CHIP8_OP_Fx07;
+            break;
+        case 0x000A:
+            in->op = CHIP8_OP_Fx0A;
+            break;
+        case 0x0015:
+            in->op = CHIP8_OP_Fx15;
+            break;
+        case 0x0018:
+            in->op = CHIP8_OP_Fx18;
+            break;
+        case 0x001E:
+            in->op = CHIP8_OP_Fx1E;
+            break;
+        case 0x0029:
+            in->op = CHIP8_OP_Fx29;
+            break;
+        case 0x0030:
+            in->op = CHIP8_OP_Fx30;
+            break;
+        case 0x0033:
+            in->op = CHIP8_OP_Fx33;
+            break;
+        case 0x0065:
+            in->op = CHIP8_OP_Fx65;
+            break;
+        case 0x0055:
+            in->op = CHIP8_OP_Fx55;
+            break;
+        case 0x0075:
+            in->op = CHIP8_OP_Fx75;
+            break;
+        case 0x0085:
+            in->op = CHIP8_OP_Fx85;
+            break;
+        }
+        break;
+    }
+}
+
+// every possible opcode, decoded once per process
+static struct chip8_insn chip8_insn_table[0x10000];
+static pthread_once_t chip8_insn_table_once = PTHREAD_ONCE_INIT;
+
+static void chip8_build_insn_table()
+{
+    for (uint32_t opcode = 0; opcode <= 0xFFFF; opcode++)
+    {
+        chip8_decode(opcode, &chip8_insn_table[opcode]);
+    }
+}
+
+// forced inline for the same reason as chip8_tick_timers()
+__attribute__((always_inline)) static inline const struct chip8_insn *chip8_fetch_insn(struct chip8_data *chip)
+{
+    chip->opcode = (chip->mem[chip->pc & 0xFFF] << 8) | chip->mem[(chip->pc + 1) & 0xFFF];
+    chip->pc += 2;
+
+    return &chip8_insn_table[chip->opcode];
+}
+
+// Instructions that may set chip->parked
+static inline int chip8_insn_parks(uint8_t op)
+{
+    return op == CHIP8_OP_Fx0A || op == CHIP8_OP_00FD || op == CHIP8_OP_1nnn;
+}
+
+template <unsigned int Q>
+static void chip8_run_switch(struct chip8_data *chip, unsigned long long cycles)
+{
+    while (cycles-- > 0)
+    {
+        chip8_cycle<Q>(chip);
+
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+        }
+    }
+}
+
+template <unsigned int Q>
+static void chip8_run_table(struct chip8_data *chip, unsigned long long cycles)
+{
+    const struct chip8_insn *in;
+
+#if defined(__GNUC__)
+    // threaded code: every handler jumps straight to the next one
+    static void *const op_labels[CHIP8_OP_COUNT] = {
+#define X(name) &&op_##name,
+        CHIP8_OPCODES(X)
+#undef X
+    };
+
+#define CHIP8_DISPATCH()              \
+    do                                \
+    {                                 \
+        if (cycles-- == 0)            \
+            return;                   \
+        in = chip8_fetch_insn(chip);  \
+        goto *op_labels[in->op];      \
+    } while (0)
+
+    CHIP8_DISPATCH();
+
+#define X(name)                                            \
+    op_##name:                                             \
+    chip8_op_##name<Q>(chip, in);                          \
+    chip8_tick_timers(chip);                               \
+    if (chip8_insn_parks(CHIP8_OP_##name) && chip->parked) \
+    {                                                      \
+        cycles -= chip8_unpark(chip, cycles);              \
+    }                                                      \
+    CHIP8_DISPATCH();
+    CHIP8_OPCODES(X)
+#undef X
+#undef CHIP8_DISPATCH
+#else
+    while (cycles-- > 0)
+    {
+        in = chip8_fetch_insn(chip);
+
+        switch (in->op)
+        {
+#define X(name)                       \
+    case CHIP8_OP_##name:             \
+        chip8_op_##name<Q>(chip, in); \
+        break;
+            CHIP8_OPCODES(X)
+#undef X
+        }
+
+        chip8_tick_timers(chip);
+
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+        }
+    }
+#endif
+}
+
+template <unsigned int Q>
+static void chip8_run_engine(struct chip8_data *chip, unsigned long long cycles)
+{
+    // stopping points and tracing hook the reference interpreter, the other
+    // engines run several instructions between the points they could see
+    if (chip->debug != NULL && chip->debug->armed)
+    {
+        chip8_run_debug<Q>(chip, cycles);
+        return;
+    }
+
+    if (chip->trace != NULL)
+    {
+        chip8_run_trace<Q>(chip, cycles);
+        return;
+    }
+
+#ifdef CHIP8_PROFILE
+    // only the reference interpreter is instrumented
+    chip8_run_switch<Q>(chip, cycles);
+    return;
+#endif
+
+    switch (chip->engine)
+    {
+    case CHIP8_ENGINE_TABLE:
+        pthread_once(&chip8_insn_table_once, chip8_build_insn_table);
+        chip8_run_table<Q>(chip, cycles);
+        break;
+    case CHIP8_ENGINE_BLOCK:
+        pthread_once(&chip8_insn_table_once, chip8_build_insn_table);
+        chip8_run_block<Q>(chip, cycles);
+        break;
+    case CHIP8_ENGINE_JIT:
+        pthread_once(&chip8_insn_table_once, chip8_build_insn_table);
+        chip8_run_jit<Q>(chip, cycles);
+        break;
+    case CHIP8_ENGINE_AOT:
+        pthread_once(&chip8_insn_table_once, chip8_build_insn_table);
+        chip8_run_aot<Q>(chip, cycles);
+        break;
+    default:
+        chip8_run_switch<Q>(chip, cycles);
+        break;
+    }
+}
+
+void chip8_run(struct chip8_data *chip, unsigned long long cycles)
+{
+    // the keys may have changed since whatever parked the last run
+    chip->parked = 0;
+
+    // every profile has its own copy of every engine
+    switch (chip->quirks)
+    {
+#define X(name, label, quirks)                       \
+    case CHIP8_QUIRKS_##name:                        \
+        chip8_run_engine<(quirks)>(chip, cycles);   \
+        break;
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+    default:
+        chip8_run_engine<0>(chip, cycles);
+        break;
+    }
+}
+
+int chip8_parse_engine(const char *name)
+{
+    if (strcmp(name, "switch") == 0)
+    {
+        return CHIP8_ENGINE_SWITCH;
+    }
+
+    if (strcmp(name, "table") == 0)
+    {
+        return CHIP8_ENGINE_TABLE;
+    }
+
+    if (strcmp(name, "block") == 0)
+    {
+        return CHIP8_ENGINE_BLOCK;
+    }
+
+    if (strcmp(name, "jit") == 0)
+    {
+        return CHIP8_ENGINE_JIT;
+    }
+
+    if (strcmp(name, "aot") == 0)
+    {
+        return CHIP8_ENGINE_AOT;
+    }
+
+    return -1;
+}
+
+int chip8_parse_quirks(const char *name)
+{
+#define X(name_, label, quirks)       \
+    if (strcmp(name, label) == 0)     \
+    {                                 \
+        return CHIP8_QUIRKS_##name_;  \
+    }
+    CHIP8_QUIRK_PROFILES(X)
+#undef X
+
+    return -1;
+}
+
+const char *chip8_quirks_name(int quirks)
+{
+    switch (quirks)
+    {
+#define X(name, label, quirks) \
+    case CHIP8_QUIRKS_##name:  \
+        return label;
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+    default:
+        return "unknown";
+    }
+}
+
+// CHIP8_QUIRK_* bits of a CHIP8_QUIRKS_* profile
+unsigned int chip8_quirk_bits(int quirks)
+{
+    switch (quirks)
+    {
+#define X(name, label, bits)  \
+    case CHIP8_QUIRKS_##name: \
+        return (bits);
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+    default:
+        return 0;
+    }
+}
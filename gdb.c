@@ -0,0 +1,785 @@
+#include "chip8.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// GDB remote serial protocol over a local TCP port or unix socket. The
+// registers GDB sees are, in order and described by target.xml below,
+//   v0-vf (8 bits), i (16), pc (16), sp (8), dt (8), st (8)
+// with 16-bit ones little-endian, and memory is the 4 KB at address 0.
+// Breakpoints and watchpoints go in the chip8_debug bitmaps, so a
+// session with none armed runs the machine on its usual engine.
+//
+// The stub never blocks the frontend while the machine runs: the
+// frontend polls for packets and runs the machine in slices with
+// chip8_gdb_run(), which reports a stop when one happens.
+
+static const char chip8_gdb_target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.chip8.core\">"
+    "<reg name=\"v0\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v1\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v2\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v3\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v4\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v5\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v6\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v7\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v8\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"v9\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"va\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vb\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vc\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vd\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"ve\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"vf\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>"
+    "</feature>"
+    "</target>";
+
+const unsigned int GDB_NUM_REGS = 21;
+
+// signals stop replies give
+const int GDB_SIGINT = 2;
+const int GDB_SIGILL = 4;
+const int GDB_SIGTRAP = 5;
+const int GDB_SIGSEGV = 11;
+
+// chip8_gdb in_state, where the receiver is in "$<payload>#<checksum>"
+enum
+{
+    GDB_IN_IDLE,
+    GDB_IN_PAYLOAD,
+    GDB_IN_CHECKSUM1,
+    GDB_IN_CHECKSUM2,
+};
+
+static const char chip8_gdb_hex_digits[] = "0123456789abcdef";
+
+static int chip8_gdb_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parses hex digits up to the next non-hex character, returning where
+// it stopped or NULL if there were none
+static const char *chip8_gdb_parse_hex(const char *text, unsigned long *value)
+{
+    const char *start = text;
+
+    *value = 0;
+    while (chip8_gdb_hex(*text) >= 0)
+    {
+        *value = (*value << 4) | chip8_gdb_hex(*text);
+        text++;
+    }
+
+    return text == start ? NULL : text;
+}
+
+static void chip8_gdb_put_byte(char *out, uint8_t byte)
+{
+    out[0] = chip8_gdb_hex_digits[byte >> 4];
+    out[1] = chip8_gdb_hex_digits[byte & 0xF];
+}
+
+static int chip8_gdb_write(struct chip8_gdb *gdb, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(gdb->fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return -1;
+        }
+
+        data += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+// Sends one packet, keeping it in case GDB wants it again
+static void chip8_gdb_send(struct chip8_gdb *gdb, const char *payload)
+{
+    size_t len = strlen(payload);
+    uint8_t checksum = 0;
+
+    gdb->out[0] = '$';
+    for (size_t i = 0; i < len; i++)
+    {
+        gdb->out[1 + i] = payload[i];
+        checksum += (uint8_t)payload[i];
+    }
+    gdb->out[1 + len] = '#';
+    chip8_gdb_put_byte(&gdb->out[2 + len], checksum);
+    gdb->out_len = len + 4;
+
+    chip8_gdb_write(gdb, gdb->out, gdb->out_len);
+}
+
+// The stop reply for where the machine is now, S or T packet
+static void chip8_gdb_send_stop(struct chip8_gdb *gdb, const struct chip8_data *chip)
+{
+    char reply[64];
+    struct chip8_debug *debug = &gdb->debug;
+
+    if (chip->status == CHIP8_INVALID_OPCODE)
+    {
+        snprintf(reply, sizeof(reply), "S%02x", GDB_SIGILL);
+    }
+    else if (chip->status != CHIP8_OK)
+    {
+        snprintf(reply, sizeof(reply), "S%02x", GDB_SIGSEGV);
+    }
+    else if (debug->stop == CHIP8_DEBUG_BREAK)
+    {
+        snprintf(reply, sizeof(reply), "T%02xswbreak:;", GDB_SIGTRAP);
+    }
+    else if (debug->stop != 0)
+    {
+        // an address watched both ways was set with Z4
+        int both = chip8_debug_test(debug->reads, debug->stop_addr) && chip8_debug_test(debug->writes, debug->stop_addr);
+        const char *kind = both ? "awatch" : debug->stop == CHIP8_DEBUG_READ ? "rwatch" : "watch";
+        snprintf(reply, sizeof(reply), "T%02x%s:%x;", GDB_SIGTRAP, kind, debug->stop_addr);
+    }
+    else
+    {
+        snprintf(reply, sizeof(reply), "S%02x", GDB_SIGTRAP);
+    }
+
+    debug->stop = 0;
+    chip8_gdb_send(gdb, reply);
+}
+
+static unsigned int chip8_gdb_reg_bytes(unsigned int reg)
+{
+    return reg == 16 || reg == 17 ? 2 : 1;
+}
+
+static unsigned int chip8_gdb_get_reg(const struct chip8_data *chip, unsigned int reg)
+{
+    switch (reg)
+    {
+    case 16:
+        return chip->idx;
+    case 17:
+        return chip->pc;
+    case 18:
+        return chip->sp;
+    case 19:
+        return chip->delTime;
+    case 20:
+        return chip->sfxTime;
+    default:
+        return chip->regs[reg & 0xF];
+    }
+}
+
+static void chip8_gdb_set_reg(struct chip8_data *chip, unsigned int reg, unsigned int value)
+{
+    switch (reg)
+    {
+    case 16:
+        chip->idx = value;
+        break;
+    case 17:
+        chip->pc = value;
+        break;
+    case 18:
+        // 2nnn and 00EE trust it to index the stack
+        chip->sp = value < 16 ? value : 15;
+        break;
+    case 19:
+        chip->delTime = value;
+        break;
+    case 20:
+        chip->sfxTime = value;
+        break;
+    default:
+        chip->regs[reg & 0xF] = value;
+        break;
+    }
+}
+
+// Register value as target-order hex, returns the characters written
+static size_t chip8_gdb_put_reg(char *out, const struct chip8_data *chip, unsigned int reg)
+{
+    unsigned int value = chip8_gdb_get_reg(chip, reg);
+
+    for (unsigned int i = 0; i < chip8_gdb_reg_bytes(reg); i++)
+    {
+        chip8_gdb_put_byte(out + 2 * i, value >> (8 * i));
+    }
+
+    return 2 * chip8_gdb_reg_bytes(reg);
+}
+
+// Target-order hex of a register's size, returns where it stopped or NULL
+static const char *chip8_gdb_parse_reg(const char *text, unsigned int reg, unsigned int *value)
+{
+    *value = 0;
+    for (unsigned int i = 0; i < chip8_gdb_reg_bytes(reg); i++)
+    {
+        int hi = chip8_gdb_hex(text[0]);
+        int lo = hi >= 0 ? chip8_gdb_hex(text[1]) : -1;
+        if (lo < 0)
+        {
+            return NULL;
+        }
+
+        *value |= (unsigned int)(hi << 4 | lo) << (8 * i);
+        text += 2;
+    }
+
+    return text;
+}
+
+// "Z<type>,<addr>,<kind>" and "z..." for the CHIP8_DEBUG_* kinds
+static void chip8_gdb_stop_point(struct chip8_gdb *gdb, const char *packet)
+{
+    static const int kinds[5] = {
+        CHIP8_DEBUG_BREAK, CHIP8_DEBUG_BREAK, CHIP8_DEBUG_WRITE, CHIP8_DEBUG_READ, CHIP8_DEBUG_READ | CHIP8_DEBUG_WRITE,
+    };
+    unsigned long type;
+    unsigned long addr;
+    unsigned long len;
+    const char *next = chip8_gdb_parse_hex(packet + 1, &type);
+
+    if (next == NULL || *next != ',' || type > 4 || (next = chip8_gdb_parse_hex(next + 1, &addr)) == NULL ||
+        *next != ',' || chip8_gdb_parse_hex(next + 1, &len) == NULL)
+    {
+        chip8_gdb_send(gdb, "E01");
+        return;
+    }
+
+    // a breakpoint's kind is the instruction length, only its first byte counts
+    if (kinds[type] == CHIP8_DEBUG_BREAK)
+    {
+        len = 1;
+    }
+
+    if (addr > 0xFFF || len > 0x1000 || chip8_debug_set(&gdb->debug, kinds[type], addr, len, packet[0] == 'Z') < 0)
+    {
+        chip8_gdb_send(gdb, "E01");
+        return;
+    }
+
+    chip8_gdb_send(gdb, "OK");
+}
+
+// "qXfer:features:read:target.xml:<offset>,<length>"
+static void chip8_gdb_xfer_features(struct chip8_gdb *gdb, const char *args)
+{
+    unsigned long offset;
+    unsigned long len;
+    const char *next;
+    static const char annex[] = "target.xml:";
+
+    if (strncmp(args, annex, sizeof(annex) - 1) != 0)
+    {
+        chip8_gdb_send(gdb, "E00");
+        return;
+    }
+
+    next = chip8_gdb_parse_hex(args + sizeof(annex) - 1, &offset);
+    if (next == NULL || *next != ',' || chip8_gdb_parse_hex(next + 1, &len) == NULL)
+    {
+        chip8_gdb_send(gdb, "E01");
+        return;
+    }
+
+    size_t total = sizeof(chip8_gdb_target_xml) - 1;
+    char reply[CHIP8_GDB_PACKET_SIZE];
+    if (offset > total)
+    {
+        offset = total;
+    }
+    if (len > total - offset)
+    {
+        len = total - offset;
+    }
+    if (len > sizeof(reply) - 2)
+    {
+        len = sizeof(reply) - 2;
+    }
+
+    // 'l' marks the last piece
+    reply[0] = offset + len < total ? 'm' : 'l';
+    memcpy(reply + 1, chip8_gdb_target_xml + offset, len);
+    reply[1 + len] = '\0';
+    chip8_gdb_send(gdb, reply);
+}
+
+// Runs one instruction and reports where it stopped
+static void chip8_gdb_step(struct chip8_gdb *gdb, struct chip8_data *chip)
+{
+    gdb->debug.resume = 1;
+    chip8_step(chip, 1);
+    gdb->debug.resume = 0;
+    chip8_gdb_send_stop(gdb, chip);
+}
+
+// Handles one packet. Returns -1 if it ended the session.
+static int chip8_gdb_handle(struct chip8_gdb *gdb, struct chip8_data *chip, const char *packet)
+{
+    char reply[2 * CHIP8_GDB_PACKET_SIZE + 1];
+    unsigned long addr;
+    unsigned long len;
+    unsigned int value;
+    const char *next;
+
+    switch (packet[0])
+    {
+    case '?':
+        chip8_gdb_send_stop(gdb, chip);
+        return 0;
+
+    case 'g':
+    {
+        size_t pos = 0;
+        for (unsigned int reg = 0; reg < GDB_NUM_REGS; reg++)
+        {
+            pos += chip8_gdb_put_reg(reply + pos, chip, reg);
+        }
+        reply[pos] = '\0';
+        chip8_gdb_send(gdb, reply);
+        return 0;
+    }
+
+    case 'G':
+    {
+        // all or nothing, so a short packet leaves the registers alone
+        unsigned int values[GDB_NUM_REGS];
+        next = packet + 1;
+        for (unsigned int reg = 0; reg < GDB_NUM_REGS && next != NULL; reg++)
+        {
+            next = chip8_gdb_parse_reg(next, reg, &values[reg]);
+        }
+        if (next == NULL)
+        {
+            chip8_gdb_send(gdb, "E01");
+            return 0;
+        }
+
+        for (unsigned int reg = 0; reg < GDB_NUM_REGS; reg++)
+        {
+            chip8_gdb_set_reg(chip, reg, values[reg]);
+        }
+        chip8_gdb_send(gdb, "OK");
+        return 0;
+    }
+
+    case 'p':
+        if (chip8_gdb_parse_hex(packet + 1, &addr) == NULL || addr >= GDB_NUM_REGS)
+        {
+            chip8_gdb_send(gdb, "E01");
+            return 0;
+        }
+        reply[chip8_gdb_put_reg(reply, chip, addr)] = '\0';
+        chip8_gdb_send(gdb, reply);
+        return 0;
+
+    case 'P':
+        next = chip8_gdb_parse_hex(packet + 1, &addr);
+        if (next == NULL || *next != '=' || addr >= GDB_NUM_REGS || chip8_gdb_parse_reg(next + 1, addr, &value) == NULL)
+        {
+            chip8_gdb_send(gdb, "E01");
+            return 0;
+        }
+        chip8_gdb_set_reg(chip, addr, value);
+        chip8_gdb_send(gdb, "OK");
+        return 0;
+
+    case 'm':
+        next = chip8_gdb_parse_hex(packet + 1, &addr);
+        if (next == NULL || *next != ',' || chip8_gdb_parse_hex(next + 1, &len) == NULL || addr > 0xFFF)
+        {
+            chip8_gdb_send(gdb, "E01");
+            return 0;
+        }
+
+        // a read past the end of memory comes back short
+        if (len > 0x1000 - addr)
+        {
+            len = 0x1000 - addr;
+        }
+        if (len > CHIP8_GDB_PACKET_SIZE)
+        {
+            len = CHIP8_GDB_PACKET_SIZE;
+        }
+        for (unsigned long i = 0; i < len; i++)
+        {
+            chip8_gdb_put_byte(reply + 2 * i, chip->mem[addr + i]);
+        }
+        reply[2 * len] = '\0';
+        chip8_gdb_send(gdb, reply);
+        return 0;
+
+    case 'M':
+        next = chip8_gdb_parse_hex(packet + 1, &addr);
+        if (next == NULL || *next != ',' || (next = chip8_gdb_parse_hex(next + 1, &len)) == NULL || *next != ':' ||
+            addr > 0xFFF || len > 0x1000 - addr || strlen(next + 1) != 2 * len)
+        {
+            chip8_gdb_send(gdb, "E01");
+            return 0;
+        }
+
+        for (unsigned long i = 0; i < len; i++)
+        {
+            int hi = chip8_gdb_hex(next[1 + 2 * i]);
+            int lo = chip8_gdb_hex(next[2 + 2 * i]);
+            if (hi < 0 || lo < 0)
+            {
+                chip8_gdb_send(gdb, "E01");
+                return 0;
+            }
+            chip->mem[addr + i] = hi << 4 | lo;
+        }
+
+        // the engines may have code decoded from those bytes
+        chip8_bcache_write(chip, addr, len);
+        chip8_gdb_send(gdb, "OK");
+        return 0;
+
+    case 's':
+    case 'c':
+        if (chip8_gdb_parse_hex(packet + 1, &addr) != NULL)
+        {
+            chip->pc = addr;
+        }
+
+        if (packet[0] == 's' || chip->status != CHIP8_OK)
+        {
+            chip8_gdb_step(gdb, chip);
+            return 0;
+        }
+
+        // the stop is sent by chip8_gdb_run() when it comes
+        gdb->debug.resume = 1;
+        gdb->running = 1;
+        return 0;
+
+    case 'Z':
+    case 'z':
+        chip8_gdb_stop_point(gdb, packet);
+        return 0;
+
+    case 'D':
+        chip8_gdb_send(gdb, "OK");
+        return -1;
+
+    case 'k':
+        return -1;
+
+    case 'H':
+    case 'T':
+        chip8_gdb_send(gdb, "OK");
+        return 0;
+
+    case 'q':
+        if (strncmp(packet, "qSupported", 10) == 0)
+        {
+            snprintf(reply, sizeof(reply), "PacketSize=%x;qXfer:features:read+;swbreak+;hwbreak+;QStartNoAckMode+",
+                     CHIP8_GDB_PACKET_SIZE);
+            chip8_gdb_send(gdb, reply);
+        }
+        else if (strncmp(packet, "qXfer:features:read:", 20) == 0)
+        {
+            chip8_gdb_xfer_features(gdb, packet + 20);
+        }
+        else if (strcmp(packet, "qAttached") == 0)
+        {
+            chip8_gdb_send(gdb, "1");
+        }
+        else if (strcmp(packet, "qC") == 0)
+        {
+            chip8_gdb_send(gdb, "QC1");
+        }
+        else if (strcmp(packet, "qfThreadInfo") == 0)
+        {
+            chip8_gdb_send(gdb, "m1");
+        }
+        else if (strcmp(packet, "qsThreadInfo") == 0)
+        {
+            chip8_gdb_send(gdb, "l");
+        }
+        else if (strcmp(packet, "qOffsets") == 0)
+        {
+            chip8_gdb_send(gdb, "Text=0;Data=0;Bss=0");
+        }
+        else
+        {
+            chip8_gdb_send(gdb, "");
+        }
+        return 0;
+
+    case 'Q':
+        if (strcmp(packet, "QStartNoAckMode") == 0)
+        {
+            // acknowledged like any other packet, the next one isn't
+            chip8_gdb_send(gdb, "OK");
+            gdb->no_ack = 1;
+            return 0;
+        }
+        chip8_gdb_send(gdb, "");
+        return 0;
+
+    default:
+        // an empty reply tells GDB the packet isn't supported
+        chip8_gdb_send(gdb, "");
+        return 0;
+    }
+}
+
+// Takes in received bytes, handling each packet they complete. Returns -1
+// if one ended the session.
+static int chip8_gdb_receive(struct chip8_gdb *gdb, struct chip8_data *chip, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+
+        switch (gdb->in_state)
+        {
+        case GDB_IN_IDLE:
+            if (c == '$')
+            {
+                gdb->in_len = 0;
+                gdb->in_state = GDB_IN_PAYLOAD;
+            }
+            else if (c == '-' && !gdb->no_ack)
+            {
+                chip8_gdb_write(gdb, gdb->out, gdb->out_len);
+            }
+            else if (c == 0x03 && gdb->running)
+            {
+                // ^C from GDB's side
+                gdb->running = 0;
+                char reply[4];
+                snprintf(reply, sizeof(reply), "S%02x", GDB_SIGINT);
+                chip8_gdb_send(gdb, reply);
+            }
+            break;
+
+        case GDB_IN_PAYLOAD:
+            if (c == '#')
+            {
+                gdb->in_state = GDB_IN_CHECKSUM1;
+            }
+            else if (gdb->in_len < sizeof(gdb->in) - 1)
+            {
+                gdb->in[gdb->in_len++] = c;
+            }
+            break;
+
+        case GDB_IN_CHECKSUM1:
+            gdb->in_checksum[0] = c;
+            gdb->in_state = GDB_IN_CHECKSUM2;
+            break;
+
+        case GDB_IN_CHECKSUM2:
+        {
+            gdb->in_checksum[1] = c;
+            gdb->in_state = GDB_IN_IDLE;
+            gdb->in[gdb->in_len] = '\0';
+
+            uint8_t checksum = 0;
+            for (size_t j = 0; j < gdb->in_len; j++)
+            {
+                checksum += (uint8_t)gdb->in[j];
+            }
+
+            int hi = chip8_gdb_hex(gdb->in_checksum[0]);
+            int lo = chip8_gdb_hex(gdb->in_checksum[1]);
+            if (!gdb->no_ack)
+            {
+                int ok = hi >= 0 && lo >= 0 && (hi << 4 | lo) == checksum;
+                chip8_gdb_write(gdb, ok ? "+" : "-", 1);
+                if (!ok)
+                {
+                    break;
+                }
+            }
+
+            // nothing but ^C is expected while the machine runs
+            if (!gdb->running && chip8_gdb_handle(gdb, chip, gdb->in) < 0)
+            {
+                return -1;
+            }
+            break;
+        }
+        }
+    }
+
+    return 0;
+}
+
+// Listens on address, a port number on 127.0.0.1 or a unix socket path
+int chip8_gdb_open(struct chip8_gdb *gdb, const char *address)
+{
+    memset(gdb, 0, sizeof(*gdb));
+    gdb->listen_fd = -1;
+    gdb->fd = -1;
+
+    char *port_end;
+    unsigned long port = strtoul(address, &port_end, 10);
+
+    if (*address != '\0' && *port_end == '\0')
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int reuse = 1;
+        gdb->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (gdb->listen_fd < 0 || port > 65535 ||
+            setsockopt(gdb->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+            bind(gdb->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(gdb->listen_fd, 1) < 0)
+        {
+            fprintf(stderr, "Could not listen on port %s: %s\n", address, strerror(errno));
+            chip8_gdb_close(gdb);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Socket path '%s' is too long\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+
+        gdb->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (gdb->listen_fd < 0 || bind(gdb->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(gdb->listen_fd, 1) < 0)
+        {
+            fprintf(stderr, "Could not listen on '%s': %s\n", address, strerror(errno));
+            chip8_gdb_close(gdb);
+            return -1;
+        }
+        strcpy(gdb->path, address);
+    }
+
+    return 0;
+}
+
+// Waits for GDB to connect, with the machine stopped
+int chip8_gdb_accept(struct chip8_gdb *gdb)
+{
+    gdb->fd = accept(gdb->listen_fd, NULL, NULL);
+    if (gdb->fd < 0)
+    {
+        fprintf(stderr, "Could not accept a GDB connection: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // replies are small and each one is waited on
+    int nodelay = 1;
+    setsockopt(gdb->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return 0;
+}
+
+// Handles whatever GDB has sent, waiting up to timeout_ms for it (-1 for
+// as long as it takes). Returns -1 once GDB detaches, kills the machine
+// or goes away.
+int chip8_gdb_poll(struct chip8_gdb *gdb, struct chip8_data *chip, int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = gdb->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (ready == 0)
+    {
+        return 0;
+    }
+
+    char data[1024];
+    ssize_t len = recv(gdb->fd, data, sizeof(data), 0);
+    if (len <= 0)
+    {
+        return len < 0 && errno == EINTR ? 0 : -1;
+    }
+
+    return chip8_gdb_receive(gdb, chip, data, len);
+}
+
+// Runs up to cycles instructions if GDB has the machine running, and
+// sends the stop reply if a breakpoint, watchpoint or fault stops it
+void chip8_gdb_run(struct chip8_gdb *gdb, struct chip8_data *chip, unsigned long long cycles)
+{
+    if (!gdb->running)
+    {
+        return;
+    }
+
+    int status = chip8_step(chip, cycles);
+    gdb->debug.resume = 0;
+
+    if (status != CHIP8_OK || gdb->debug.stop != 0)
+    {
+        gdb->running = 0;
+        chip8_gdb_send_stop(gdb, chip);
+    }
+}
+
+void chip8_gdb_close(struct chip8_gdb *gdb)
+{
+    if (gdb->fd >= 0)
+    {
+        close(gdb->fd);
+        gdb->fd = -1;
+    }
+
+    if (gdb->listen_fd >= 0)
+    {
+        close(gdb->listen_fd);
+        gdb->listen_fd = -1;
+    }
+
+    if (gdb->path[0] != '\0')
+    {
+        unlink(gdb->path);
+        gdb->path[0] = '\0';
+    }
+}
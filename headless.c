@@ -0,0 +1,555 @@
+#include "headless.h"
+#include <getopt.h>
+
+const int HEADLESS_CAPTURE_SCALE = 4;
+
+// instructions run between looks for a ^C while GDB has the machine running
+const unsigned long long HEADLESS_GDB_SLICE = 100000;
+
+static void headless_usage()
+{
+    fprintf(stderr, "Usage: chip8-emu-headless [-e engine] [-q quirks] [-i ips] [-r] [-w seconds] [-a pcm] [-c capture] [-t trace] [-s state] [-S state] <cycles>[f] <rom_file_bin>\n");
+    fprintf(stderr, "       chip8-emu-headless [-e engine] [-q quirks] [-c capture] [-t trace] [-s state] [-S state] -p <input_log> <rom_file_bin>\n");
+    fprintf(stderr, "       chip8-emu-headless [-e engine] [-q quirks] [-i ips] [-s state] [-S state] -g <port|socket> <rom_file_bin>\n");
+    fprintf(stderr, "       chip8-emu-headless [-e engine] [-i ips] -b <jobs_file> [-j threads]\n");
+    fprintf(stderr, "       chip8-emu-headless [-i ips] --bench-engines <cycles> <rom_file_bin>...\n");
+    fprintf(stderr, "       chip8-emu-headless [-i ips] --bench-scaler <frames> <rom_file_bin>...\n");
+    fprintf(stderr, "       chip8-emu-headless [-e engine] [-i ips] --suite <baseline> [--update-baseline] [--tolerance pct] <cycles>[f] <rom_file_bin>...\n");
+    fprintf(stderr, "  -e, --engine   switch, table, block, jit or aot (default table)\n");
+    fprintf(stderr, "  -q, --quirks   modern, vip, chip48 or schip (default: from the ROM database, else modern)\n");
+    fprintf(stderr, "  -i, --ips      emulated instructions per second (default %u)\n", CHIP8_DEFAULT_IPS);
+    fprintf(stderr, "  -r, --realtime pace the run at 60 frames per second of wall time\n");
+    fprintf(stderr, "  -w, --rewind   keep a rewind buffer of this many seconds and report its cost\n");
+    fprintf(stderr, "  -a, --pcm      write the sound as raw signed 16-bit mono %u Hz PCM\n", CHIP8_AUDIO_RATE);
+    fprintf(stderr, "  -s, --load-state  boot from a state file, which keeps the ips it was saved with, and its quirks unless -q is given\n");
+    fprintf(stderr, "  -S, --save-state  write a state file once the run completes\n");
+    fprintf(stderr, "  -x, --seed     seed for Cxkk (default: the time)\n");
+    fprintf(stderr, "  -p, --replay   run an input log recorded by chip8-emu -R to its end\n");
+    fprintf(stderr, "  -P, --profile  text, json or folded; needs a -DCHIP8_PROFILE build\n");
+    fprintf(stderr, "  -c, --capture  record every frame to a .y4m, .gif or raw RGBA file\n");
+    fprintf(stderr, "      --capture-scale  frames are 128x64 times this (default %d)\n", HEADLESS_CAPTURE_SCALE);
+    fprintf(stderr, "      --capture-filter nearest, scale2x or scale3x (default nearest)\n");
+    fprintf(stderr, "      --capture-scanlines darken the last line of every display row\n");
+    fprintf(stderr, "  -t, --trace    write the last instructions run to a file for chip8-tracedump, at the end or on a fault\n");
+    fprintf(stderr, "      --trace-size instructions the trace keeps (default %u)\n", CHIP8_TRACE_DEFAULT_ENTRIES);
+    fprintf(stderr, "  -g, --gdb      serve the GDB remote protocol on a 127.0.0.1 port or unix socket, run until it detaches\n");
+    fprintf(stderr, "  a trailing 'f' counts 60 Hz timer frames instead of cycles\n");
+}
+
+static int headless_parse_cycles(const char *arg, unsigned int ips, unsigned long long *cycles)
+{
+    char *count_end;
+    unsigned long long count = strtoull(arg, &count_end, 10);
+
+    *cycles = count;
+    if (*count_end == 'f')
+    {
+        // the instructions it takes a fresh machine to reach that frame
+        *cycles = (count * ips + 59) / 60;
+        count_end++;
+    }
+
+    if (count_end == arg || *count_end != '\0')
+    {
+        fprintf(stderr, "Invalid run length '%s'\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"engine", required_argument, NULL, 'e'},
+        {"quirks", required_argument, NULL, 'q'},
+        {"batch", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 'j'},
+        {"ips", required_argument, NULL, 'i'},
+        {"realtime", no_argument, NULL, 'r'},
+        {"rewind", required_argument, NULL, 'w'},
+        {"pcm", required_argument, NULL, 'a'},
+        {"load-state", required_argument, NULL, 's'},
+        {"save-state", required_argument, NULL, 'S'},
+        {"seed", required_argument, NULL, 'x'},
+        {"replay", required_argument, NULL, 'p'},
+        {"profile", required_argument, NULL, 'P'},
+        {"capture", required_argument, NULL, 'c'},
+        {"capture-scale", required_argument, NULL, 'K'},
+        {"capture-filter", required_argument, NULL, 'F'},
+        {"capture-scanlines", no_argument, NULL, 'L'},
+        {"trace", required_argument, NULL, 't'},
+        {"trace-size", required_argument, NULL, 'N'},
+        {"gdb", required_argument, NULL, 'g'},
+        {"bench-engines", no_argument, NULL, 'E'},
+        {"bench-scaler", no_argument, NULL, 'C'},
+        {"suite", required_argument, NULL, 'B'},
+        {"update-baseline", no_argument, NULL, 'U'},
+        {"tolerance", required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int engine = CHIP8_ENGINE_TABLE;
+    int quirks = -1;
+    const char *jobs_filename = NULL;
+    int num_threads = 0;
+    unsigned int ips = CHIP8_DEFAULT_IPS;
+    int bench_engines = 0;
+    int bench_scaler = 0;
+    const char *baseline_filename = NULL;
+    int update_baseline = 0;
+    double tolerance_pct = 10.0;
+    int realtime = 0;
+    unsigned int rewind_seconds = 0;
+    const char *pcm_filename = NULL;
+    const char *load_state_filename = NULL;
+    const char *save_state_filename = NULL;
+    uint64_t seed = time(NULL);
+    const char *replay_filename = NULL;
+#ifdef CHIP8_PROFILE
+    const char *profile_format = NULL;
+#endif
+    const char *capture_filename = NULL;
+    int capture_scale = HEADLESS_CAPTURE_SCALE;
+    int capture_filter = CHIP8_SCALE_NEAREST;
+    int capture_scanlines = 0;
+    const char *trace_filename = NULL;
+    unsigned int trace_entries = CHIP8_TRACE_DEFAULT_ENTRIES;
+    const char *gdb_address = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "e:q:b:j:i:rw:a:s:S:x:p:P:c:t:g:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+            engine = chip8_parse_engine(optarg);
+            if (engine < 0)
+            {
+                fprintf(stderr, "Unknown engine '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            quirks = chip8_parse_quirks(optarg);
+            if (quirks < 0)
+            {
+                fprintf(stderr, "Unknown quirks '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            jobs_filename = optarg;
+            break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'i':
+            ips = strtoul(optarg, NULL, 10);
+            if (ips == 0)
+            {
+                fprintf(stderr, "Invalid instructions per second '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            realtime = 1;
+            break;
+        case 'w':
+            rewind_seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            pcm_filename = optarg;
+            break;
+        case 's':
+            load_state_filename = optarg;
+            break;
+        case 'S':
+            save_state_filename = optarg;
+            break;
+        case 'x':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            replay_filename = optarg;
+            break;
+        case 'P':
+#ifdef CHIP8_PROFILE
+            profile_format = optarg;
+            break;
+#else
+            fprintf(stderr, "Profiling needs a build with -DCHIP8_PROFILE, see make headless-profile\n");
+            return 1;
+#endif
+        case 'c':
+            capture_filename = optarg;
+            break;
+        case 'K':
+            capture_scale = atoi(optarg);
+            break;
+        case 'F':
+            capture_filter = chip8_parse_scale_filter(optarg);
+            if (capture_filter < 0)
+            {
+                fprintf(stderr, "Unknown scale filter '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            capture_scanlines = 1;
+            break;
+        case 't':
+            trace_filename = optarg;
+            break;
+        case 'N':
+            trace_entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            gdb_address = optarg;
+            break;
+        case 'E':
+            bench_engines = 1;
+            break;
+        case 'C':
+            bench_scaler = 1;
+            break;
+        case 'B':
+            baseline_filename = optarg;
+            break;
+        case 'U':
+            update_baseline = 1;
+            break;
+        case 'T':
+            tolerance_pct = atof(optarg);
+            break;
+        default:
+            headless_usage();
+            return 1;
+        }
+    }
+
+    if (jobs_filename != NULL)
+    {
+        return batch_main(jobs_filename, num_threads, engine, ips, seed);
+    }
+
+    unsigned long long cycles;
+    if (baseline_filename != NULL)
+    {
+        if (argc - optind < 2 || headless_parse_cycles(argv[optind], ips, &cycles) < 0)
+        {
+            headless_usage();
+            return 1;
+        }
+
+        return bench_suite_main(baseline_filename, update_baseline, tolerance_pct, cycles, ips, engine,
+                                argv + optind + 1, argc - optind - 1);
+    }
+
+    if (bench_engines)
+    {
+        if (argc - optind < 2 || headless_parse_cycles(argv[optind], ips, &cycles) < 0)
+        {
+            headless_usage();
+            return 1;
+        }
+
+        return bench_engines_main(cycles, ips, argv + optind + 1, argc - optind - 1);
+    }
+
+    if (bench_scaler)
+    {
+        char *frames_end;
+        unsigned long long frames = argc - optind >= 2 ? strtoull(argv[optind], &frames_end, 10) : 0;
+        if (frames == 0 || *frames_end != '\0')
+        {
+            headless_usage();
+            return 1;
+        }
+
+        return bench_scaler_main(frames, ips, argv + optind + 1, argc - optind - 1);
+    }
+
+    // a replay runs for as long as the recording did, a GDB session for as
+    // long as GDB stays
+    struct chip8_inputlog replay;
+    if (gdb_address != NULL)
+    {
+        if (argc - optind != 1)
+        {
+            headless_usage();
+            return 1;
+        }
+    }
+    else if (replay_filename != NULL)
+    {
+        if (argc - optind != 1)
+        {
+            headless_usage();
+            return 1;
+        }
+        if (chip8_inputlog_load(&replay, replay_filename) < 0)
+        {
+            return 1;
+        }
+    }
+    else if (argc - optind != 2 || headless_parse_cycles(argv[optind], ips, &cycles) < 0)
+    {
+        headless_usage();
+        return 1;
+    }
+
+    const char *rom_filename = argv[argc - 1];
+
+    struct chip8_data *chip = chip8_create();
+    if (chip8_load_rom(chip, rom_filename) != CHIP8_OK)
+    {
+        return 1;
+    }
+    chip->engine = engine;
+    chip->ips = ips;
+    chip8_seed(chip, seed);
+
+    if (load_state_filename != NULL && chip8_state_load(chip, load_state_filename) < 0)
+    {
+        return 1;
+    }
+
+    // after the state, which brings the profile it was saved with
+    if (quirks >= 0)
+    {
+        chip8_set_quirks(chip, quirks);
+    }
+
+    static struct chip8_capture capture;
+    if (capture_filename != NULL && chip8_capture_open(&capture, capture_filename, capture_filter, capture_scale, capture_scanlines) < 0)
+    {
+        return 1;
+    }
+
+    // a fault saves the trace from inside chip8_fault(), with the faulting
+    // instruction last
+    struct chip8_trace trace;
+    if (trace_filename != NULL)
+    {
+        if (chip8_trace_init(&trace, trace_entries, trace_filename) < 0)
+        {
+            return 1;
+        }
+        chip->trace = &trace;
+    }
+
+    int status = CHIP8_OK;
+    long long start_time = time_nanos();
+    if (gdb_address != NULL)
+    {
+        static struct chip8_gdb gdb;
+        if (chip8_gdb_open(&gdb, gdb_address) < 0)
+        {
+            return 1;
+        }
+
+        fprintf(stderr, "Waiting for GDB on %s\n", gdb_address);
+        if (chip8_gdb_accept(&gdb) < 0)
+        {
+            chip8_gdb_close(&gdb);
+            return 1;
+        }
+        chip->debug = &gdb.debug;
+
+        // the machine starts stopped; while GDB has it running, it runs
+        // flat out and only stops to look for a ^C
+        uint64_t start_frames = chip->frames;
+        uint32_t start_acc = chip->timer_acc;
+        while (chip8_gdb_poll(&gdb, chip, gdb.running ? 0 : -1) == 0)
+        {
+            chip8_gdb_run(&gdb, chip, HEADLESS_GDB_SLICE);
+        }
+
+        chip->debug = NULL;
+        chip8_gdb_close(&gdb);
+        status = chip->status;
+        cycles = ((chip->frames - start_frames) * chip->ips + chip->timer_acc - start_acc) / 60;
+    }
+    else if (replay_filename != NULL)
+    {
+        // the log carries everything the session started with that the
+        // ROM or state file doesn't
+        chip->ips = replay.header.ips;
+        chip->rng = replay.header.rng;
+        if (chip->frames != replay.header.start_frame)
+        {
+            fprintf(stderr, "Input log starts at frame %llu but the machine is at frame %llu\n",
+                    (unsigned long long)replay.header.start_frame, (unsigned long long)chip->frames);
+            return 1;
+        }
+
+        if (capture_filename != NULL)
+        {
+            // a frame at a time so each one is captured
+            cycles = 0;
+            while (chip->frames < replay.end_frame)
+            {
+                cycles += chip8_inputlog_replay(&replay, chip, chip->frames + 1);
+                chip8_capture_push(&capture, chip);
+            }
+        }
+        else
+        {
+            cycles = chip8_inputlog_replay(&replay, chip, replay.end_frame);
+        }
+        fprintf(stderr, "replay_events=%zu\n", replay.num_events);
+        chip8_inputlog_free(&replay);
+    }
+    else if (realtime || rewind_seconds > 0 || pcm_filename != NULL || capture_filename != NULL)
+    {
+        struct chip8_sched sched;
+        struct chip8_rewind rw;
+        struct chip8_audio audio;
+        FILE *pcm_file = NULL;
+        unsigned long long executed = 0;
+        unsigned long long uploaded_frames = 0;
+
+        if (rewind_seconds > 0 && chip8_rewind_init(&rw, rewind_seconds, CHIP8_REWIND_DEFAULT_BUDGET) < 0)
+        {
+            return 1;
+        }
+
+        if (pcm_filename != NULL)
+        {
+            pcm_file = fopen(pcm_filename, "wb");
+            if (pcm_file == NULL)
+            {
+                fprintf(stderr, "Could not create PCM file '%s'\n", pcm_filename);
+                return 1;
+            }
+
+            // the file stands in for a device buffer one frame long
+            chip8_audio_init(&audio, CHIP8_AUDIO_RATE, CHIP8_AUDIO_RATE / 60);
+        }
+
+        chip8_sched_init(&sched, 60);
+        while (executed < cycles)
+        {
+            unsigned long long run = chip8_cycles_to_frame(chip);
+            if (run > cycles - executed)
+            {
+                run = cycles - executed;
+            }
+
+            status = chip8_step(chip, run);
+            if (status != CHIP8_OK)
+            {
+                break;
+            }
+            executed += run;
+
+            if (rewind_seconds > 0)
+            {
+                chip8_rewind_push(&rw, chip);
+            }
+
+            if (capture_filename != NULL)
+            {
+                chip8_capture_push(&capture, chip);
+            }
+
+            if (pcm_file != NULL && chip8_audio_write_pcm(&audio, chip, pcm_file) < 0)
+            {
+                fprintf(stderr, "Could not write PCM file '%s'\n", pcm_filename);
+                return 1;
+            }
+
+            if (realtime)
+            {
+                // stands in for the upload a display frontend would do
+                if (chip->vid_dirty)
+                {
+                    chip->vid_dirty = 0;
+                    uploaded_frames++;
+                }
+
+                chip8_sched_wait(&sched);
+            }
+        }
+
+        if (realtime)
+        {
+            chip8_sched_report(&sched, stderr);
+            fprintf(stderr, "uploaded_frames=%llu skipped_frames=%llu\n", uploaded_frames, sched.total_frames - uploaded_frames);
+        }
+
+        if (rewind_seconds > 0)
+        {
+            chip8_rewind_report(&rw, stderr);
+            chip8_rewind_free(&rw);
+        }
+
+        if (pcm_file != NULL)
+        {
+            fclose(pcm_file);
+            chip8_audio_report(&audio, stderr);
+        }
+    }
+    else
+    {
+        status = chip8_step(chip, cycles);
+    }
+
+    // whatever was captured up to a fault is kept, it's what a bug report
+    // wants to show
+    if (capture_filename != NULL)
+    {
+        int capture_status = chip8_capture_close(&capture);
+        chip8_capture_report(&capture, stderr);
+        if (capture_status < 0)
+        {
+            return 1;
+        }
+    }
+
+    if (trace_filename != NULL)
+    {
+        int trace_status = status == CHIP8_OK ? chip8_trace_save(&trace, chip, trace_filename) : 0;
+        chip->trace = NULL;
+        chip8_trace_free(&trace);
+        if (trace_status < 0)
+        {
+            return 1;
+        }
+    }
+
+    if (status != CHIP8_OK)
+    {
+        fprintf(stderr, "Aborting!\n%s\n", chip8_status_name(status));
+        chip8_print_state(chip);
+        return 1;
+    }
+
+    long long elapsed = time_nanos() - start_time;
+    double seconds = elapsed / 1e9;
+
+    printf("seed=%llu\n", (unsigned long long)seed);
+    printf("quirks=%s\n", chip8_quirks_name(chip->quirks));
+    printf("cycles=%llu\n", cycles);
+    printf("seconds=%.6f\n", seconds);
+    printf("frames=%llu\n", (unsigned long long)chip->frames);
+    printf("ips=%.0f\n", seconds > 0 ? cycles / seconds : 0.0);
+    printf("idle_cycles=%llu\n", chip->idle_cycles);
+    printf("vid_hash=%016llx\n", (unsigned long long)chip8_display_hash(chip));
+    printf("mem_hash=%016llx\n", (unsigned long long)chip8_hash(chip->mem, sizeof(chip->mem)));
+
+    if (save_state_filename != NULL && chip8_state_save(chip, save_state_filename) < 0)
+    {
+        return 1;
+    }
+
+#ifdef CHIP8_PROFILE
+    if (profile_format != NULL && chip8_profile_dump(chip, profile_format, stdout) < 0)
+    {
+        return 1;
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "chip8.h"
+
+// headless functions, chip8-emu-headless modes other than a single run
+int batch_main(const char *jobs_filename, int num_threads, int engine, unsigned int ips, uint64_t seed);
+int bench_engines_main(unsigned long long cycles, unsigned int ips, char **rom_filenames, int num_roms);
+int bench_scaler_main(unsigned long long frames, unsigned int ips, char **rom_filenames, int num_roms);
+int bench_suite_main(const char *baseline_filename, int update_baseline, double tolerance_pct,
+                     unsigned long long cycles, unsigned int ips, int engine, char **rom_filenames, int num_roms);
+
+#endif
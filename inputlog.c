@@ -0,0 +1,225 @@
+#include "chip8.h"
+
+// An input log is a chip8_inputlog_header followed by one record per key
+// transition:
+//   <varint frames since the previous record> <down << 4 | key>
+// and a final record with key byte INPUTLOG_END giving the frame the
+// session stopped at. Transitions are applied at the start of their frame,
+// before any of its instructions run, so a replay that runs whole frames
+// sees exactly what the recording did.
+
+const char CHIP8_INPUTLOG_MAGIC[8] = {'C', 'H', '8', 'I', 'N', 'P', 'U', 'T'};
+const uint32_t CHIP8_INPUTLOG_VERSION = 1;
+const uint8_t INPUTLOG_END = 0xFF;
+
+static void chip8_inputlog_put(struct chip8_inputlog *log, uint64_t frame, uint8_t code)
+{
+    uint64_t delta = frame - log->last_frame;
+    uint8_t buf[11];
+    int len = 0;
+
+    while (delta >= 0x80)
+    {
+        buf[len++] = (delta & 0x7F) | 0x80;
+        delta >>= 7;
+    }
+    buf[len++] = delta;
+    buf[len++] = code;
+
+    fwrite(buf, len, 1, log->file);
+    log->last_frame = frame;
+}
+
+int chip8_inputlog_create(struct chip8_inputlog *log, const char *filename, const struct chip8_data *chip)
+{
+    memset(log, 0, sizeof(*log));
+
+    log->file = fopen(filename, "wb");
+    if (log->file == NULL)
+    {
+        fprintf(stderr, "Could not create input log '%s'\n", filename);
+        return -1;
+    }
+
+    struct chip8_inputlog_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_INPUTLOG_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_INPUTLOG_VERSION;
+    header.ips = chip->ips;
+    header.rng = chip->rng;
+    header.start_frame = chip->frames;
+    fwrite(&header, sizeof(header), 1, log->file);
+
+    log->header = header;
+    log->last_frame = chip->frames;
+    memcpy(log->keys, chip->keys, sizeof(log->keys));
+
+    return 0;
+}
+
+// Logs whatever keys changed since the last call. Call once per frame,
+// before running it.
+void chip8_inputlog_record(struct chip8_inputlog *log, const struct chip8_data *chip)
+{
+    if (log->file == NULL)
+    {
+        return;
+    }
+
+    // rewinding or loading a state leaves a log that can't be replayed
+    // from its start, so stop at the last frame that can
+    if (chip->frames < log->last_frame)
+    {
+        fprintf(stderr, "Machine state moved back, input log stopped at frame %llu\n", (unsigned long long)log->last_frame);
+        chip8_inputlog_close(log, log->last_frame);
+        return;
+    }
+
+    for (int key = 0; key < 16; key++)
+    {
+        if (chip->keys[key] != log->keys[key])
+        {
+            log->keys[key] = chip->keys[key];
+            chip8_inputlog_put(log, chip->frames, (chip->keys[key] != 0) << 4 | key);
+            log->num_events++;
+        }
+    }
+}
+
+void chip8_inputlog_close(struct chip8_inputlog *log, uint64_t end_frame)
+{
+    if (log->file == NULL)
+    {
+        return;
+    }
+
+    chip8_inputlog_put(log, end_frame, INPUTLOG_END);
+    fclose(log->file);
+    log->file = NULL;
+}
+
+int chip8_inputlog_load(struct chip8_inputlog *log, const char *filename)
+{
+    memset(log, 0, sizeof(*log));
+
+    FILE *log_file = fopen(filename, "rb");
+    if (log_file == NULL)
+    {
+        fprintf(stderr, "Could not open input log '%s'\n", filename);
+        return -1;
+    }
+
+    if (fread(&log->header, sizeof(log->header), 1, log_file) != 1 ||
+        memcmp(log->header.magic, CHIP8_INPUTLOG_MAGIC, sizeof(log->header.magic)) != 0 ||
+        log->header.version != CHIP8_INPUTLOG_VERSION)
+    {
+        fprintf(stderr, "'%s' is not a version %u input log\n", filename, CHIP8_INPUTLOG_VERSION);
+        fclose(log_file);
+        return -1;
+    }
+
+    if (log->header.ips == 0)
+    {
+        fprintf(stderr, "Input log '%s' has an instruction rate of 0\n", filename);
+        fclose(log_file);
+        return -1;
+    }
+
+    size_t cap_events = 0;
+    uint64_t frame = log->header.start_frame;
+    int status = -1;
+
+    for (;;)
+    {
+        uint64_t delta = 0;
+        int shift = 0;
+        int c;
+
+        while ((c = fgetc(log_file)) != EOF && (c & 0x80) && shift < 63)
+        {
+            delta |= (uint64_t)(c & 0x7F) << shift;
+            shift += 7;
+        }
+        if (c == EOF)
+        {
+            // a session that crashed has no end record, replay what there is
+            log->end_frame = frame;
+            status = 0;
+            break;
+        }
+        delta |= (uint64_t)c << shift;
+        frame += delta;
+
+        int code = fgetc(log_file);
+        if (code == EOF)
+        {
+            fprintf(stderr, "Input log '%s' is truncated\n", filename);
+            break;
+        }
+
+        if (code == INPUTLOG_END)
+        {
+            log->end_frame = frame;
+            status = 0;
+            break;
+        }
+
+        if (log->num_events == cap_events)
+        {
+            cap_events = cap_events ? cap_events * 2 : 256;
+            log->events = (struct chip8_input_event *)realloc(log->events, cap_events * sizeof(*log->events));
+        }
+
+        log->events[log->num_events].frame = frame;
+        log->events[log->num_events].key = code & 0xF;
+        log->events[log->num_events].down = (code >> 4) & 1;
+        log->num_events++;
+    }
+
+    fclose(log_file);
+    if (status < 0)
+    {
+        free(log->events);
+        log->events = NULL;
+    }
+
+    return status;
+}
+
+// Runs until end_frame, applying the logged transitions as their frames
+// come up. Between transitions the machine runs straight through. A later
+// call carries on from there, so a replay can also go a frame at a time.
+// Returns the instructions executed.
+unsigned long long chip8_inputlog_replay(struct chip8_inputlog *log, struct chip8_data *chip, uint64_t end_frame)
+{
+    unsigned long long executed = 0;
+    size_t next_event = log->next_event;
+
+    while (chip->frames < end_frame)
+    {
+        while (next_event < log->num_events && log->events[next_event].frame <= chip->frames)
+        {
+            chip->keys[log->events[next_event].key] = log->events[next_event].down;
+            next_event++;
+        }
+
+        uint64_t run_to = end_frame;
+        if (next_event < log->num_events && log->events[next_event].frame < run_to)
+        {
+            run_to = log->events[next_event].frame;
+        }
+
+        unsigned long long run = chip8_cycles_until_frame(chip, run_to);
+        chip8_run(chip, run);
+        executed += run;
+    }
+
+    log->next_event = next_event;
+    return executed;
+}
+
+void chip8_inputlog_free(struct chip8_inputlog *log)
+{
+    free(log->events);
+    log->events = NULL;
+}
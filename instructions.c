@@ -1,497 +1,787 @@
 #include "chip8.h"
 
 // CLS (clear the display)
-void chip8_op_0E00()
+template <unsigned int Q>
+void chip8_op_0E00(struct chip8_data *chip, const struct chip8_insn *)
 {
-    memset(g_chip8_data.vid, 0, sizeof(g_chip8_data.vid));
+    memset(chip->vid, 0, sizeof(chip->vid));
+    memset(chip->vid_right, 0, sizeof(chip->vid_right));
+    chip->vid_dirty = 1;
 }
 
 // 00EE - RET
 // Return from a subroutine
-void chip8_op_00EE()
+template <unsigned int Q>
+void chip8_op_00EE(struct chip8_data *chip, const struct chip8_insn *)
 {
-    if (g_chip8_data.sp <= 0)
+    if (chip->sp <= 0)
     {
-        fprintf(stderr, "Aborting!\nInvalid SP during RET\n");
-        chip8_print_state();
-        exit(-1);
+        chip8_fault(chip, CHIP8_STACK_UNDERFLOW);
     }
 
-    g_chip8_data.pc = g_chip8_data.stk[--g_chip8_data.sp];
+    chip->pc = chip->stk[--chip->sp];
 }
 
 // 1nnn - JP addr
 // Jump to location nnn
-void chip8_op_1nnn()
+template <unsigned int Q>
+void chip8_op_1nnn(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    g_chip8_data.pc = g_chip8_data.opcode & 0x0FFF;
+    // VIP 64x64 ROMs start with 1260, which on the real machine jumps into
+    // a patched interpreter loaded alongside them. Switch modes and skip to
+    // where the program proper starts at 02C0.
+    if (in->nnn == 0x260 && chip->pc == 0x202)
+    {
+        chip->vid_height = 64;
+        chip->vid_dirty = 1;
+        chip->pc = 0x2C0;
+        return;
+    }
+
+    // a jump to itself, or back to an Fx07 / 3xkk delay poll, is an idle
+    // loop that chip8_unpark() can skip
+    if (in->nnn == chip->pc - 2)
+    {
+        chip->parked = 1;
+    }
+    else if (in->nnn == chip->pc - 6 && in->nnn <= 0xFFA)
+    {
+        const uint8_t *loop = &chip->mem[in->nnn];
+        chip->parked = (loop[0] & 0xF0) == 0xF0 && loop[1] == 0x07 && loop[2] == (0x30 | (loop[0] & 0x0F));
+    }
+
+    chip->pc = in->nnn;
 }
 
 //  2nnn - CALL addr
 // Call subroutine at nnn.
-void chip8_op_2nnn()
+template <unsigned int Q>
+void chip8_op_2nnn(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    if (g_chip8_data.sp >= 15)
+    if (chip->sp >= 15)
     {
-        fprintf(stderr, "Aborting!\nStack Overflow\n");
-        chip8_print_state();
-        exit(-1);
+        chip8_fault(chip, CHIP8_STACK_OVERFLOW);
     }
 
-    g_chip8_data.stk[g_chip8_data.sp++] = g_chip8_data.pc;
-    g_chip8_data.pc = g_chip8_data.opcode & 0x0FFF;
+    chip->stk[chip->sp++] = chip->pc;
+    chip->pc = in->nnn;
 }
 
 // 3xkk - SE Vx, byte
 // Skip next instruction if Vx == kk
-void chip8_op_3xkk()
+template <unsigned int Q>
+void chip8_op_3xkk(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint16_t kk = (g_chip8_data.opcode & 0x00FF);
-    if (g_chip8_data.regs[x] == kk)
+    if (chip->regs[in->x] == in->kk)
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
 // 4xkk - SNE Vx, byte
 // Skip next instruction if Vx != kk
-void chip8_op_4xkk()
+template <unsigned int Q>
+void chip8_op_4xkk(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint16_t kk = (g_chip8_data.opcode & 0x00FF);
-    if (g_chip8_data.regs[x] != kk)
+    if (chip->regs[in->x] != in->kk)
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
 // 5xy0 - SE Vx, Vy
 // Skip next instruction if Vx == Vy
-void chip8_op_5xy0()
+template <unsigned int Q>
+void chip8_op_5xy0(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    if (g_chip8_data.regs[x] == g_chip8_data.regs[y])
+    if (chip->regs[in->x] == chip->regs[in->y])
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
 // 6xkk - LD Vx, byte
 // Set Vx = kk
-void chip8_op_6xkk()
+template <unsigned int Q>
+void chip8_op_6xkk(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t kk = (g_chip8_data.opcode & 0x00FF);
-    g_chip8_data.regs[x] = kk;
+    chip->regs[in->x] = in->kk;
 }
 
 // 7xkk - ADD Vx, byte
 // Set Vx = Vx + kk
-void chip8_op_7xkk()
+template <unsigned int Q>
+void chip8_op_7xkk(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t kk = (g_chip8_data.opcode & 0x00FF);
-    g_chip8_data.regs[x] += kk;
+    chip->regs[in->x] += in->kk;
 }
 
 // 8xy0 - LD Vx, Vy
 // Set Vx = Vy.
-void chip8_op_8xy0()
+template <unsigned int Q>
+void chip8_op_8xy0(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    g_chip8_data.regs[x] = g_chip8_data.regs[y];
+    chip->regs[in->x] = chip->regs[in->y];
 }
 
 // 8xy1 - OR Vx, Vy
 // Set Vx = Vx | Vy.
-void chip8_op_8xy1()
+template <unsigned int Q>
+void chip8_op_8xy1(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    g_chip8_data.regs[x] |= g_chip8_data.regs[y];
+    chip->regs[in->x] |= chip->regs[in->y];
+    if (Q & CHIP8_QUIRK_VF_RESET)
+    {
+        chip->regs[0xF] = 0;
+    }
 }
 
 // 8xy2 - AND Vx, Vy
 // Set Vx = Vx & Vy.
-void chip8_op_8xy2()
+template <unsigned int Q>
+void chip8_op_8xy2(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    g_chip8_data.regs[x] &= g_chip8_data.regs[y];
+    chip->regs[in->x] &= chip->regs[in->y];
+    if (Q & CHIP8_QUIRK_VF_RESET)
+    {
+        chip->regs[0xF] = 0;
+    }
 }
 
 // 8xy3 - XOR Vx, Vy
 // Set Vx = Vx ^ Vy.
-void chip8_op_8xy3()
+template <unsigned int Q>
+void chip8_op_8xy3(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    g_chip8_data.regs[x] ^= g_chip8_data.regs[y];
+    chip->regs[in->x] ^= chip->regs[in->y];
+    if (Q & CHIP8_QUIRK_VF_RESET)
+    {
+        chip->regs[0xF] = 0;
+    }
 }
 
 // 8xy4 - ADD Vx, Vy
 // Set Vx = Vx + Vy, set VF = carry
-void chip8_op_8xy4()
+template <unsigned int Q>
+void chip8_op_8xy4(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    uint16_t ans = g_chip8_data.regs[x] + g_chip8_data.regs[y];
+    uint16_t ans = chip->regs[in->x] + chip->regs[in->y];
 
-    g_chip8_data.regs[0xF] = ans > 0xFF;
-    g_chip8_data.regs[x] = ans & 0xFF;
+    chip->regs[0xF] = ans > 0xFF;
+    chip->regs[in->x] = ans & 0xFF;
 }
 
 // 8xy5 - SUB Vx, Vy
 // Set Vx = Vx - Vy, set VF = not borrow
-void chip8_op_8xy5()
+template <unsigned int Q>
+void chip8_op_8xy5(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    uint16_t ans = g_chip8_data.regs[x] - g_chip8_data.regs[y];
+    uint16_t ans = chip->regs[in->x] - chip->regs[in->y];
 
-    g_chip8_data.regs[0xF] = g_chip8_data.regs[x] > g_chip8_data.regs[y];
+    chip->regs[0xF] = chip->regs[in->x] > chip->regs[in->y];
 
-    g_chip8_data.regs[x] = ans & 0xFF;
+    chip->regs[in->x] = ans & 0xFF;
 }
 
 // 8xy6 - SHR Vx {, Vy}
-// Set Vx = Vx >> 1, Set VF = Vx & 1
-void chip8_op_8xy6()
+// Set Vx = Vx >> 1, Set VF = Vx & 1. The VIP shifts Vy instead and sets
+// VF last.
+template <unsigned int Q>
+void chip8_op_8xy6(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.regs[0xF] = g_chip8_data.regs[x] & 1;
-    g_chip8_data.regs[x] >>= 1;
+    if (Q & CHIP8_QUIRK_SHIFT_VY)
+    {
+        uint8_t src = chip->regs[in->y];
+        chip->regs[in->x] = src >> 1;
+        chip->regs[0xF] = src & 1;
+        return;
+    }
+
+    chip->regs[0xF] = chip->regs[in->x] & 1;
+    chip->regs[in->x] >>= 1;
 }
 
 // 8xy7 - SUBN Vx, Vy
 // Set Vx = Vy - Vx, set VF = not borrow
-void chip8_op_8xy7()
+template <unsigned int Q>
+void chip8_op_8xy7(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    uint16_t ans = g_chip8_data.regs[y] - g_chip8_data.regs[x];
+    uint16_t ans = chip->regs[in->y] - chip->regs[in->x];
 
-    g_chip8_data.regs[0xF] = (g_chip8_data.regs[y] > g_chip8_data.regs[x]);
+    chip->regs[0xF] = (chip->regs[in->y] > chip->regs[in->x]);
 
-    g_chip8_data.regs[x] = ans & 0xFF;
+    chip->regs[in->x] = ans & 0xFF;
 }
 
 // 8xyE - SHL Vx {, Vy}
-// Set Vx = Vx << 1, Set VF = 1 if MSB is on
-void chip8_op_8xyE()
+// Set Vx = Vx << 1, Set VF = 1 if MSB is on. The VIP shifts Vy instead
+// and sets VF last.
+template <unsigned int Q>
+void chip8_op_8xyE(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.regs[0xF] = (g_chip8_data.regs[x] & 0x80) >> 7;
-    g_chip8_data.regs[x] <<= 1;
+    if (Q & CHIP8_QUIRK_SHIFT_VY)
+    {
+        uint8_t src = chip->regs[in->y];
+        chip->regs[in->x] = src << 1;
+        chip->regs[0xF] = src >> 7;
+        return;
+    }
+
+    chip->regs[0xF] = (chip->regs[in->x] & 0x80) >> 7;
+    chip->regs[in->x] <<= 1;
 }
 
 // 9xy0 - SNE Vx, Vy
 // Skip next instruction if Vx != Vy.
-void chip8_op_9xy0()
+template <unsigned int Q>
+void chip8_op_9xy0(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    if (g_chip8_data.regs[x] != g_chip8_data.regs[y])
+    if (chip->regs[in->x] != chip->regs[in->y])
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
 // Annn - LD I, addr
 // Set I = nnn.
-void chip8_op_Annn()
+template <unsigned int Q>
+void chip8_op_Annn(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    g_chip8_data.idx = g_chip8_data.opcode & 0x0FFF;
+    chip->idx = in->nnn;
 }
 
 // Bnnn - JP V0, addr
-// Jump to location nnn + V0.
-void chip8_op_Bnnn()
+// Jump to location nnn + V0. CHIP-48 and SUPER-CHIP read it as Bxnn and
+// add Vx instead.
+template <unsigned int Q>
+void chip8_op_Bnnn(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    g_chip8_data.pc += g_chip8_data.opcode & 0x0FFF;
+    chip->pc = in->nnn + chip->regs[(Q & CHIP8_QUIRK_JUMP_VX) ? in->x : 0];
 }
 
 // Cxkk - RND Vx, byte
 // Set Vx = random byte AND kk.
-void chip8_op_Cxkk()
-{
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t kk = (g_chip8_data.opcode & 0x00FF);
-    g_chip8_data.regs[x] = (rand() % 256) & kk;
-}
-
-void chip8_op_Dxyn()
-{
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t y = (g_chip8_data.opcode & 0x00F0) >> 4;
-    uint8_t height = g_chip8_data.opcode & 0x000F;
-
-    uint8_t x_pos = g_chip8_data.regs[x] % VIDEO_WIDTH;
-    uint8_t y_pos = g_chip8_data.regs[y] % VIDEO_HEIGHT;
-    g_chip8_data.regs[0xF] = 0;
-
-    for (uint8_t row = 0; row < height; ++row)
+template <unsigned int Q>
+void chip8_op_Cxkk(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->regs[in->x] = chip8_random(chip) & in->kk;
+}
+
+// Dxyn - DRW Vx, Vy, nibble
+// XOR an n-byte sprite from I onto the display at (Vx, Vy), set VF = collision.
+// Dxy0 draws a 16x16 sprite, two bytes per row. The start position wraps
+// around the display, the sprite itself is clipped at the right and bottom
+// edges.
+template <unsigned int Q>
+void chip8_op_Dxyn(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    unsigned int width = chip->vid_width;
+    unsigned int height = chip->vid_height;
+    // every mode's dimensions are powers of two
+    unsigned int x_pos = chip->regs[in->x] & (width - 1);
+    unsigned int y_pos = chip->regs[in->y] & (height - 1);
+    unsigned int rows = in->n ? in->n : 16;
+    unsigned int row_bytes = in->n ? 1 : 2;
+    uint64_t collision = 0;
+    uint64_t drawn = 0;
+
+    if (width == 64 && row_bytes == 1)
     {
-        uint8_t sprite_byte = g_chip8_data.mem[g_chip8_data.idx + row];
-        for (uint8_t col = 0; col < 8; col++)
+        // the usual case, byte-wide rows that only ever touch vid
+        for (unsigned int row = 0; row < rows && y_pos + row < height; ++row)
         {
-            uint8_t sprite_pixel = sprite_byte & (0x80 >> col);
-            uint32_t *screen_pixel = &g_chip8_data.vid[(y_pos + row) * VIDEO_WIDTH + (x_pos + col)];
+            // bit 63 is the leftmost pixel, whatever lands past bit 0 is clipped
+            uint64_t sprite_row = ((uint64_t)chip->mem[(chip->idx + row) & 0xFFF] << 56) >> x_pos;
+            uint64_t *screen_row = &chip->vid[y_pos + row];
 
-            if (sprite_pixel)
+            collision |= *screen_row & sprite_row;
+            drawn |= sprite_row;
+            *screen_row ^= sprite_row;
+        }
+    }
+    else
+    {
+        for (unsigned int row = 0; row < rows && y_pos + row < height; ++row)
+        {
+            uint16_t addr = chip->idx + row * row_bytes;
+            uint64_t sprite_row = (uint64_t)chip->mem[addr & 0xFFF] << 56;
+            if (row_bytes == 2)
             {
-                if (*screen_pixel)
-                    g_chip8_data.regs[0xF] = 1;
+                sprite_row |= (uint64_t)chip->mem[(addr + 1) & 0xFFF] << 48;
+            }
 
-                *screen_pixel ^= 0xFFFFFFFF;
+            // split across the two 64-column halves, whatever lands past
+            // the mode's right edge is clipped
+            uint64_t left = x_pos < 64 ? sprite_row >> x_pos : 0;
+            uint64_t right = 0;
+            if (width > 64)
+            {
+                right = x_pos >= 64 ? sprite_row >> (x_pos - 64) : x_pos > 0 ? sprite_row << (64 - x_pos) : 0;
             }
+
+            uint64_t *screen_left = &chip->vid[y_pos + row];
+            uint64_t *screen_right = &chip->vid_right[y_pos + row];
+
+            collision |= (*screen_left & left) | (*screen_right & right);
+            drawn |= left | right;
+            *screen_left ^= left;
+            *screen_right ^= right;
         }
     }
+
+    chip->regs[0xF] = collision != 0;
+    chip->vid_dirty |= drawn != 0;
+    CHIP8_PROFILE_READ(chip, chip->idx, rows * row_bytes);
 }
 
-void chip8_op_Ex9E()
+template <unsigned int Q>
+void chip8_op_Ex9E(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    if (g_chip8_data.keys[g_chip8_data.regs[x]])
+    if (chip->keys[chip->regs[in->x]])
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
-void chip8_op_ExA1()
+template <unsigned int Q>
+void chip8_op_ExA1(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    if (!g_chip8_data.keys[g_chip8_data.regs[x]])
+    if (!chip->keys[chip->regs[in->x]])
     {
-        g_chip8_data.pc += 2;
+        chip->pc += 2;
     }
 }
 
-void chip8_op_Fx07()
+template <unsigned int Q>
+void chip8_op_Fx07(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.regs[x] = g_chip8_data.delTime;
+    chip->regs[in->x] = chip->delTime;
 }
 
-void chip8_op_Fx0A()
+template <unsigned int Q>
+void chip8_op_Fx0A(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-
     for (uint8_t key = 0; key < 16; key++)
     {
-        if (g_chip8_data.keys[key])
+        if (chip->keys[key])
         {
-            g_chip8_data.regs[x] = key;
+            chip->regs[in->x] = key;
             return;
         }
     }
 
-    g_chip8_data.pc -= 2;
+    // no key can arrive before the run ends, so wait it out in one go
+    chip->pc -= 2;
+    chip->parked = 1;
 }
 
-void chip8_op_Fx15()
+template <unsigned int Q>
+void chip8_op_Fx15(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.delTime = g_chip8_data.regs[x];
+    chip->delTime = chip->regs[in->x];
 }
 
-void chip8_op_Fx18()
+template <unsigned int Q>
+void chip8_op_Fx18(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.sfxTime = g_chip8_data.regs[x];
+    chip->sfxTime = chip->regs[in->x];
 }
 
-void chip8_op_Fx1E()
+template <unsigned int Q>
+void chip8_op_Fx1E(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    g_chip8_data.idx += g_chip8_data.regs[x];
+    chip->idx += chip->regs[in->x];
 }
 
-void chip8_op_Fx29()
+template <unsigned int Q>
+void chip8_op_Fx29(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t digit = g_chip8_data.regs[x];
-    g_chip8_data.idx = FONT_OFFSET + 5 * digit;
+    uint8_t digit = chip->regs[in->x];
+    chip->idx = FONT_OFFSET + 5 * digit;
 }
 
-void chip8_op_Fx33()
+template <unsigned int Q>
+void chip8_op_Fx33(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    uint8_t val = g_chip8_data.regs[x];
+    uint8_t val = chip->regs[in->x];
 
     for (int i = 2; i >= 0; i--)
     {
-        g_chip8_data.mem[g_chip8_data.idx + i] = val % 10;
+        chip->mem[(chip->idx + i) & 0xFFF] = val % 10;
         val /= 10;
     }
+
+    chip8_bcache_write(chip, chip->idx, 3);
+    CHIP8_PROFILE_WRITE(chip, chip->idx, 3);
 }
 
-void chip8_op_Fx55()
+// Where Fx55 and Fx65 leave I
+template <unsigned int Q>
+static inline void chip8_load_store_advance(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    for (uint8_t i = 0; i <= x; i++)
+    if (Q & CHIP8_QUIRK_LOAD_STORE_I)
+    {
+        chip->idx += in->x + 1;
+    }
+    else if (Q & CHIP8_QUIRK_LOAD_STORE_I_X)
     {
-        g_chip8_data.mem[g_chip8_data.idx + i] = g_chip8_data.regs[i];
+        chip->idx += in->x;
     }
 }
 
-void chip8_op_Fx65()
+template <unsigned int Q>
+void chip8_op_Fx55(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    uint8_t x = (g_chip8_data.opcode & 0x0F00) >> 8;
-    for (uint8_t i = 0; i <= x; i++)
+    for (uint8_t i = 0; i <= in->x; i++)
     {
-        g_chip8_data.regs[i] = g_chip8_data.mem[g_chip8_data.idx + i];
+        chip->mem[(chip->idx + i) & 0xFFF] = chip->regs[i];
     }
+
+    chip8_bcache_write(chip, chip->idx, in->x + 1);
+    CHIP8_PROFILE_WRITE(chip, chip->idx, in->x + 1);
+    chip8_load_store_advance<Q>(chip, in);
 }
 
-void chip8_decode_execute()
+template <unsigned int Q>
+void chip8_op_Fx65(struct chip8_data *chip, const struct chip8_insn *in)
 {
-    switch (g_chip8_data.opcode & 0xF000)
+    for (uint8_t i = 0; i <= in->x; i++)
+    {
+        chip->regs[i] = chip->mem[(chip->idx + i) & 0xFFF];
+    }
+
+    CHIP8_PROFILE_READ(chip, chip->idx, in->x + 1);
+    chip8_load_store_advance<Q>(chip, in);
+}
+
+// SUPER-CHIP display and flag instructions
+
+// 00Cn - SCD nibble
+// Scroll the display down n rows
+template <unsigned int Q>
+void chip8_op_00Cn(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    unsigned int height = chip->vid_height;
+    unsigned int n = in->n;
+
+    memmove(chip->vid + n, chip->vid, (height - n) * sizeof(chip->vid[0]));
+    memmove(chip->vid_right + n, chip->vid_right, (height - n) * sizeof(chip->vid_right[0]));
+    memset(chip->vid, 0, n * sizeof(chip->vid[0]));
+    memset(chip->vid_right, 0, n * sizeof(chip->vid_right[0]));
+    chip->vid_dirty |= n != 0;
+}
+
+// 00FB - SCR
+// Scroll the display right 4 pixels
+template <unsigned int Q>
+void chip8_op_00FB(struct chip8_data *chip, const struct chip8_insn *)
+{
+    for (unsigned int row = 0; row < chip->vid_height; row++)
+    {
+        if (chip->vid_width > 64)
+        {
+            chip->vid_right[row] = (chip->vid_right[row] >> 4) | (chip->vid[row] << 60);
+        }
+        chip->vid[row] >>= 4;
+    }
+
+    chip->vid_dirty = 1;
+}
+
+// 00FC - SCL
+// Scroll the display left 4 pixels
+template <unsigned int Q>
+void chip8_op_00FC(struct chip8_data *chip, const struct chip8_insn *)
+{
+    for (unsigned int row = 0; row < chip->vid_height; row++)
+    {
+        chip->vid[row] = (chip->vid[row] << 4) | (chip->vid_right[row] >> 60);
+        chip->vid_right[row] <<= 4;
+    }
+
+    chip->vid_dirty = 1;
+}
+
+// 00FD - EXIT
+// Stop the program. The machine parks on this instruction, like Fx0A with
+// no key ever coming.
+template <unsigned int Q>
+void chip8_op_00FD(struct chip8_data *chip, const struct chip8_insn *)
+{
+    chip->pc -= 2;
+    chip->parked = 1;
+}
+
+// 00FE - LOW
+// Switch to the 64x32 display and clear it
+template <unsigned int Q>
+void chip8_op_00FE(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->vid_width = 64;
+    chip->vid_height = 32;
+    chip8_op_0E00<Q>(chip, in);
+}
+
+// 00FF - HIGH
+// Switch to the 128x64 display and clear it
+template <unsigned int Q>
+void chip8_op_00FF(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->vid_width = 128;
+    chip->vid_height = 64;
+    chip8_op_0E00<Q>(chip, in);
+}
+
+// Fx30 - LD HF, Vx
+// Set I = location of the 8x10 sprite for digit Vx
+template <unsigned int Q>
+void chip8_op_Fx30(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    uint8_t digit = chip->regs[in->x] & 0xF;
+    chip->idx = BIG_FONT_OFFSET + 10 * digit;
+}
+
+// Fx75 - LD R, Vx
+// Store V0 through Vx in the RPL flags
+template <unsigned int Q>
+void chip8_op_Fx75(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    memcpy(chip->rpl, chip->regs, in->x + 1);
+}
+
+// Fx85 - LD Vx, R
+// Read V0 through Vx from the RPL flags
+template <unsigned int Q>
+void chip8_op_Fx85(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    memcpy(chip->regs, chip->rpl, in->x + 1);
+}
+
+// Superinstructions, only ever built by the block cache. Each one stands
+// for two consecutive opcodes, see chip8_bcache_fuse().
+
+// Annn, Dxyn
+template <unsigned int Q>
+void chip8_op_Annn_Dxyn(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->idx = in->nnn;
+    chip8_op_Dxyn<Q>(chip, in);
+}
+
+// 7xkk, 3ykk (second kk in the low byte of nnn)
+template <unsigned int Q>
+void chip8_op_7xkk_3xkk(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->regs[in->x] += in->kk;
+    if (chip->regs[in->y] == (in->nnn & 0x00FF))
+    {
+        chip->pc += 2;
+    }
+}
+
+// Fx07, 3ykk
+template <unsigned int Q>
+void chip8_op_Fx07_3xkk(struct chip8_data *chip, const struct chip8_insn *in)
+{
+    chip->regs[in->x] = chip->delTime;
+    if (chip->regs[in->y] == in->kk)
+    {
+        chip->pc += 2;
+    }
+}
+
+template <unsigned int Q>
+void chip8_op_invalid(struct chip8_data *chip, const struct chip8_insn *)
+{
+    chip8_fault(chip, CHIP8_INVALID_OPCODE);
+}
+
+template <unsigned int Q>
+void chip8_decode_execute(struct chip8_data *chip)
+{
+    struct chip8_insn in;
+    chip8_decode_operands(chip->opcode, &in);
+
+    switch (chip->opcode & 0xF000)
     {
     case 0x0000:
-        switch (g_chip8_data.opcode & 0x00FF)
+        switch (chip->opcode & 0x00FF)
         {
         case 0x00E0:
-            chip8_op_0E00();
+            chip8_op_0E00<Q>(chip, &in);
             break;
         case 0x00EE:
-            chip8_op_00EE();
+            chip8_op_00EE<Q>(chip, &in);
+            break;
+        case 0x0030:
+            // 0230 is the VIP hires interpreter's clear screen
+            if (chip->opcode == 0x0230)
+            {
+                chip8_op_0E00<Q>(chip, &in);
+            }
+            else
+            {
+                chip8_op_invalid<Q>(chip, &in);
+            }
+            break;
+        case 0x00FB:
+            chip8_op_00FB<Q>(chip, &in);
+            break;
+        case 0x00FC:
+            chip8_op_00FC<Q>(chip, &in);
+            break;
+        case 0x00FD:
+            chip8_op_00FD<Q>(chip, &in);
+            break;
+        case 0x00FE:
+            chip8_op_00FE<Q>(chip, &in);
+            break;
+        case 0x00FF:
+            chip8_op_00FF<Q>(chip, &in);
             break;
         default:
-            fprintf(stderr, "Aborting!\nInvalid opcode: 0x%04X\n", g_chip8_data.opcode);
-            chip8_print_state();
-            exit(-1);
+            if ((chip->opcode & 0x00F0) == 0x00C0)
+            {
+                chip8_op_00Cn<Q>(chip, &in);
+            }
+            else
+            {
+                chip8_op_invalid<Q>(chip, &in);
+            }
+            break;
         }
         break;
     case 0x1000:
-        chip8_op_1nnn();
+        chip8_op_1nnn<Q>(chip, &in);
         break;
     case 0x2000:
-        chip8_op_2nnn();
+        chip8_op_2nnn<Q>(chip, &in);
         break;
     case 0x3000:
-        chip8_op_3xkk();
+        chip8_op_3xkk<Q>(chip, &in);
         break;
     case 0x4000:
-        chip8_op_4xkk();
+        chip8_op_4xkk<Q>(chip, &in);
         break;
     case 0x5000:
-        chip8_op_5xy0();
+        chip8_op_5xy0<Q>(chip, &in);
         break;
     case 0x6000:
-        chip8_op_6xkk();
+        chip8_op_6xkk<Q>(chip, &in);
         break;
     case 0x7000:
-        chip8_op_7xkk();
+        chip8_op_7xkk<Q>(chip, &in);
         break;
     case 0x8000:
-        switch (g_chip8_data.opcode & 0x000F)
+        switch (chip->opcode & 0x000F)
         {
         case 0x0000:
-            chip8_op_8xy0();
+            chip8_op_8xy0<Q>(chip, &in);
             break;
         case 0x0001:
-            chip8_op_8xy1();
+            chip8_op_8xy1<Q>(chip, &in);
             break;
         case 0x0002:
-            chip8_op_8xy2();
+            chip8_op_8xy2<Q>(chip, &in);
             break;
         case 0x0003:
-            chip8_op_8xy3();
+            chip8_op_8xy3<Q>(chip, &in);
             break;
         case 0x0004:
-            chip8_op_8xy4();
+            chip8_op_8xy4<Q>(chip, &in);
             break;
         case 0x0005:
-            chip8_op_8xy5();
+            chip8_op_8xy5<Q>(chip, &in);
             break;
         case 0x0006:
-            chip8_op_8xy6();
+            chip8_op_8xy6<Q>(chip, &in);
             break;
         case 0x0007:
-            chip8_op_8xy7();
+            chip8_op_8xy7<Q>(chip, &in);
             break;
         case 0x000E:
-            chip8_op_8xyE();
+            chip8_op_8xyE<Q>(chip, &in);
             break;
         default:
-            fprintf(stderr, "Aborting!\nInvalid opcode: 0x%04X\n", g_chip8_data.opcode);
-            chip8_print_state();
-            exit(-1);
+            chip8_op_invalid<Q>(chip, &in);
+            break;
         }
         break;
     case 0x9000:
-        chip8_op_9xy0();
+        chip8_op_9xy0<Q>(chip, &in);
         break;
     case 0xA000:
-        chip8_op_Annn();
+        chip8_op_Annn<Q>(chip, &in);
         break;
     case 0xB000:
-        chip8_op_Bnnn();
+        chip8_op_Bnnn<Q>(chip, &in);
         break;
     case 0xC000:
-        chip8_op_Cxkk();
+        chip8_op_Cxkk<Q>(chip, &in);
         break;
     case 0xD000:
-        chip8_op_Dxyn();
+        chip8_op_Dxyn<Q>(chip, &in);
         break;
     case 0xE000:
-        switch (g_chip8_data.opcode & 0x00FF)
+        switch (chip->opcode & 0x00FF)
         {
         case 0x009E:
-            chip8_op_Ex9E();
+            chip8_op_Ex9E<Q>(chip, &in);
             break;
         case 0x00A1:
-            chip8_op_ExA1();
+            chip8_op_ExA1<Q>(chip, &in);
             break;
         default:
-            fprintf(stderr, "Aborting!\nInvalid opcode: 0x%04X\n", g_chip8_data.opcode);
-            chip8_print_state();
-            exit(-1);
+            chip8_op_invalid<Q>(chip, &in);
+            break;
         }
         break;
     case 0xF000:
-        switch (g_chip8_data.opcode & 0x00FF)
+        switch (chip->opcode & 0x00FF)
         {
         case 0x0007:
-            chip8_op_Fx07();
+            chip8_op_Fx07<Q>(chip, &in);
             break;
         case 0x000A:
-            chip8_op_Fx0A();
+            chip8_op_Fx0A<Q>(chip, &in);
             break;
         case 0x0015:
-            chip8_op_Fx15();
+            chip8_op_Fx15<Q>(chip, &in);
             break;
         case 0x0018:
-            chip8_op_Fx18();
+            chip8_op_Fx18<Q>(chip, &in);
             break;
         case 0x001E:
-            chip8_op_Fx1E();
+            chip8_op_Fx1E<Q>(chip, &in);
             break;
         case 0x0029:
-            chip8_op_Fx29();
+            chip8_op_Fx29<Q>(chip, &in);
+            break;
+        case 0x0030:
+            chip8_op_Fx30<Q>(chip, &in);
             break;
         case 0x0033:
-            chip8_op_Fx33();
+            chip8_op_Fx33<Q>(chip, &in);
             break;
         case 0x0065:
-            chip8_op_Fx65();
+            chip8_op_Fx65<Q>(chip, &in);
             break;
         case 0x0055:
-            chip8_op_Fx55();
+            chip8_op_Fx55<Q>(chip, &in);
+            break;
+        case 0x0075:
+            chip8_op_Fx75<Q>(chip, &in);
+            break;
+        case 0x0085:
+            chip8_op_Fx85<Q>(chip, &in);
             break;
         default:
-            fprintf(stderr, "Aborting!\nInvalid opcode: 0x%04X\n", g_chip8_data.opcode);
-            chip8_print_state();
-            exit(-1);
+            chip8_op_invalid<Q>(chip, &in);
+            break;
         }
         break;
     default:
-        fprintf(stderr, "Aborting!\nInvalid opcode: 0x%04X\n", g_chip8_data.opcode);
-        chip8_print_state();
-        exit(-1);
+        chip8_op_invalid<Q>(chip, &in);
+        break;
     }
 }
\ No newline at end of file
@@ -0,0 +1,570 @@
+#include "chip8.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+// executable memory per machine, flushed and refilled when it runs out
+const size_t JIT_ARENA_SZ = 1 << 20;
+
+// longest run of instructions compiled as one block
+const unsigned int JIT_MAX_BLOCK = 32;
+
+// room left in the arena below which it is flushed before compiling
+const size_t JIT_MAX_BLOCK_CODE = 4096;
+
+typedef void (*chip8_jit_fn)(struct chip8_data *chip);
+
+struct chip8_jit
+{
+    uint8_t *arena;
+    size_t arena_used;
+
+    // compiled block starting at each address, NULL if not compiled
+    chip8_jit_fn blocks[4096];
+
+    // instructions the block starting here retires
+    uint8_t block_cycles[4096];
+};
+
+void chip8_jit_flush(struct chip8_jit *jit)
+{
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    jit->arena_used = 0;
+}
+
+void chip8_jit_free(struct chip8_jit *jit)
+{
+    if (jit->arena != NULL)
+    {
+        munmap(jit->arena, JIT_ARENA_SZ);
+    }
+
+    free(jit);
+}
+
+#if defined(__x86_64__)
+
+static struct chip8_jit *chip8_jit_create()
+{
+    struct chip8_jit *jit = (struct chip8_jit *)calloc(1, sizeof(struct chip8_jit));
+
+    void *arena = mmap(NULL, JIT_ARENA_SZ, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+    {
+        free(jit);
+        return NULL;
+    }
+
+    jit->arena = (uint8_t *)arena;
+    return jit;
+}
+
+// Instructions that touch the timers may only start a block. Timer ticks
+// for the whole block are applied when it returns, which is only exact if
+// nothing after the first instruction can observe them.
+static inline int chip8_jit_uses_timers(uint8_t op)
+{
+    return op == CHIP8_OP_Fx07 || op == CHIP8_OP_Fx15 || op == CHIP8_OP_Fx18;
+}
+
+// Nor may instructions that can fault: the fault leaves the block before
+// the ticks for the instructions ahead of it are applied.
+static inline int chip8_jit_may_fault(uint8_t op)
+{
+    return op == CHIP8_OP_invalid || op == CHIP8_OP_00EE || op == CHIP8_OP_2nnn;
+}
+
+// Runs one instruction the JIT does not translate, with pc already
+// pointing past it as the interpreter would have it.
+template <unsigned int Q>
+static void chip8_jit_helper(struct chip8_data *chip, uint32_t opcode)
+{
+    chip->opcode = opcode;
+    chip8_exec_insn<Q>(chip, &chip8_insn_table[opcode]);
+}
+
+// rbx holds the machine for the whole block, every access is [rbx + disp32]
+#define JIT_REGS(r) ((uint32_t)(offsetof(struct chip8_data, regs) + (r)))
+#define JIT_IDX ((uint32_t)offsetof(struct chip8_data, idx))
+#define JIT_PC ((uint32_t)offsetof(struct chip8_data, pc))
+#define JIT_OPCODE ((uint32_t)offsetof(struct chip8_data, opcode))
+
+// x86 register numbers as they appear in ModRM
+const uint8_t JIT_EAX = 0;
+const uint8_t JIT_ECX = 1;
+const uint8_t JIT_EDX = 2;
+
+struct chip8_jit_emitter
+{
+    uint8_t *p;
+};
+
+static inline void jit_emit8(struct chip8_jit_emitter *e, uint8_t v)
+{
+    *e->p++ = v;
+}
+
+static inline void jit_emit16(struct chip8_jit_emitter *e, uint16_t v)
+{
+    memcpy(e->p, &v, 2);
+    e->p += 2;
+}
+
+static inline void jit_emit32(struct chip8_jit_emitter *e, uint32_t v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static inline void jit_emit64(struct chip8_jit_emitter *e, uint64_t v)
+{
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+// ModRM for [rbx + disp32] with reg in the middle field
+static inline void jit_emit_mem(struct chip8_jit_emitter *e, uint8_t reg, uint32_t disp)
+{
+    jit_emit8(e, 0x80 | (reg << 3) | 3);
+    jit_emit32(e, disp);
+}
+
+// movzx reg32, byte [rbx + disp]
+static void jit_load8(struct chip8_jit_emitter *e, uint8_t reg, uint32_t disp)
+{
+    jit_emit8(e, 0x0F);
+    jit_emit8(e, 0xB6);
+    jit_emit_mem(e, reg, disp);
+}
+
+// mov byte [rbx + disp], reg8
+static void jit_store8(struct chip8_jit_emitter *e, uint32_t disp, uint8_t reg)
+{
+    jit_emit8(e, 0x88);
+    jit_emit_mem(e, reg, disp);
+}
+
+// mov byte [rbx + disp], imm8
+static void jit_store8_imm(struct chip8_jit_emitter *e, uint32_t disp, uint8_t imm)
+{
+    jit_emit8(e, 0xC6);
+    jit_emit_mem(e, 0, disp);
+    jit_emit8(e, imm);
+}
+
+// mov word [rbx + disp], imm16
+static void jit_store16_imm(struct chip8_jit_emitter *e, uint32_t disp, uint16_t imm)
+{
+    jit_emit8(e, 0x66);
+    jit_emit8(e, 0xC7);
+    jit_emit_mem(e, 0, disp);
+    jit_emit16(e, imm);
+}
+
+// mov dword [rbx + disp], imm32
+static void jit_store32_imm(struct chip8_jit_emitter *e, uint32_t disp, uint32_t imm)
+{
+    jit_emit8(e, 0xC7);
+    jit_emit_mem(e, 0, disp);
+    jit_emit32(e, imm);
+}
+
+// pc = condition ? next + 2 : next, where cmov_op picks the condition
+// from flags the caller has just set
+static void jit_skip(struct chip8_jit_emitter *e, uint16_t next, uint8_t cmov_op)
+{
+    // mov eax, next / mov edx, next + 2 (neither touches flags)
+    jit_emit8(e, 0xB8);
+    jit_emit32(e, next);
+    jit_emit8(e, 0xBA);
+    jit_emit32(e, next + 2);
+
+    // cmovcc eax, edx
+    jit_emit8(e, 0x0F);
+    jit_emit8(e, cmov_op);
+    jit_emit8(e, 0xC2);
+
+    // mov word [rbx + pc], ax
+    jit_emit8(e, 0x66);
+    jit_emit8(e, 0x89);
+    jit_emit_mem(e, JIT_EAX, JIT_PC);
+}
+
+const uint8_t JIT_CMOVE = 0x44;
+const uint8_t JIT_CMOVNE = 0x45;
+
+// cmp byte [rbx + regs + x], kk
+static void jit_cmp_reg_imm(struct chip8_jit_emitter *e, uint8_t x, uint8_t kk)
+{
+    jit_emit8(e, 0x80);
+    jit_emit_mem(e, 7, JIT_REGS(x));
+    jit_emit8(e, kk);
+}
+
+// cmp byte [rbx + regs + x], V[y]
+static void jit_cmp_reg_reg(struct chip8_jit_emitter *e, uint8_t x, uint8_t y)
+{
+    jit_load8(e, JIT_ECX, JIT_REGS(y));
+    jit_emit8(e, 0x38);
+    jit_emit_mem(e, JIT_ECX, JIT_REGS(x));
+}
+
+template <unsigned int Q>
+static void jit_call_helper(struct chip8_jit_emitter *e, uint16_t next, uint16_t opcode)
+{
+    jit_store16_imm(e, JIT_PC, next);
+
+    // mov rdi, rbx / mov esi, opcode
+    jit_emit8(e, 0x48);
+    jit_emit8(e, 0x89);
+    jit_emit8(e, 0xDF);
+    jit_emit8(e, 0xBE);
+    jit_emit32(e, opcode);
+
+    // mov rax, helper / call rax
+    jit_emit8(e, 0x48);
+    jit_emit8(e, 0xB8);
+    jit_emit64(e, (uint64_t)(uintptr_t)&chip8_jit_helper<Q>);
+    jit_emit8(e, 0xFF);
+    jit_emit8(e, 0xD0);
+}
+
+// jit_emit_insn() result flags
+const int JIT_ENDS_BLOCK = 1;
+const int JIT_CALLED_HELPER = 2;
+
+// Emits one instruction. Anything that ends the block leaves pc where the
+// interpreter would.
+template <unsigned int Q>
+static int jit_emit_insn(struct chip8_jit_emitter *e, const struct chip8_insn *in, uint16_t addr, uint16_t opcode)
+{
+    uint16_t next = addr + 2;
+
+    switch (in->op)
+    {
+    case CHIP8_OP_1nnn:
+        // the VIP hires boot jump switches display modes, and jumps that
+        // may close an idle loop need the interpreter's check for one
+        if ((addr == 0x200 && in->nnn == 0x260) || in->nnn == addr || in->nnn == addr - 4)
+        {
+            jit_call_helper<Q>(e, next, opcode);
+            return JIT_ENDS_BLOCK | JIT_CALLED_HELPER;
+        }
+        jit_store16_imm(e, JIT_PC, in->nnn);
+        return JIT_ENDS_BLOCK;
+
+    case CHIP8_OP_3xkk:
+        jit_cmp_reg_imm(e, in->x, in->kk);
+        jit_skip(e, next, JIT_CMOVE);
+        return JIT_ENDS_BLOCK;
+
+    case CHIP8_OP_4xkk:
+        jit_cmp_reg_imm(e, in->x, in->kk);
+        jit_skip(e, next, JIT_CMOVNE);
+        return JIT_ENDS_BLOCK;
+
+    case CHIP8_OP_5xy0:
+        jit_cmp_reg_reg(e, in->x, in->y);
+        jit_skip(e, next, JIT_CMOVE);
+        return JIT_ENDS_BLOCK;
+
+    case CHIP8_OP_9xy0:
+        jit_cmp_reg_reg(e, in->x, in->y);
+        jit_skip(e, next, JIT_CMOVNE);
+        return JIT_ENDS_BLOCK;
+
+    case CHIP8_OP_6xkk:
+        jit_store8_imm(e, JIT_REGS(in->x), in->kk);
+        return 0;
+
+    case CHIP8_OP_7xkk:
+        // add byte [rbx + regs + x], kk
+        jit_emit8(e, 0x80);
+        jit_emit_mem(e, 0, JIT_REGS(in->x));
+        jit_emit8(e, in->kk);
+        return 0;
+
+    case CHIP8_OP_8xy0:
+        jit_load8(e, JIT_EAX, JIT_REGS(in->y));
+        jit_store8(e, JIT_REGS(in->x), JIT_EAX);
+        return 0;
+
+    case CHIP8_OP_8xy1:
+    case CHIP8_OP_8xy2:
+    case CHIP8_OP_8xy3:
+    {
+        // or / and / xor byte [rbx + regs + x], al
+        static const uint8_t alu_ops[] = {0x08, 0x20, 0x30};
+        jit_load8(e, JIT_EAX, JIT_REGS(in->y));
+        jit_emit8(e, alu_ops[in->op - CHIP8_OP_8xy1]);
+        jit_emit_mem(e, JIT_EAX, JIT_REGS(in->x));
+        if (Q & CHIP8_QUIRK_VF_RESET)
+        {
+            jit_store8_imm(e, JIT_REGS(0xF), 0);
+        }
+        return 0;
+    }
+
+    case CHIP8_OP_8xy4:
+        // eax = Vx + Vy; VF = eax >> 8; Vx = al (VF first, as the
+        // interpreter does, so x == F keeps the sum)
+        jit_load8(e, JIT_EAX, JIT_REGS(in->x));
+        jit_load8(e, JIT_ECX, JIT_REGS(in->y));
+        jit_emit8(e, 0x01);
+        jit_emit8(e, 0xC8);
+        jit_emit8(e, 0x89);
+        jit_emit8(e, 0xC2);
+        jit_emit8(e, 0xC1);
+        jit_emit8(e, 0xEA);
+        jit_emit8(e, 0x08);
+        jit_store8(e, JIT_REGS(0xF), JIT_EDX);
+        jit_store8(e, JIT_REGS(in->x), JIT_EAX);
+        return 0;
+
+    case CHIP8_OP_8xy5:
+    case CHIP8_OP_8xy7:
+    {
+        // 8xy5: a = Vx, b = Vy; 8xy7: a = Vy, b = Vx
+        // VF = a > b; Vx = a - b
+        uint8_t a = in->op == CHIP8_OP_8xy5 ? in->x : in->y;
+        uint8_t b = in->op == CHIP8_OP_8xy5 ? in->y : in->x;
+        jit_load8(e, JIT_EAX, JIT_REGS(a));
+        jit_load8(e, JIT_ECX, JIT_REGS(b));
+
+        // cmp al, cl / seta dl / sub al, cl
+        jit_emit8(e, 0x38);
+        jit_emit8(e, 0xC8);
+        jit_emit8(e, 0x0F);
+        jit_emit8(e, 0x97);
+        jit_emit8(e, 0xC2);
+        jit_emit8(e, 0x28);
+        jit_emit8(e, 0xC8);
+        jit_store8(e, JIT_REGS(0xF), JIT_EDX);
+        jit_store8(e, JIT_REGS(in->x), JIT_EAX);
+        return 0;
+    }
+
+    case CHIP8_OP_8xy6:
+    case CHIP8_OP_8xyE:
+        if (Q & CHIP8_QUIRK_SHIFT_VY)
+        {
+            // edx = eax = Vy; Vx = eax shifted; VF = shifted-out bit
+            jit_load8(e, JIT_EAX, JIT_REGS(in->y));
+            jit_emit8(e, 0x89);
+            jit_emit8(e, 0xC2);
+
+            // shr eax, 1 / shl eax, 1
+            jit_emit8(e, 0xD1);
+            jit_emit8(e, in->op == CHIP8_OP_8xy6 ? 0xE8 : 0xE0);
+            jit_store8(e, JIT_REGS(in->x), JIT_EAX);
+
+            // and edx, 1 / shr edx, 7
+            jit_emit8(e, in->op == CHIP8_OP_8xy6 ? 0x83 : 0xC1);
+            jit_emit8(e, in->op == CHIP8_OP_8xy6 ? 0xE2 : 0xEA);
+            jit_emit8(e, in->op == CHIP8_OP_8xy6 ? 0x01 : 0x07);
+            jit_store8(e, JIT_REGS(0xF), JIT_EDX);
+            return 0;
+        }
+
+        // VF = shifted-out bit, then Vx is shifted after reloading it,
+        // since x == F must shift the new VF like the interpreter does
+        jit_load8(e, JIT_EAX, JIT_REGS(in->x));
+        jit_emit8(e, 0x89);
+        jit_emit8(e, 0xC2);
+        if (in->op == CHIP8_OP_8xy6)
+        {
+            // and edx, 1
+            jit_emit8(e, 0x83);
+            jit_emit8(e, 0xE2);
+            jit_emit8(e, 0x01);
+        }
+        else
+        {
+            // shr edx, 7
+            jit_emit8(e, 0xC1);
+            jit_emit8(e, 0xEA);
+            jit_emit8(e, 0x07);
+        }
+        jit_store8(e, JIT_REGS(0xF), JIT_EDX);
+        jit_load8(e, JIT_EAX, JIT_REGS(in->x));
+
+        // shr eax, 1 / shl eax, 1
+        jit_emit8(e, 0xD1);
+        jit_emit8(e, in->op == CHIP8_OP_8xy6 ? 0xE8 : 0xE0);
+        jit_store8(e, JIT_REGS(in->x), JIT_EAX);
+        return 0;
+
+    case CHIP8_OP_Annn:
+        jit_store16_imm(e, JIT_IDX, in->nnn);
+        return 0;
+
+    case CHIP8_OP_Fx1E:
+        // add word [rbx + idx], ax
+        jit_load8(e, JIT_EAX, JIT_REGS(in->x));
+        jit_emit8(e, 0x66);
+        jit_emit8(e, 0x01);
+        jit_emit_mem(e, JIT_EAX, JIT_IDX);
+        return 0;
+
+    // may branch or fault
+    case CHIP8_OP_invalid:
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_2nnn:
+    case CHIP8_OP_Bnnn:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+    case CHIP8_OP_Fx0A:
+    case CHIP8_OP_00FD:
+    // may rewrite the rest of the block
+    case CHIP8_OP_Fx33:
+    case CHIP8_OP_Fx55:
+        jit_call_helper<Q>(e, next, opcode);
+        return JIT_ENDS_BLOCK | JIT_CALLED_HELPER;
+
+    default:
+        jit_call_helper<Q>(e, next, opcode);
+        return JIT_CALLED_HELPER;
+    }
+}
+
+template <unsigned int Q>
+static chip8_jit_fn chip8_jit_compile(struct chip8_data *chip, uint16_t start)
+{
+    struct chip8_jit *jit = chip->jit;
+
+    if (JIT_ARENA_SZ - jit->arena_used < JIT_MAX_BLOCK_CODE)
+    {
+        chip8_jit_flush(jit);
+    }
+
+    struct chip8_jit_emitter e;
+    uint8_t *code = jit->arena + jit->arena_used;
+    e.p = code;
+
+    // push rbx / mov rbx, rdi
+    jit_emit8(&e, 0x53);
+    jit_emit8(&e, 0x48);
+    jit_emit8(&e, 0x89);
+    jit_emit8(&e, 0xFB);
+
+    uint16_t addr = start;
+    uint16_t opcode = 0;
+    unsigned int cycles = 0;
+    int flags = 0;
+
+    while (!(flags & JIT_ENDS_BLOCK) && cycles < JIT_MAX_BLOCK && addr + 2 <= 0x1000)
+    {
+        uint16_t next_opcode = (chip->mem[addr] << 8) | chip->mem[addr + 1];
+        const struct chip8_insn *in = &chip8_insn_table[next_opcode];
+
+        if (cycles > 0 && (chip8_jit_uses_timers(in->op) || chip8_jit_may_fault(in->op)))
+        {
+            break;
+        }
+
+        opcode = next_opcode;
+
+        flags = jit_emit_insn<Q>(&e, in, addr, opcode);
+
+        chip->bcache.code[addr >> 3] |= 1 << (addr & 7);
+        chip->bcache.code[(addr + 1) >> 3] |= 1 << ((addr + 1) & 7);
+
+        addr += 2;
+        cycles++;
+    }
+
+    // fell off the end of the block rather than branching
+    if (!(flags & JIT_ENDS_BLOCK))
+    {
+        jit_store16_imm(&e, JIT_PC, addr);
+    }
+
+    // helpers record their own opcode
+    if (!(flags & JIT_CALLED_HELPER))
+    {
+        jit_store32_imm(&e, JIT_OPCODE, opcode);
+    }
+
+    // pop rbx / ret
+    jit_emit8(&e, 0x5B);
+    jit_emit8(&e, 0xC3);
+
+    jit->arena_used += e.p - code;
+    jit->block_cycles[start] = cycles;
+    jit->blocks[start] = (chip8_jit_fn)(void *)code;
+
+    return jit->blocks[start];
+}
+
+template <unsigned int Q>
+static inline void chip8_jit_step(struct chip8_data *chip)
+{
+    const struct chip8_insn *in = chip8_fetch_insn(chip);
+    chip8_exec_insn<Q>(chip, in);
+    chip8_tick_timers(chip);
+}
+
+template <unsigned int Q>
+void chip8_run_jit(struct chip8_data *chip, unsigned long long cycles)
+{
+    if (chip->jit == NULL)
+    {
+        chip->jit = chip8_jit_create();
+        if (chip->jit == NULL)
+        {
+            // no executable memory here, the block cache is next best
+            chip->engine = CHIP8_ENGINE_BLOCK;
+            chip8_run_block<Q>(chip, cycles);
+            return;
+        }
+    }
+
+    struct chip8_jit *jit = chip->jit;
+
+    while (cycles > 0)
+    {
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+            continue;
+        }
+
+        uint16_t start = chip->pc;
+
+        if (start > 0xFFE)
+        {
+            chip8_jit_step<Q>(chip);
+            cycles--;
+            continue;
+        }
+
+        chip8_jit_fn block = jit->blocks[start];
+        if (block == NULL)
+        {
+            block = chip8_jit_compile<Q>(chip, start);
+        }
+
+        unsigned int block_cycles = jit->block_cycles[start];
+        if (block_cycles > cycles)
+        {
+            chip8_jit_step<Q>(chip);
+            cycles--;
+            continue;
+        }
+
+        block(chip);
+        chip8_timers_advance(chip, block_cycles);
+        cycles -= block_cycles;
+    }
+}
+
+#else
+
+template <unsigned int Q>
+void chip8_run_jit(struct chip8_data *chip, unsigned long long cycles)
+{
+    // no code generator for this host
+    chip->engine = CHIP8_ENGINE_BLOCK;
+    chip8_run_block<Q>(chip, cycles);
+}
+
+#endif
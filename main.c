@@ -0,0 +1,365 @@
+#include "platform.h"
+#include <getopt.h>
+
+// Interactive frontend, presents one emulated frame per 60 Hz host frame
+
+int main(int argc, char **argv)
+{
+    const char *record_filename = NULL;
+    uint64_t seed = time(NULL);
+    unsigned int audio_buffer = CHIP8_AUDIO_DEFAULT_BUFFER;
+    const char *keymap_filename = NULL;
+    const char *capture_filename = NULL;
+    const char *trace_filename = NULL;
+    const char *gdb_address = NULL;
+    int quirks = -1;
+    int scale_filter = CHIP8_SCALE_NEAREST;
+    int scanlines = 0;
+    int gpu_scaling = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "R:x:a:c:t:d:k:q:f:lg")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            audio_buffer = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            capture_filename = optarg;
+            break;
+        case 'd':
+            gdb_address = optarg;
+            break;
+        case 'f':
+            scale_filter = chip8_parse_scale_filter(optarg);
+            if (scale_filter < 0)
+            {
+                fprintf(stderr, "Unknown scale filter '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            gpu_scaling = 1;
+            break;
+        case 'k':
+            keymap_filename = optarg;
+            break;
+        case 'l':
+            scanlines = 1;
+            break;
+        case 'q':
+            quirks = chip8_parse_quirks(optarg);
+            if (quirks < 0)
+            {
+                fprintf(stderr, "Unknown quirks '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'R':
+            record_filename = optarg;
+            break;
+        case 't':
+            trace_filename = optarg;
+            break;
+        case 'x':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    if (argc - optind != 3 && argc - optind != 4)
+    {
+        fprintf(stderr, "Usage: chip8-emu [-a samples] [-c capture] [-d gdb_address] [-f filter] [-l] [-g] [-k keymap] [-q quirks] [-R input_log] [-t trace] [-x seed] <video_scale> <ips> <rom_file_bin> [state_file]\n");
+        fprintf(stderr, "  F5 saves to state_file (default <rom_file_bin>.state), F9 loads it\n");
+        fprintf(stderr, "  hold Backspace to rewind up to %u seconds\n", CHIP8_REWIND_DEFAULT_SECONDS);
+        fprintf(stderr, "  -a audio device buffer in samples (default %u), smaller is lower latency\n", CHIP8_AUDIO_DEFAULT_BUFFER);
+        fprintf(stderr, "  -c records what's on screen to a .y4m, .gif or raw RGBA file\n");
+        fprintf(stderr, "  -d waits for GDB on a 127.0.0.1 port or unix socket, the ROM starts stopped\n");
+        fprintf(stderr, "  -f nearest, scale2x or scale3x, how the CPU scales the display to the window (default nearest)\n");
+        fprintf(stderr, "  -l darkens the last line of every display row, like a CRT's scanlines\n");
+        fprintf(stderr, "  -g leaves scaling to the renderer instead, for setups with a GPU\n");
+        fprintf(stderr, "  -k keymap file of '<chip-8 key> <SDL key name>' lines, e.g. 'A Z'\n");
+        fprintf(stderr, "  -q modern, vip, chip48 or schip (default: from the ROM database, else modern)\n");
+        fprintf(stderr, "  -R records key presses for chip8-emu-headless --replay\n");
+        fprintf(stderr, "  -t keeps the last %u instructions for chip8-tracedump, saved on F8 or a fault\n", CHIP8_TRACE_DEFAULT_ENTRIES);
+        return 1;
+    }
+
+    int video_scale = atoi(argv[optind]);
+    unsigned long long ips = strtoull(argv[optind + 1], NULL, 10);
+    const char *rom_filename = argv[optind + 2];
+    int boot_from_state = argc - optind == 4;
+
+    // a state file given on the command line is booted from
+    char state_filename[4096];
+    snprintf(state_filename, sizeof(state_filename), "%s.state", rom_filename);
+    if (boot_from_state)
+    {
+        snprintf(state_filename, sizeof(state_filename), "%s", argv[optind + 3]);
+    }
+
+    if (ips == 0)
+    {
+        fprintf(stderr, "Invalid instructions per second '%s'\n", argv[optind + 1]);
+        return 1;
+    }
+
+    if (keymap_filename != NULL && platform_load_keymap(keymap_filename) < 0)
+    {
+        return 1;
+    }
+
+    struct chip8_data *chip = chip8_create();
+    if (chip8_load_rom(chip, rom_filename) != CHIP8_OK)
+    {
+        return 1;
+    }
+    chip->ips = ips;
+    chip8_seed(chip, seed);
+
+    if (boot_from_state && chip8_state_load(chip, state_filename) < 0)
+    {
+        return 1;
+    }
+
+    // after the state, which brings the profile it was saved with
+    if (quirks >= 0)
+    {
+        chip8_set_quirks(chip, quirks);
+    }
+
+    // the CPU scales to the largest factor that fits the window, leaving
+    // the renderer a plain copy
+    int window_width = VIDEO_WIDTH * video_scale;
+    int window_height = VIDEO_HEIGHT * video_scale;
+    int scale_factor = 1;
+    struct chip8_scaler scaler;
+    if (!gpu_scaling)
+    {
+        scale_factor = chip8_scale_fit(scale_filter, VIDEO_WIDTH, VIDEO_HEIGHT, window_width, window_height);
+        if (chip8_scaler_init(&scaler, scale_filter, scale_factor, scanlines) < 0)
+        {
+            return 1;
+        }
+    }
+
+    platform_init("CHIP-8 Emulator", window_width, window_height, VIDEO_WIDTH * scale_factor, VIDEO_HEIGHT * scale_factor);
+
+    // the emulator runs silently if there is no sound device
+    static struct chip8_audio audio;
+    int audio_open = platform_audio_open(&audio, CHIP8_AUDIO_RATE, audio_buffer) == 0;
+
+    struct chip8_inputlog record;
+    memset(&record, 0, sizeof(record));
+    if (record_filename != NULL && chip8_inputlog_create(&record, record_filename, chip) < 0)
+    {
+        return 1;
+    }
+
+    // captured at about the window's size, through the same filter
+    static struct chip8_capture capture;
+    if (capture_filename != NULL && chip8_capture_open(&capture, capture_filename, scale_filter, (video_scale + 1) / 2, scanlines) < 0)
+    {
+        return 1;
+    }
+
+    struct chip8_trace trace;
+    if (trace_filename != NULL)
+    {
+        if (chip8_trace_init(&trace, CHIP8_TRACE_DEFAULT_ENTRIES, trace_filename) < 0)
+        {
+            return 1;
+        }
+        chip->trace = &trace;
+    }
+
+    static struct chip8_gdb gdb;
+    if (gdb_address != NULL)
+    {
+        if (chip8_gdb_open(&gdb, gdb_address) < 0)
+        {
+            return 1;
+        }
+
+        fprintf(stderr, "Waiting for GDB on %s\n", gdb_address);
+        if (chip8_gdb_accept(&gdb) < 0)
+        {
+            chip8_gdb_close(&gdb);
+            return 1;
+        }
+        chip->debug = &gdb.debug;
+    }
+
+    static uint32_t video_pixels[VIDEO_MAX_WIDTH * VIDEO_MAX_HEIGHT];
+    int video_width = VIDEO_WIDTH;
+    int video_height = VIDEO_HEIGHT;
+    struct chip8_sched sched;
+    unsigned long long uploaded_frames = 0;
+    unsigned long long skipped_frames = 0;
+    struct chip8_rewind rw;
+    int requests = 0;
+    int status = CHIP8_OK;
+
+    if (chip8_rewind_init(&rw, CHIP8_REWIND_DEFAULT_SECONDS, CHIP8_REWIND_DEFAULT_BUDGET) < 0)
+    {
+        return 1;
+    }
+
+    chip8_sched_init(&sched, 60);
+
+    // requests and keys come from waiting out the previous frame
+    while (!(requests & PLATFORM_QUIT))
+    {
+        if (requests & PLATFORM_SAVE_STATE)
+        {
+            chip8_state_save(chip, state_filename);
+        }
+
+        if ((requests & PLATFORM_SAVE_TRACE) && trace_filename != NULL)
+        {
+            chip8_trace_save(&trace, chip, trace_filename);
+        }
+
+        // a recording can't be replayed past a jump in machine state
+        if (requests & (PLATFORM_LOAD_STATE | PLATFORM_REWIND))
+        {
+            chip8_inputlog_close(&record, chip->frames);
+        }
+
+        if (requests & PLATFORM_LOAD_STATE)
+        {
+            chip8_state_load(chip, state_filename);
+        }
+
+        // while rewinding, each frame steps back one instead of running one
+        if (requests & PLATFORM_REWIND)
+        {
+            chip8_rewind_pop(&rw, chip);
+        }
+        else if (gdb_address != NULL)
+        {
+            // GDB decides when the machine runs, and a fault stops it for
+            // GDB to look at instead of ending the session. Once GDB goes
+            // away the machine runs on its own.
+            if (chip8_gdb_poll(&gdb, chip, 0) < 0)
+            {
+                chip->debug = NULL;
+                chip8_gdb_close(&gdb);
+                gdb_address = NULL;
+            }
+            else
+            {
+                chip8_gdb_run(&gdb, chip, chip8_cycles_to_frame(chip));
+            }
+        }
+        else
+        {
+            chip8_inputlog_record(&record, chip);
+
+            // one 60 Hz timer frame's worth of instructions per host frame
+            status = chip8_run_frame(chip);
+            if (status != CHIP8_OK)
+            {
+                fprintf(stderr, "Aborting!\n%s\n", chip8_status_name(status));
+                chip8_print_state(chip);
+                break;
+            }
+            chip8_rewind_push(&rw, chip);
+        }
+
+        if (audio_open)
+        {
+            chip8_audio_push(&audio, chip);
+        }
+
+        if (capture_filename != NULL)
+        {
+            chip8_capture_push(&capture, chip);
+        }
+
+        // the display only changes on 00E0 and Dxyn, so most frames have
+        // nothing new to upload
+        if (chip->vid_dirty)
+        {
+            chip->vid_dirty = 0;
+
+            // 00FE/00FF and the VIP hires boot change the texture size
+            if (chip->vid_width != video_width || chip->vid_height != video_height)
+            {
+                video_width = chip->vid_width;
+                video_height = chip->vid_height;
+                if (!gpu_scaling)
+                {
+                    scale_factor = chip8_scale_fit(scale_filter, video_width, video_height, window_width, window_height);
+                    chip8_scaler_init(&scaler, scale_filter, scale_factor, scanlines);
+                }
+                platform_resize(video_width * scale_factor, video_height * scale_factor);
+            }
+
+            if (gpu_scaling)
+            {
+                chip8_expand_framebuffer(chip, video_pixels);
+                platform_update(video_pixels, sizeof(video_pixels[0]) * video_width);
+            }
+            else
+            {
+                void *pixels;
+                int pitch;
+                platform_lock(&pixels, &pitch);
+                chip8_scale(&scaler, chip, pixels, pitch);
+                platform_unlock();
+            }
+            uploaded_frames++;
+        }
+        else
+        {
+            skipped_frames++;
+        }
+
+        // input is handled as it arrives while waiting for the frame's
+        // deadline, the sleep only covers what's left under a millisecond
+        requests = process_input(chip->keys, chip8_sched_deadline(&sched));
+        chip8_sched_wait(&sched);
+    }
+
+    chip8_sched_report(&sched, stderr);
+    fprintf(stderr, "uploaded_frames=%llu skipped_frames=%llu\n", uploaded_frames, skipped_frames);
+    chip8_rewind_report(&rw, stderr);
+    chip8_rewind_free(&rw);
+    chip8_inputlog_close(&record, chip->frames);
+
+    if (capture_filename != NULL)
+    {
+        chip8_capture_close(&capture);
+        chip8_capture_report(&capture, stderr);
+    }
+
+    if (trace_filename != NULL)
+    {
+        chip->trace = NULL;
+        chip8_trace_free(&trace);
+    }
+
+    if (gdb_address != NULL)
+    {
+        chip->debug = NULL;
+        chip8_gdb_close(&gdb);
+    }
+
+    if (audio_open)
+    {
+        platform_audio_close();
+        chip8_audio_report(&audio, stderr);
+    }
+
+#ifdef CHIP8_PROFILE
+    chip8_profile_dump(chip, "text", stderr);
+#endif
+
+    chip8_destroy(chip);
+    return status != CHIP8_OK;
+}
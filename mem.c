@@ -1,14 +1,12 @@
 #include "chip8.h"
 
-const unsigned int ROM_OFFSET = 0x200u;
-const unsigned int MAX_ROM_SZ = 0xD00u;
-void chip8_load_rom(const char *filename)
+int chip8_load_rom(struct chip8_data *chip, const char *filename)
 {
     FILE *rom_file = fopen(filename, "rb");
     if (rom_file == NULL)
     {
         fprintf(stderr, "Could not open ROM file '%s'\n", filename);
-        exit(1);
+        return CHIP8_IO_ERROR;
     }
 
     fseek(rom_file, 0L, SEEK_END);
@@ -18,12 +16,40 @@ void chip8_load_rom(const char *filename)
     if (rom_sz > MAX_ROM_SZ)
     {
         fprintf(stderr, "ROM '%s' of size 0x%lx bytes exceeds max size of 0x%x\n", filename, rom_sz, MAX_ROM_SZ);
-        exit(1);
+        fclose(rom_file);
+        return CHIP8_ROM_TOO_LARGE;
     }
 
-    fread(g_chip8_data.mem + ROM_OFFSET, rom_sz, 1, rom_file);
-
+    uint8_t rom[MAX_ROM_SZ];
+    size_t read_sz = fread(rom, 1, rom_sz, rom_file);
     fclose(rom_file);
+
+    if (read_sz != rom_sz)
+    {
+        fprintf(stderr, "Could not read ROM file '%s'\n", filename);
+        return CHIP8_IO_ERROR;
+    }
+
+    return chip8_load_rom_buffer(chip, rom, rom_sz);
+}
+
+// Copies the ROM to ROM_OFFSET and clears the memory after it
+int chip8_load_rom_buffer(struct chip8_data *chip, const uint8_t *rom, size_t len)
+{
+    if (len > MAX_ROM_SZ)
+    {
+        return CHIP8_ROM_TOO_LARGE;
+    }
+
+    memcpy(chip->mem + ROM_OFFSET, rom, len);
+    memset(chip->mem + ROM_OFFSET + len, 0, MAX_ROM_SZ - len);
+
+    // known ROMs run under the interpreter they were written for
+    int quirks = chip8_romdb_lookup(rom, len);
+    chip8_set_quirks(chip, quirks >= 0 ? quirks : CHIP8_QUIRKS_MODERN);
+    chip->aot = chip8_aot_lookup(rom, len);
+
+    return CHIP8_OK;
 }
 
 uint8_t fontset[FONTSET_SZ] =
@@ -46,7 +72,29 @@ uint8_t fontset[FONTSET_SZ] =
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-void chip8_load_fonts()
+// SUPER-CHIP 8x10 digits for Fx30, with the XO-CHIP letters after them
+uint8_t big_fontset[BIG_FONTSET_SZ] =
+    {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+void chip8_load_fonts(struct chip8_data *chip)
 {
-    memcpy(g_chip8_data.mem + FONT_OFFSET, fontset, FONTSET_SZ);
+    memcpy(chip->mem + FONT_OFFSET, fontset, FONTSET_SZ);
+    memcpy(chip->mem + BIG_FONT_OFFSET, big_fontset, BIG_FONTSET_SZ);
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include "chip8.h"
+#include <SDL2/SDL.h>
+
+// SDL functions, see video.c
+void platform_init(const char *title, int window_width, int window_height, int texture_width, int texture_height);
+// process_input() requests
+const int PLATFORM_QUIT = 1;
+const int PLATFORM_SAVE_STATE = 2;
+const int PLATFORM_LOAD_STATE = 4;
+const int PLATFORM_REWIND = 8;
+const int PLATFORM_SAVE_TRACE = 16;
+
+void platform_resize(int texture_width, int texture_height);
+int platform_load_keymap(const char *filename);
+int platform_audio_open(struct chip8_audio *audio, unsigned int sample_rate, unsigned int buffer_samples);
+void platform_audio_close();
+void platform_present();
+void platform_update(void *buffer, int pitch);
+void platform_lock(void **pixels, int *pitch);
+void platform_unlock();
+int process_input(uint8_t *keys, long long deadline);
+
+#endif
@@ -0,0 +1,332 @@
+#include "chip8.h"
+
+// Only built with -DCHIP8_PROFILE. Every instruction the switch interpreter
+// runs is timed and attributed to its opcode class, its address and the
+// chain of 2nnn calls that led to it.
+
+static const char *const chip8_op_names[CHIP8_OP_COUNT] = {
+#define X(name) #name,
+    CHIP8_OPCODES(X)
+#undef X
+};
+
+// distinct call stacks kept for folded output, the rest land in one bucket
+const unsigned int PROFILE_MAX_STACKS = 4096;
+
+struct chip8_profile_stack
+{
+    uint64_t hash;
+    uint64_t count;
+    uint8_t depth;
+    uint16_t frames[16];
+};
+
+struct chip8_profile
+{
+    uint64_t op_count[CHIP8_OP_COUNT];
+    uint64_t op_ns[CHIP8_OP_COUNT];
+
+    uint64_t pc_hits[4096];
+    uint64_t mem_reads[4096];
+    uint64_t mem_writes[4096];
+
+    // subroutine entry points, tracking 2nnn and 00EE
+    uint16_t call_stack[16];
+    uint8_t call_depth;
+    uint64_t call_hash;
+
+    struct chip8_profile_stack stacks[PROFILE_MAX_STACKS];
+    uint64_t dropped_stack_samples;
+
+    // cost of the two clock reads around an instruction, taken off each
+    // sample
+    long long clock_overhead_ns;
+};
+
+static uint64_t chip8_profile_hash_stack(const uint16_t *frames, uint8_t depth)
+{
+    uint64_t hash = chip8_hash(frames, depth * sizeof(frames[0]));
+    return hash ^ depth;
+}
+
+void chip8_profile_init(struct chip8_data *chip)
+{
+    if (chip->profile == NULL)
+    {
+        chip->profile = (struct chip8_profile *)calloc(1, sizeof(struct chip8_profile));
+        chip->profile->call_hash = chip8_profile_hash_stack(chip->profile->call_stack, 0);
+
+        long long overhead = -1;
+        for (int i = 0; i < 1000; i++)
+        {
+            long long start_time = time_nanos();
+            long long elapsed = time_nanos() - start_time;
+            if (overhead < 0 || elapsed < overhead)
+            {
+                overhead = elapsed;
+            }
+        }
+        chip->profile->clock_overhead_ns = overhead;
+    }
+}
+
+void chip8_profile_free(struct chip8_data *chip)
+{
+    free(chip->profile);
+    chip->profile = NULL;
+}
+
+static void chip8_profile_mem(uint64_t *heatmap, uint16_t addr, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; i++)
+    {
+        heatmap[(addr + i) & 0xFFF]++;
+    }
+}
+
+void chip8_profile_read(struct chip8_data *chip, uint16_t addr, unsigned int len)
+{
+    chip8_profile_mem(chip->profile->mem_reads, addr, len);
+}
+
+void chip8_profile_write(struct chip8_data *chip, uint16_t addr, unsigned int len)
+{
+    chip8_profile_mem(chip->profile->mem_writes, addr, len);
+}
+
+static void chip8_profile_sample_stack(struct chip8_profile *prof)
+{
+    unsigned int slot = prof->call_hash % PROFILE_MAX_STACKS;
+
+    for (unsigned int probe = 0; probe < PROFILE_MAX_STACKS; probe++)
+    {
+        struct chip8_profile_stack *stack = &prof->stacks[slot];
+
+        if (stack->count == 0)
+        {
+            stack->hash = prof->call_hash;
+            stack->depth = prof->call_depth;
+            memcpy(stack->frames, prof->call_stack, sizeof(stack->frames));
+            stack->count = 1;
+            return;
+        }
+
+        if (stack->hash == prof->call_hash && stack->depth == prof->call_depth &&
+            memcmp(stack->frames, prof->call_stack, prof->call_depth * sizeof(stack->frames[0])) == 0)
+        {
+            stack->count++;
+            return;
+        }
+
+        slot = (slot + 1) % PROFILE_MAX_STACKS;
+    }
+
+    prof->dropped_stack_samples++;
+}
+
+// Called after each instruction with the address it was fetched from
+void chip8_profile_insn(struct chip8_data *chip, uint16_t pc, long long ns)
+{
+    struct chip8_profile *prof = chip->profile;
+    struct chip8_insn in;
+
+    chip8_decode(chip->opcode, &in);
+    prof->op_count[in.op]++;
+    prof->op_ns[in.op] += ns > prof->clock_overhead_ns ? ns - prof->clock_overhead_ns : 0;
+    prof->pc_hits[pc & 0xFFF]++;
+
+    chip8_profile_sample_stack(prof);
+
+    // the instruction already ran, so the call it made is the next sample's
+    if (in.op == CHIP8_OP_2nnn && prof->call_depth < 16)
+    {
+        prof->call_stack[prof->call_depth++] = in.nnn;
+        prof->call_hash = chip8_profile_hash_stack(prof->call_stack, prof->call_depth);
+    }
+    else if (in.op == CHIP8_OP_00EE && prof->call_depth > 0)
+    {
+        prof->call_depth--;
+        prof->call_hash = chip8_profile_hash_stack(prof->call_stack, prof->call_depth);
+    }
+}
+
+// qsort has no context argument, the key array rides in a static
+static const uint64_t *chip8_profile_sort_keys;
+
+static int chip8_profile_cmp(const void *a, const void *b)
+{
+    uint64_t ka = chip8_profile_sort_keys[*(const int *)a];
+    uint64_t kb = chip8_profile_sort_keys[*(const int *)b];
+    return ka < kb ? 1 : ka > kb ? -1 : *(const int *)a - *(const int *)b;
+}
+
+// Indices of keys[0..n) sorted by descending value
+static int *chip8_profile_rank(const uint64_t *keys, int n)
+{
+    int *order = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+
+    chip8_profile_sort_keys = keys;
+    qsort(order, n, sizeof(int), chip8_profile_cmp);
+    return order;
+}
+
+// rows shown per table in text output
+const int PROFILE_TEXT_TOP = 16;
+
+static void chip8_profile_text_heatmap(const char *title, const uint64_t *counts, FILE *out)
+{
+    int *order = chip8_profile_rank(counts, 4096);
+    uint64_t total = 0;
+    for (int i = 0; i < 4096; i++)
+    {
+        total += counts[i];
+    }
+
+    fprintf(out, "\n%s (%llu total)\n", title, (unsigned long long)total);
+    for (int i = 0; i < PROFILE_TEXT_TOP && counts[order[i]] > 0; i++)
+    {
+        fprintf(out, "  0x%03x %12llu %6.2f%%\n", order[i], (unsigned long long)counts[order[i]], 100.0 * counts[order[i]] / total);
+    }
+
+    free(order);
+}
+
+static void chip8_profile_dump_text(const struct chip8_profile *prof, FILE *out)
+{
+    uint64_t total_count = 0;
+    uint64_t total_ns = 0;
+    for (int op = 0; op < CHIP8_OP_COUNT; op++)
+    {
+        total_count += prof->op_count[op];
+        total_ns += prof->op_ns[op];
+    }
+
+    int *order = chip8_profile_rank(prof->op_ns, CHIP8_OP_COUNT);
+    fprintf(out, "%-10s %12s %7s %14s %7s %8s\n", "op", "count", "count%", "ns", "ns%", "ns/insn");
+    for (int i = 0; i < CHIP8_OP_COUNT && prof->op_count[order[i]] > 0; i++)
+    {
+        int op = order[i];
+        fprintf(out, "%-10s %12llu %6.2f%% %14llu %6.2f%% %8.1f\n", chip8_op_names[op],
+                (unsigned long long)prof->op_count[op], 100.0 * prof->op_count[op] / total_count,
+                (unsigned long long)prof->op_ns[op], total_ns ? 100.0 * prof->op_ns[op] / total_ns : 0.0,
+                (double)prof->op_ns[op] / prof->op_count[op]);
+    }
+    free(order);
+
+    chip8_profile_text_heatmap("hottest pc", prof->pc_hits, out);
+    chip8_profile_text_heatmap("most read", prof->mem_reads, out);
+    chip8_profile_text_heatmap("most written", prof->mem_writes, out);
+}
+
+static void chip8_profile_json_heatmap(const char *name, const uint64_t *counts, FILE *out)
+{
+    const char *sep = "";
+
+    fprintf(out, "  \"%s\": {", name);
+    for (int addr = 0; addr < 4096; addr++)
+    {
+        if (counts[addr] > 0)
+        {
+            fprintf(out, "%s\"0x%03x\": %llu", sep, addr, (unsigned long long)counts[addr]);
+            sep = ", ";
+        }
+    }
+    fprintf(out, "}");
+}
+
+static void chip8_profile_folded_stack(const struct chip8_profile_stack *stack, FILE *out)
+{
+    fprintf(out, "main");
+    for (int i = 0; i < stack->depth; i++)
+    {
+        fprintf(out, ";sub_%03x", stack->frames[i]);
+    }
+}
+
+static void chip8_profile_dump_json(const struct chip8_profile *prof, FILE *out)
+{
+    const char *sep = "";
+
+    fprintf(out, "{\n  \"ops\": [");
+    for (int op = 0; op < CHIP8_OP_COUNT; op++)
+    {
+        if (prof->op_count[op] > 0)
+        {
+            fprintf(out, "%s\n    {\"op\": \"%s\", \"count\": %llu, \"ns\": %llu}", sep, chip8_op_names[op],
+                    (unsigned long long)prof->op_count[op], (unsigned long long)prof->op_ns[op]);
+            sep = ",";
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    chip8_profile_json_heatmap("pc_hits", prof->pc_hits, out);
+    fprintf(out, ",\n");
+    chip8_profile_json_heatmap("mem_reads", prof->mem_reads, out);
+    fprintf(out, ",\n");
+    chip8_profile_json_heatmap("mem_writes", prof->mem_writes, out);
+
+    sep = "";
+    fprintf(out, ",\n  \"stacks\": [");
+    for (unsigned int i = 0; i < PROFILE_MAX_STACKS; i++)
+    {
+        if (prof->stacks[i].count > 0)
+        {
+            fprintf(out, "%s\n    {\"stack\": \"", sep);
+            chip8_profile_folded_stack(&prof->stacks[i], out);
+            fprintf(out, "\", \"count\": %llu}", (unsigned long long)prof->stacks[i].count);
+            sep = ",";
+        }
+    }
+    fprintf(out, "\n  ],\n  \"dropped_stack_samples\": %llu\n}\n", (unsigned long long)prof->dropped_stack_samples);
+}
+
+// one line per call stack weighted by instructions executed, the input
+// flamegraph.pl and speedscope expect
+static void chip8_profile_dump_folded(const struct chip8_profile *prof, FILE *out)
+{
+    for (unsigned int i = 0; i < PROFILE_MAX_STACKS; i++)
+    {
+        if (prof->stacks[i].count > 0)
+        {
+            chip8_profile_folded_stack(&prof->stacks[i], out);
+            fprintf(out, " %llu\n", (unsigned long long)prof->stacks[i].count);
+        }
+    }
+
+    if (prof->dropped_stack_samples > 0)
+    {
+        fprintf(out, "[dropped] %llu\n", (unsigned long long)prof->dropped_stack_samples);
+    }
+}
+
+int chip8_profile_dump(const struct chip8_data *chip, const char *format, FILE *out)
+{
+    if (chip->profile == NULL)
+    {
+        return 0;
+    }
+
+    if (strcmp(format, "text") == 0)
+    {
+        chip8_profile_dump_text(chip->profile, out);
+    }
+    else if (strcmp(format, "json") == 0)
+    {
+        chip8_profile_dump_json(chip->profile, out);
+    }
+    else if (strcmp(format, "folded") == 0)
+    {
+        chip8_profile_dump_folded(chip->profile, out);
+    }
+    else
+    {
+        fprintf(stderr, "Unknown profile format '%s', expected text, json or folded\n", format);
+        return -1;
+    }
+
+    return 0;
+}
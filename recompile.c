@@ -0,0 +1,752 @@
+#include "chip8.h"
+#include <getopt.h>
+
+// Static recompiler: walks a ROM's control flow from ROM_OFFSET with the
+// interpreter's own decoder and writes the code it reaches out as a C++
+// translation unit. Linked into a program with libchip8, it runs that ROM
+// under -e aot; see aot.c for the runtime side.
+//
+// Each basic block becomes a label in one function, jumps, calls and skips
+// become gotos between them and the common instructions are written out
+// inline. The rest call back into the interpreter's handlers, as does
+// everything the walk can't follow statically.
+
+static void recompile_usage()
+{
+    fprintf(stderr, "Usage: chip8-recompile [-q quirks] [-n name] <rom_file_bin> <output_cpp>\n");
+    fprintf(stderr, "  -q modern, vip, chip48 or schip (default: from the ROM database, else modern)\n");
+    fprintf(stderr, "  -n name the program reports itself as (default: the ROM's file name)\n");
+}
+
+struct recompile
+{
+    // fonts and ROM as chip8_create() and chip8_load_rom_buffer() leave them
+    struct chip8_data *chip;
+    unsigned int rom_end;
+
+    int quirks;
+    unsigned int quirk_bits;
+
+    // instructions the walk reached, the ones blocks start at, and return
+    // addresses of calls it found to come back
+    uint8_t reached[4096];
+    uint8_t leader[4096];
+    uint8_t returns[4096];
+
+    // chip8_aot_program entries and code bitmaps
+    uint8_t entries[4096 / 8];
+    uint8_t code[4096 / 8];
+
+    unsigned int num_blocks;
+    unsigned int num_insns;
+    unsigned int num_computed;
+
+    // whether any reached 00EE or Bnnn goes back through the entry switch
+    int redispatch;
+};
+
+static inline uint16_t recompile_opcode(const struct recompile *rc, unsigned int addr)
+{
+    return (rc->chip->mem[addr] << 8) | rc->chip->mem[addr + 1];
+}
+
+// Whole instructions inside the ROM are all the walk follows, everything
+// else is left to the interpreter
+static inline int recompile_in_rom(const struct recompile *rc, unsigned int addr)
+{
+    return addr >= ROM_OFFSET && addr + 2 <= rc->rom_end;
+}
+
+// Everything that leaves the straight-line path or calls for a check
+// afterwards ends a block
+static int recompile_ends_block(uint8_t op)
+{
+    switch (op)
+    {
+    case CHIP8_OP_invalid:
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_1nnn:
+    case CHIP8_OP_2nnn:
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_Bnnn:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+    case CHIP8_OP_Fx0A:
+    case CHIP8_OP_00FD:
+    case CHIP8_OP_Fx33:
+    case CHIP8_OP_Fx55:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Where the instruction at addr can go next, not counting the return from
+// a 2nnn. Returns how many places.
+static int recompile_successors(const struct recompile *rc, unsigned int addr, unsigned int next[2])
+{
+    struct chip8_insn in;
+    chip8_decode(recompile_opcode(rc, addr), &in);
+
+    switch (in.op)
+    {
+    case CHIP8_OP_invalid:
+    case CHIP8_OP_00EE:
+    case CHIP8_OP_Bnnn:
+    case CHIP8_OP_00FD:
+        return 0;
+    case CHIP8_OP_1nnn:
+        // the VIP hires start, see chip8_op_1nnn()
+        next[0] = in.nnn == 0x260 && addr == 0x200 ? 0x2C0 : in.nnn;
+        return 1;
+    case CHIP8_OP_2nnn:
+        next[0] = in.nnn;
+        return 1;
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+        next[0] = addr + 2;
+        next[1] = addr + 4;
+        return 2;
+    default:
+        next[0] = addr + 2;
+        return 1;
+    }
+}
+
+// Whether a 00EE can be reached from a subroutine's first instruction.
+// Code after a call that never comes back is often data, so its return
+// address only counts as code if this says it might.
+static int recompile_may_return(const struct recompile *rc, unsigned int start)
+{
+    static uint8_t seen[4096];
+    static uint16_t stack[2 * 4096];
+    unsigned int depth = 0;
+
+    memset(seen, 0, sizeof(seen));
+    stack[depth++] = start;
+
+    while (depth > 0)
+    {
+        unsigned int addr = stack[--depth];
+        if (!recompile_in_rom(rc, addr) || seen[addr])
+        {
+            continue;
+        }
+        seen[addr] = 1;
+
+        if (recompile_opcode(rc, addr) == 0x00EE)
+        {
+            return 1;
+        }
+
+        unsigned int next[2];
+        int num_next = recompile_successors(rc, addr, next);
+        for (int i = 0; i < num_next; i++)
+        {
+            stack[depth++] = next[i];
+        }
+    }
+
+    return 0;
+}
+
+// Marks every instruction reachable from ROM_OFFSET and the return
+// addresses of calls that come back, until neither grows
+static void recompile_walk(struct recompile *rc)
+{
+    static uint16_t stack[3 * 4096];
+    int changed = 1;
+
+    while (changed)
+    {
+        unsigned int depth = 0;
+
+        memset(rc->reached, 0, sizeof(rc->reached));
+        stack[depth++] = ROM_OFFSET;
+        for (unsigned int addr = 0; addr < 4096; addr++)
+        {
+            if (rc->returns[addr])
+            {
+                stack[depth++] = addr;
+            }
+        }
+
+        while (depth > 0)
+        {
+            unsigned int addr = stack[--depth];
+            if (!recompile_in_rom(rc, addr) || rc->reached[addr])
+            {
+                continue;
+            }
+            rc->reached[addr] = 1;
+
+            unsigned int next[2];
+            int num_next = recompile_successors(rc, addr, next);
+            for (int i = 0; i < num_next; i++)
+            {
+                stack[depth++] = next[i];
+            }
+        }
+
+        changed = 0;
+        for (unsigned int addr = ROM_OFFSET; addr < rc->rom_end; addr++)
+        {
+            uint16_t opcode = recompile_opcode(rc, addr);
+            if (rc->reached[addr] && (opcode & 0xF000) == 0x2000 && addr + 2 < 4096 && !rc->returns[addr + 2] &&
+                recompile_may_return(rc, opcode & 0x0FFF))
+            {
+                rc->returns[addr + 2] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    // blocks start at the entry point, return addresses and wherever a
+    // block-ending instruction can go
+    rc->leader[ROM_OFFSET] = recompile_in_rom(rc, ROM_OFFSET);
+    for (unsigned int addr = ROM_OFFSET; addr < rc->rom_end; addr++)
+    {
+        if (!rc->reached[addr])
+        {
+            continue;
+        }
+
+        struct chip8_insn in;
+        chip8_decode(recompile_opcode(rc, addr), &in);
+
+        unsigned int next[2];
+        int num_next = recompile_successors(rc, addr, next);
+        for (int i = 0; i < num_next; i++)
+        {
+            if (recompile_ends_block(in.op) && next[i] < 4096 && rc->reached[next[i]])
+            {
+                rc->leader[next[i]] = 1;
+            }
+        }
+
+        if (rc->returns[addr])
+        {
+            rc->leader[addr] = 1;
+        }
+
+        if (in.op == CHIP8_OP_Bnnn)
+        {
+            rc->num_computed++;
+        }
+
+        if (in.op == CHIP8_OP_00EE || in.op == CHIP8_OP_Bnnn)
+        {
+            rc->redispatch = 1;
+        }
+
+        rc->code[addr >> 3] |= 1 << (addr & 7);
+        rc->code[(addr + 1) >> 3] |= 1 << ((addr + 1) & 7);
+        rc->num_insns++;
+    }
+
+    for (unsigned int addr = 0; addr < 4096; addr++)
+    {
+        if (rc->leader[addr])
+        {
+            rc->entries[addr >> 3] |= 1 << (addr & 7);
+            rc->num_blocks++;
+        }
+    }
+}
+
+static void recompile_write_bytes(FILE *out, const char *name, const uint8_t *bytes, size_t len)
+{
+    fprintf(out, "static const uint8_t %s[%zu] = {", name, len);
+    for (size_t i = 0; i < len; i++)
+    {
+        fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", bytes[i]);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+// Continues at addr: a goto if a block starts there, otherwise back to the
+// runtime with pc set
+static void recompile_write_goto(const struct recompile *rc, FILE *out, const char *indent, unsigned int addr)
+{
+    if (addr < 4096 && rc->leader[addr])
+    {
+        fprintf(out, "%sgoto b_%03X;\n", indent, addr);
+        return;
+    }
+
+    fprintf(out, "%schip->pc = 0x%03X;\n", indent, addr);
+    fprintf(out, "%sgoto out;\n", indent);
+}
+
+// Ticks the timers for the instructions before this one, left being how
+// many of the block's are still to run including it
+static void recompile_write_sync(FILE *out, const char *indent, unsigned int left)
+{
+    fprintf(out, "%schip8_aot_timers(chip, ran - %u - ticked);\n", indent, left);
+    fprintf(out, "%sticked = ran - %u;\n", indent, left);
+}
+
+// An instruction the interpreter runs, with pc past it as it expects
+static void recompile_write_exec(FILE *out, const char *indent, unsigned int addr, uint16_t opcode)
+{
+    fprintf(out, "%schip->pc = 0x%03X;\n", indent, addr + 2);
+    fprintf(out, "%schip8_aot_exec(chip, 0x%04X);\n", indent, opcode);
+}
+
+#define REG "chip->regs[0x%X]"
+#define VF "chip->regs[0xF]"
+
+// Writes out one instruction, left being how many of the block's are
+// still to run including it. Instructions that end a block also write how
+// it continues.
+static void recompile_write_insn(const struct recompile *rc, FILE *out, unsigned int addr, unsigned int left)
+{
+    uint16_t opcode = recompile_opcode(rc, addr);
+    struct chip8_insn in;
+    chip8_decode(opcode, &in);
+
+    char text[32];
+    chip8_disassemble(opcode, rc->quirks, text, sizeof(text));
+    fprintf(out, "    // %03X  %04X  %s\n", addr, opcode, text);
+
+    unsigned int x = in.x;
+    unsigned int y = in.y;
+
+    switch (in.op)
+    {
+    case CHIP8_OP_00EE:
+        fprintf(out, "    if (chip->sp <= 0)\n    {\n");
+        recompile_write_sync(out, "        ", left);
+        recompile_write_exec(out, "        ", addr, opcode);
+        fprintf(out, "    }\n");
+        fprintf(out, "    chip->pc = chip->stk[--chip->sp];\n");
+        fprintf(out, "    chip->opcode = 0x%04X;\n", opcode);
+        fprintf(out, "    goto dispatch;\n");
+        break;
+    case CHIP8_OP_1nnn:
+        fprintf(out, "    chip->opcode = 0x%04X;\n", opcode);
+        if (in.nnn == 0x260 && addr == 0x200)
+        {
+            fprintf(out, "    chip->vid_height = 64;\n");
+            fprintf(out, "    chip->vid_dirty = 1;\n");
+            recompile_write_goto(rc, out, "    ", 0x2C0);
+        }
+        else if (in.nnn == addr || (in.nnn == addr - 4 && in.nnn >= ROM_OFFSET && recompile_opcode(rc, in.nnn) >> 12 == 0xF &&
+                                    (recompile_opcode(rc, in.nnn) & 0xFF) == 0x07 &&
+                                    recompile_opcode(rc, in.nnn + 2) >> 8 == (0x30 | ((recompile_opcode(rc, in.nnn) >> 8) & 0xF))))
+        {
+            // an idle loop chip8_unpark() skips, see chip8_op_1nnn()
+            fprintf(out, "    chip->parked = 1;\n");
+            fprintf(out, "    chip->pc = 0x%03X;\n", in.nnn);
+            fprintf(out, "    goto out;\n");
+        }
+        else
+        {
+            recompile_write_goto(rc, out, "    ", in.nnn);
+        }
+        break;
+    case CHIP8_OP_2nnn:
+        fprintf(out, "    if (chip->sp >= 15)\n    {\n");
+        recompile_write_sync(out, "        ", left);
+        recompile_write_exec(out, "        ", addr, opcode);
+        fprintf(out, "    }\n");
+        fprintf(out, "    chip->stk[chip->sp++] = 0x%03X;\n", addr + 2);
+        fprintf(out, "    chip->opcode = 0x%04X;\n", opcode);
+        recompile_write_goto(rc, out, "    ", in.nnn);
+        break;
+    case CHIP8_OP_3xkk:
+    case CHIP8_OP_4xkk:
+    case CHIP8_OP_5xy0:
+    case CHIP8_OP_9xy0:
+    case CHIP8_OP_Ex9E:
+    case CHIP8_OP_ExA1:
+        fprintf(out, "    chip->opcode = 0x%04X;\n", opcode);
+        if (in.op == CHIP8_OP_3xkk)
+        {
+            fprintf(out, "    if (" REG " == 0x%02X)\n", x, in.kk);
+        }
+        else if (in.op == CHIP8_OP_4xkk)
+        {
+            fprintf(out, "    if (" REG " != 0x%02X)\n", x, in.kk);
+        }
+        else if (in.op == CHIP8_OP_5xy0)
+        {
+            fprintf(out, "    if (" REG " == " REG ")\n", x, y);
+        }
+        else if (in.op == CHIP8_OP_9xy0)
+        {
+            fprintf(out, "    if (" REG " != " REG ")\n", x, y);
+        }
+        else if (in.op == CHIP8_OP_Ex9E)
+        {
+            fprintf(out, "    if (chip->keys[" REG "])\n", x);
+        }
+        else
+        {
+            fprintf(out, "    if (!chip->keys[" REG "])\n", x);
+        }
+        fprintf(out, "    {\n");
+        recompile_write_goto(rc, out, "        ", addr + 4);
+        fprintf(out, "    }\n");
+        recompile_write_goto(rc, out, "    ", addr + 2);
+        break;
+    case CHIP8_OP_Bnnn:
+        recompile_write_exec(out, "    ", addr, opcode);
+        fprintf(out, "    goto dispatch;\n");
+        break;
+    case CHIP8_OP_Fx0A:
+        recompile_write_exec(out, "    ", addr, opcode);
+        fprintf(out, "    if (chip->parked)\n    {\n        goto out;\n    }\n");
+        recompile_write_goto(rc, out, "    ", addr + 2);
+        break;
+    case CHIP8_OP_Fx33:
+    case CHIP8_OP_Fx55:
+        // a store into the code stops it here, see aot.c
+        recompile_write_exec(out, "    ", addr, opcode);
+        fprintf(out, "    if (chip->aot_stale)\n    {\n        goto out;\n    }\n");
+        recompile_write_goto(rc, out, "    ", addr + 2);
+        break;
+    case CHIP8_OP_00FD:
+        recompile_write_exec(out, "    ", addr, opcode);
+        fprintf(out, "    goto out;\n");
+        break;
+    case CHIP8_OP_invalid:
+        // faults, so never gets to out to tick for the ones before it
+        recompile_write_sync(out, "    ", left);
+        recompile_write_exec(out, "    ", addr, opcode);
+        fprintf(out, "    goto out;\n");
+        break;
+    case CHIP8_OP_6xkk:
+        fprintf(out, "    " REG " = 0x%02X;\n", x, in.kk);
+        break;
+    case CHIP8_OP_7xkk:
+        fprintf(out, "    " REG " += 0x%02X;\n", x, in.kk);
+        break;
+    case CHIP8_OP_8xy0:
+        fprintf(out, "    " REG " = " REG ";\n", x, y);
+        break;
+    case CHIP8_OP_8xy1:
+    case CHIP8_OP_8xy2:
+    case CHIP8_OP_8xy3:
+        fprintf(out, "    " REG " %c= " REG ";\n", x, in.op == CHIP8_OP_8xy1 ? '|' : in.op == CHIP8_OP_8xy2 ? '&' : '^', y);
+        if (rc->quirk_bits & CHIP8_QUIRK_VF_RESET)
+        {
+            fprintf(out, "    " VF " = 0;\n");
+        }
+        break;
+    case CHIP8_OP_8xy4:
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t ans = " REG " + " REG ";\n", x, y);
+        fprintf(out, "        " VF " = ans > 0xFF;\n");
+        fprintf(out, "        " REG " = ans & 0xFF;\n", x);
+        fprintf(out, "    }\n");
+        break;
+    case CHIP8_OP_8xy5:
+    case CHIP8_OP_8xy7:
+    {
+        unsigned int a = in.op == CHIP8_OP_8xy5 ? x : y;
+        unsigned int b = in.op == CHIP8_OP_8xy5 ? y : x;
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t ans = " REG " - " REG ";\n", a, b);
+        fprintf(out, "        " VF " = " REG " > " REG ";\n", a, b);
+        fprintf(out, "        " REG " = ans & 0xFF;\n", x);
+        fprintf(out, "    }\n");
+        break;
+    }
+    case CHIP8_OP_8xy6:
+    case CHIP8_OP_8xyE:
+    {
+        int right = in.op == CHIP8_OP_8xy6;
+        if (rc->quirk_bits & CHIP8_QUIRK_SHIFT_VY)
+        {
+            fprintf(out, "    {\n");
+            fprintf(out, "        uint8_t src = " REG ";\n", y);
+            fprintf(out, "        " REG " = src %s 1;\n", x, right ? ">>" : "<<");
+            fprintf(out, "        " VF " = src %s;\n", right ? "& 1" : ">> 7");
+            fprintf(out, "    }\n");
+        }
+        else
+        {
+            fprintf(out, "    " VF " = " REG " %s;\n", x, right ? "& 1" : ">> 7");
+            fprintf(out, "    " REG " %s= 1;\n", x, right ? ">>" : "<<");
+        }
+        break;
+    }
+    case CHIP8_OP_Annn:
+        fprintf(out, "    chip->idx = 0x%03X;\n", in.nnn);
+        break;
+    case CHIP8_OP_Fx07:
+        recompile_write_sync(out, "    ", left);
+        fprintf(out, "    " REG " = chip->delTime;\n", x);
+        break;
+    case CHIP8_OP_Fx15:
+        recompile_write_sync(out, "    ", left);
+        fprintf(out, "    chip->delTime = " REG ";\n", x);
+        break;
+    case CHIP8_OP_Fx18:
+        recompile_write_sync(out, "    ", left);
+        fprintf(out, "    chip->sfxTime = " REG ";\n", x);
+        break;
+    case CHIP8_OP_Fx1E:
+        fprintf(out, "    chip->idx += " REG ";\n", x);
+        break;
+    case CHIP8_OP_Fx29:
+        fprintf(out, "    chip->idx = FONT_OFFSET + 5 * " REG ";\n", x);
+        break;
+    case CHIP8_OP_Fx30:
+        fprintf(out, "    chip->idx = BIG_FONT_OFFSET + 10 * (" REG " & 0xF);\n", x);
+        break;
+    case CHIP8_OP_Fx65:
+        for (unsigned int i = 0; i <= x; i++)
+        {
+            fprintf(out, "    " REG " = chip->mem[(chip->idx + %u) & 0xFFF];\n", i, i);
+        }
+        if (rc->quirk_bits & CHIP8_QUIRK_LOAD_STORE_I)
+        {
+            fprintf(out, "    chip->idx += %u;\n", x + 1);
+        }
+        else if ((rc->quirk_bits & CHIP8_QUIRK_LOAD_STORE_I_X) && x > 0)
+        {
+            fprintf(out, "    chip->idx += %u;\n", x);
+        }
+        break;
+    case CHIP8_OP_Fx75:
+        fprintf(out, "    memcpy(chip->rpl, chip->regs, %u);\n", x + 1);
+        break;
+    case CHIP8_OP_Fx85:
+        fprintf(out, "    memcpy(chip->regs, chip->rpl, %u);\n", x + 1);
+        break;
+    default:
+        // drawing, scrolling, display modes and Cxkk
+        fprintf(out, "    chip8_aot_exec(chip, 0x%04X);\n", opcode);
+        break;
+    }
+}
+
+#undef REG
+#undef VF
+
+// One label per block: the budget check, the instructions, then where it
+// goes. A block runs until an instruction that ends one, or into the next.
+static void recompile_write_block(const struct recompile *rc, FILE *out, unsigned int start)
+{
+    unsigned int end = start;
+    unsigned int len = 0;
+
+    for (;;)
+    {
+        struct chip8_insn in;
+        chip8_decode(recompile_opcode(rc, end), &in);
+        end += 2;
+        len++;
+
+        if (recompile_ends_block(in.op) || !recompile_in_rom(rc, end) || !rc->reached[end] || rc->leader[end])
+        {
+            break;
+        }
+    }
+
+    fprintf(out, "b_%03X:\n", start);
+    fprintf(out, "    if (cycles - ran < %u)\n    {\n", len);
+    fprintf(out, "        chip->pc = 0x%03X;\n", start);
+    fprintf(out, "        goto out;\n    }\n");
+    fprintf(out, "    ran += %u;\n", len);
+
+    unsigned int left = len;
+    for (unsigned int addr = start; addr < end; addr += 2)
+    {
+        recompile_write_insn(rc, out, addr, left--);
+    }
+
+    uint16_t last = recompile_opcode(rc, end - 2);
+    struct chip8_insn in;
+    chip8_decode(last, &in);
+    if (!recompile_ends_block(in.op))
+    {
+        fprintf(out, "    chip->opcode = 0x%04X;\n", last);
+        recompile_write_goto(rc, out, "    ", end);
+    }
+    fprintf(out, "\n");
+}
+
+static void recompile_write_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', out);
+        }
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static const char *recompile_quirks_enum(int quirks)
+{
+    switch (quirks)
+    {
+#define X(name, label, bits)  \
+    case CHIP8_QUIRKS_##name: \
+        return "CHIP8_QUIRKS_" #name;
+        CHIP8_QUIRK_PROFILES(X)
+#undef X
+    default:
+        return "CHIP8_QUIRKS_MODERN";
+    }
+}
+
+static void recompile_write(const struct recompile *rc, FILE *out, const char *name, const char *rom_filename)
+{
+    const uint8_t *rom = rc->chip->mem + ROM_OFFSET;
+    size_t rom_len = rc->rom_end - ROM_OFFSET;
+    uint8_t digest[20];
+    chip8_sha1(rom, rom_len, digest);
+
+    fprintf(out, "// Generated by chip8-recompile from %s, do not edit.\n", rom_filename);
+    fprintf(out, "// SHA-1 ");
+    for (int i = 0; i < 20; i++)
+    {
+        fprintf(out, "%02x", digest[i]);
+    }
+    fprintf(out, ", %s quirks\n", chip8_quirks_name(rc->quirks));
+    fprintf(out, "// %u blocks, %u instructions, %u computed jumps left to the interpreter\n\n", rc->num_blocks, rc->num_insns,
+            rc->num_computed);
+    fprintf(out, "#include \"chip8.h\"\n\n");
+
+    recompile_write_bytes(out, "rom", rom, rom_len);
+    recompile_write_bytes(out, "entries", rc->entries, sizeof(rc->entries));
+    recompile_write_bytes(out, "code", rc->code, sizeof(rc->code));
+
+    fprintf(out, "static unsigned long long run(struct chip8_data *chip, unsigned long long cycles)\n{\n");
+    fprintf(out, "    // instructions run, and how many of them the timers have ticked for\n");
+    fprintf(out, "    unsigned long long ran = 0;\n");
+    fprintf(out, "    unsigned long long ticked = 0;\n\n");
+
+    if (rc->redispatch)
+    {
+        fprintf(out, "dispatch:\n");
+    }
+    fprintf(out, "    switch (chip->pc)\n    {\n");
+    for (unsigned int addr = 0; addr < 4096; addr++)
+    {
+        if (rc->leader[addr])
+        {
+            fprintf(out, "    case 0x%03X:\n        goto b_%03X;\n", addr, addr);
+        }
+    }
+    fprintf(out, "    default:\n        goto out;\n    }\n\n");
+
+    for (unsigned int addr = 0; addr < 4096; addr++)
+    {
+        if (rc->leader[addr])
+        {
+            recompile_write_block(rc, out, addr);
+        }
+    }
+
+    fprintf(out, "out:\n");
+    fprintf(out, "    chip8_aot_timers(chip, ran - ticked);\n");
+    fprintf(out, "    return ran;\n}\n\n");
+
+    fprintf(out, "static struct chip8_aot_program program = {");
+    recompile_write_string(out, name);
+    fprintf(out, ", rom, sizeof(rom), %s, entries, code, run, NULL};\n\n", recompile_quirks_enum(rc->quirks));
+    fprintf(out, "__attribute__((constructor)) static void register_program()\n{\n");
+    fprintf(out, "    chip8_aot_register(&program);\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    int quirks = -1;
+    const char *name = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            quirks = chip8_parse_quirks(optarg);
+            if (quirks < 0)
+            {
+                fprintf(stderr, "Unknown quirks '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        default:
+            recompile_usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        recompile_usage();
+        return 1;
+    }
+
+    const char *rom_filename = argv[optind];
+    const char *out_filename = argv[optind + 1];
+
+    // read here rather than by chip8_load_rom(), the program is matched
+    // against the ROM's exact bytes and length
+    FILE *rom_file = fopen(rom_filename, "rb");
+    if (rom_file == NULL)
+    {
+        fprintf(stderr, "Could not open ROM file '%s'\n", rom_filename);
+        return 1;
+    }
+
+    static uint8_t rom[MAX_ROM_SZ + 1];
+    size_t rom_len = fread(rom, 1, sizeof(rom), rom_file);
+    fclose(rom_file);
+
+    static struct recompile rc;
+    rc.chip = chip8_create();
+    if (chip8_load_rom_buffer(rc.chip, rom, rom_len) != CHIP8_OK)
+    {
+        fprintf(stderr, "ROM '%s' exceeds max size of 0x%x\n", rom_filename, MAX_ROM_SZ);
+        return 1;
+    }
+    rc.rom_end = ROM_OFFSET + rom_len;
+
+    rc.quirks = quirks >= 0 ? quirks : rc.chip->quirks;
+    rc.quirk_bits = chip8_quirk_bits(rc.quirks);
+
+    if (name == NULL)
+    {
+        name = strrchr(rom_filename, '/') != NULL ? strrchr(rom_filename, '/') + 1 : rom_filename;
+    }
+
+    recompile_walk(&rc);
+
+    FILE *out = fopen(out_filename, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not create '%s'\n", out_filename);
+        return 1;
+    }
+
+    recompile_write(&rc, out, name, rom_filename);
+    if (fclose(out) != 0)
+    {
+        fprintf(stderr, "Could not write '%s'\n", out_filename);
+        return 1;
+    }
+
+    fprintf(stderr, "%s: %u blocks, %u instructions, %u computed jumps\n", name, rc.num_blocks, rc.num_insns, rc.num_computed);
+    chip8_destroy(rc.chip);
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include "chip8.h"
+
+// Every frame pushes a snapshot of the machine state (the same bytes a state
+// file holds). Each one is XORed against the newest keyframe and the result
+// run-length encoded as
+//   <u16 equal bytes> <u16 changed bytes> <changed bytes XOR keyframe> ...
+// so a frame that only touched a few registers and a sprite costs tens of
+// bytes. Keyframes are encoded the same way against all zeroes.
+//
+// Records live back to back in one arena allocated up front. When a new
+// record doesn't fit, the oldest keyframe is dropped along with every delta
+// that depends on it.
+
+static const uint8_t chip8_rewind_zero[CHIP8_STATE_SIZE] = {0};
+
+// frames between keyframes, bounds the work to restore any one frame
+const unsigned int REWIND_KEYFRAME_INTERVAL = 60;
+
+// changed bytes are only split around at least this many equal ones, since
+// a new run costs 4 bytes of header
+const unsigned int REWIND_MIN_EQUAL_RUN = 4;
+
+static inline void chip8_rewind_put16(uint8_t *out, size_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static inline size_t chip8_rewind_get16(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+static size_t chip8_rewind_encode(const uint8_t *cur, const uint8_t *base, uint8_t *out)
+{
+    size_t pos = 0;
+    size_t len = 0;
+
+    while (pos < CHIP8_STATE_SIZE)
+    {
+        size_t equal_start = pos;
+
+        // most of the state is unchanged, skip it a word at a time
+        while (pos + 8 <= CHIP8_STATE_SIZE && memcmp(cur + pos, base + pos, 8) == 0)
+        {
+            pos += 8;
+        }
+        while (pos < CHIP8_STATE_SIZE && cur[pos] == base[pos])
+        {
+            pos++;
+        }
+
+        size_t changed_start = pos;
+        size_t equal_run = 0;
+        while (pos < CHIP8_STATE_SIZE && equal_run < REWIND_MIN_EQUAL_RUN)
+        {
+            equal_run = cur[pos] == base[pos] ? equal_run + 1 : 0;
+            pos++;
+        }
+        pos -= equal_run;
+
+        size_t changed = pos - changed_start;
+        chip8_rewind_put16(out + len, changed_start - equal_start);
+        chip8_rewind_put16(out + len + 2, changed);
+        len += 4;
+
+        for (size_t i = 0; i < changed; i++)
+        {
+            out[len + i] = cur[changed_start + i] ^ base[changed_start + i];
+        }
+        len += changed;
+    }
+
+    return len;
+}
+
+static void chip8_rewind_decode(const uint8_t *in, size_t len, const uint8_t *base, uint8_t *out)
+{
+    size_t pos = 0;
+
+    memcpy(out, base, CHIP8_STATE_SIZE);
+    for (size_t i = 0; i < len;)
+    {
+        pos += chip8_rewind_get16(in + i);
+        size_t changed = chip8_rewind_get16(in + i + 2);
+        i += 4;
+
+        for (size_t j = 0; j < changed; j++)
+        {
+            out[pos + j] ^= in[i + j];
+        }
+        pos += changed;
+        i += changed;
+    }
+}
+
+int chip8_rewind_init(struct chip8_rewind *rw, unsigned int seconds, size_t budget)
+{
+    memset(rw, 0, sizeof(*rw));
+
+    // a keyframe that doesn't compress at all must still fit
+    if (budget < 2 * CHIP8_STATE_SIZE)
+    {
+        budget = 2 * CHIP8_STATE_SIZE;
+    }
+
+    rw->max_entries = seconds * 60 > 0 ? seconds * 60 : 1;
+    rw->arena_size = budget;
+    rw->arena = (uint8_t *)malloc(rw->arena_size);
+    rw->entries = (struct chip8_rewind_entry *)calloc(rw->max_entries, sizeof(struct chip8_rewind_entry));
+    rw->keyframe = (uint8_t *)malloc(CHIP8_STATE_SIZE);
+    rw->scratch = (uint8_t *)malloc(2 * CHIP8_STATE_SIZE);
+    rw->force_keyframe = 1;
+
+    if (rw->arena == NULL || rw->entries == NULL || rw->keyframe == NULL || rw->scratch == NULL)
+    {
+        fprintf(stderr, "Could not allocate %zu bytes of rewind buffer\n", budget);
+        chip8_rewind_free(rw);
+        return -1;
+    }
+
+    // touch every page now rather than on some later frame
+    memset(rw->arena, 0, rw->arena_size);
+
+    return 0;
+}
+
+void chip8_rewind_free(struct chip8_rewind *rw)
+{
+    free(rw->arena);
+    free(rw->entries);
+    free(rw->keyframe);
+    free(rw->scratch);
+    rw->arena = NULL;
+    rw->entries = NULL;
+    rw->keyframe = NULL;
+    rw->scratch = NULL;
+}
+
+static inline struct chip8_rewind_entry *chip8_rewind_entry_at(struct chip8_rewind *rw, unsigned int age)
+{
+    return &rw->entries[(rw->first + age) % rw->max_entries];
+}
+
+// Drops the oldest keyframe and the deltas that were taken against it
+static void chip8_rewind_evict(struct chip8_rewind *rw)
+{
+    do
+    {
+        rw->stored_bytes -= chip8_rewind_entry_at(rw, 0)->len;
+        rw->first = (rw->first + 1) % rw->max_entries;
+        rw->num_entries--;
+    } while (rw->num_entries > 0 && !chip8_rewind_entry_at(rw, 0)->keyframe);
+
+    if (rw->num_entries == 0)
+    {
+        rw->head = 0;
+        rw->force_keyframe = 1;
+    }
+}
+
+// Finds room for len bytes, evicting as needed. Live records run from the
+// oldest entry's offset up to head, wrapping at most once.
+static size_t chip8_rewind_alloc(struct chip8_rewind *rw, size_t len)
+{
+    for (;;)
+    {
+        if (rw->num_entries == 0)
+        {
+            return 0;
+        }
+
+        size_t tail = chip8_rewind_entry_at(rw, 0)->offset;
+        if (rw->head > tail)
+        {
+            if (rw->arena_size - rw->head >= len)
+            {
+                return rw->head;
+            }
+            if (tail >= len)
+            {
+                return 0;
+            }
+        }
+        else if (tail - rw->head >= len)
+        {
+            return rw->head;
+        }
+
+        chip8_rewind_evict(rw);
+    }
+}
+
+void chip8_rewind_push(struct chip8_rewind *rw, const struct chip8_data *chip)
+{
+    long long start_time = time_nanos();
+    const uint8_t *state = (const uint8_t *)chip;
+
+    if (rw->num_entries == rw->max_entries)
+    {
+        chip8_rewind_evict(rw);
+    }
+
+    int keyframe = rw->force_keyframe || rw->since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL;
+    size_t len = chip8_rewind_encode(state, keyframe ? chip8_rewind_zero : rw->keyframe, rw->scratch);
+
+    // a delta may have evicted its own keyframe to make room, in which case
+    // this frame has to become one
+    size_t offset = chip8_rewind_alloc(rw, len);
+    if (!keyframe && rw->force_keyframe)
+    {
+        keyframe = 1;
+        len = chip8_rewind_encode(state, chip8_rewind_zero, rw->scratch);
+        offset = chip8_rewind_alloc(rw, len);
+    }
+
+    memcpy(rw->arena + offset, rw->scratch, len);
+
+    struct chip8_rewind_entry *entry = chip8_rewind_entry_at(rw, rw->num_entries);
+    entry->offset = offset;
+    entry->len = len;
+    entry->keyframe = keyframe;
+
+    rw->num_entries++;
+    rw->head = offset + len;
+    rw->stored_bytes += len;
+
+    if (keyframe)
+    {
+        memcpy(rw->keyframe, state, CHIP8_STATE_SIZE);
+        rw->force_keyframe = 0;
+        rw->since_keyframe = 0;
+    }
+    else
+    {
+        rw->since_keyframe++;
+    }
+
+    long long elapsed = time_nanos() - start_time;
+    rw->pushes++;
+    rw->push_bytes += len;
+    rw->push_ns += elapsed;
+    if (elapsed > rw->max_push_ns)
+    {
+        rw->max_push_ns = elapsed;
+    }
+}
+
+// Restores the newest snapshot and drops it. Returns -1 once there is
+// nothing left to go back to.
+int chip8_rewind_pop(struct chip8_rewind *rw, struct chip8_data *chip)
+{
+    if (rw->num_entries == 0)
+    {
+        return -1;
+    }
+
+    unsigned int newest = rw->num_entries - 1;
+    unsigned int key = newest;
+    while (!chip8_rewind_entry_at(rw, key)->keyframe)
+    {
+        key--;
+    }
+
+    struct chip8_rewind_entry *key_entry = chip8_rewind_entry_at(rw, key);
+    struct chip8_rewind_entry *entry = chip8_rewind_entry_at(rw, newest);
+
+    // the keys belong to whoever is holding them now, not to the past
+    uint8_t keys[sizeof(chip->keys)];
+    memcpy(keys, chip->keys, sizeof(keys));
+
+    chip8_rewind_decode(rw->arena + key_entry->offset, key_entry->len, chip8_rewind_zero, rw->keyframe);
+    chip8_rewind_decode(rw->arena + entry->offset, entry->len, entry->keyframe ? chip8_rewind_zero : rw->keyframe, (uint8_t *)chip);
+
+    memcpy(chip->keys, keys, sizeof(keys));
+    chip8_bcache_flush(chip);
+    chip->vid_dirty = 1;
+    chip->status = CHIP8_OK;
+
+    rw->num_entries--;
+    rw->stored_bytes -= entry->len;
+    rw->head = entry->offset;
+    rw->pops++;
+
+    // rw->keyframe now holds the newest live keyframe, but it may be the
+    // one just popped
+    rw->force_keyframe = rw->num_entries == 0 || entry->keyframe;
+    rw->since_keyframe = newest - key - (entry->keyframe ? 0 : 1);
+
+    return 0;
+}
+
+void chip8_rewind_report(const struct chip8_rewind *rw, FILE *out)
+{
+    fprintf(out, "rewind_frames=%u rewind_seconds=%.1f rewind_bytes=%zu/%zu rewind_ratio=%.1f rewind_push_us=%.2f rewind_max_push_us=%.2f rewind_pops=%llu\n",
+            rw->num_entries, rw->num_entries / 60.0, rw->stored_bytes, rw->arena_size,
+            rw->push_bytes > 0 ? (double)rw->pushes * CHIP8_STATE_SIZE / rw->push_bytes : 0.0,
+            rw->pushes > 0 ? rw->push_ns / 1e3 / rw->pushes : 0.0, rw->max_push_ns / 1e3, rw->pops);
+}
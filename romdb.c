@@ -0,0 +1,170 @@
+#include "chip8.h"
+
+// ROMs whose interpreter is known, keyed by the SHA-1 of the ROM file.
+// Anything not listed runs as CHIP8_QUIRKS_MODERN.
+
+struct chip8_romdb_entry
+{
+    const char *sha1;
+    uint8_t quirks;
+    const char *title;
+};
+
+static const struct chip8_romdb_entry chip8_romdb[] = {
+    // COSMAC VIP, 1977-1981
+    {"5b29263763be401c31d805bc35a4cd211d552881", CHIP8_QUIRKS_VIP, "Jumping X and O [Harry Kleinberg, 1977]"},
+    {"614a2b3d0bb5d62a16d963ac2d3a79eb3dd22742", CHIP8_QUIRKS_VIP, "Coin Flipping [Carmelo Cortez, 1978]"},
+    {"35158696bd94ea22ef34e899fff1f15f7154d4fd", CHIP8_QUIRKS_VIP, "Craps [Camerlo Cortez, 1978]"},
+    {"dbb52193db4063149c3d8768ab47dd740d90955c", CHIP8_QUIRKS_VIP, "Hi-Lo [Jef Winsor, 1978]"},
+    {"fc724ae0125f5f1ac94a79fe3afc6318b1f57556", CHIP8_QUIRKS_VIP, "Kaleidoscope [Joseph Weisbecker, 1978]"},
+    {"669e32b6f42f52da658e428f501aabcdfa37fb2e", CHIP8_QUIRKS_VIP, "Mastermind FourRow [Robert Lindley, 1978]"},
+    {"4031dae5c7545a1adc160a661be36f19fc1d47b2", CHIP8_QUIRKS_VIP, "Nim [Carmelo Cortez, 1978]"},
+    {"3d1d029d6e31206d245c0ba881c0d1f003953bad", CHIP8_QUIRKS_VIP, "Rocket [Joseph Weisbecker, 1978]"},
+    {"24960090b2afc9de2a4cb3ee7daf6a21456bb49b", CHIP8_QUIRKS_VIP, "Russian Roulette [Carmelo Cortez, 1978]"},
+    {"443550abf646bc7f475ef0466f8e1232ec7474f3", CHIP8_QUIRKS_VIP, "Shooting Stars [Philip Baltzer, 1978]"},
+    {"ed829190e37815771e7a8c675ba0074996a2ddb0", CHIP8_QUIRKS_VIP, "Space Intercept [Joseph Weisbecker, 1978]"},
+    {"1bd92042717c3bc4f7f34cab34be2887145a6704", CHIP8_QUIRKS_VIP, "Spooky Spot [Joseph Weisbecker, 1978]"},
+    {"89aadf7c28bcd1c11e71ad9bd6eeaf0e7be474f3", CHIP8_QUIRKS_VIP, "Submarine [Carmelo Cortez, 1978]"},
+    {"448f9d30d2157ab42679b809d4fb0b43d145f74f", CHIP8_QUIRKS_VIP, "Sequence Shoot [Joyce Weisbecker]"},
+    {"7623fa0fa915979226566b24107360e7537735f4", CHIP8_QUIRKS_VIP, "Slide [Joyce Weisbecker]"},
+    {"83a2f9c8153be955c28e788bd803aa1d25131330", CHIP8_QUIRKS_VIP, "Sum Fun [Joyce Weisbecker]"},
+    {"d666688a8fce468a7d88b536bc1ef5f35ba12031", CHIP8_QUIRKS_VIP, "Wipe Off [Joseph Weisbecker]"},
+    {"193915dcde1365ae054c4eaa21a35baa27cd3356", CHIP8_QUIRKS_VIP, "Breakout [Carmelo Cortez, 1979]"},
+    {"72e8f3a10a32bd7fb91322ecab87249f95e81e57", CHIP8_QUIRKS_VIP, "Lunar Lander [Udo Pernisz, 1979]"},
+    {"8d56a781bf16acccb307177b80ff326f62aabbdc", CHIP8_QUIRKS_VIP, "Hires Test [Tom Swan, 1979]"},
+    {"ac7c8db7865beb22c9ec9001c9c0319e02f5d5c2", CHIP8_QUIRKS_VIP, "Framed MK1 [GV Samways, 1980]"},
+    {"eb72a25bd58e122e65a540807e7a1816abaa4f41", CHIP8_QUIRKS_VIP, "Framed MK2 [GV Samways, 1980]"},
+    {"efa6bc8f1f35baaa16700d68a83dc4919797e2fe", CHIP8_QUIRKS_VIP, "Life [GV Samways, 1980]"},
+    {"016345d75eef34448840845a9590d41e6bfdf46a", CHIP8_QUIRKS_VIP, "Clock Program [Bill Fisher, 1981]"},
+
+    // CHIP-48 on the HP 48, 1990-1991
+    {"f13766c14aeb02ad8d4d103cb5eadd282d20cddc", CHIP8_QUIRKS_CHIP48, "Brix [Andreas Gustafsson, 1990]"},
+    {"91442577a6bbf8c3267f2df95fdfc50baebe176d", CHIP8_QUIRKS_CHIP48, "Brick (Brix hack, 1990)"},
+    {"b232ef880bd6060fb45fa6effed7edf0ae95670e", CHIP8_QUIRKS_CHIP48, "Pong [Paul Vervalin, 1990]"},
+    {"1bdb4ddaa7049266fa3226851f28855a365cfd12", CHIP8_QUIRKS_CHIP48, "Syzygy [Roy Trevino, 1990]"},
+    {"5f518084744bf3cb8733f6e5454dfd1634320563", CHIP8_QUIRKS_CHIP48, "Tetris [Fran Dachille, 1991]"},
+    {"ade839585ddeb0e3633177df03c1d91589e629eb", CHIP8_QUIRKS_CHIP48, "Vers [JMN, 1991]"},
+
+    // SUPER-CHIP
+    {"d40abc54374e4343639f993e897e00904ddf85d9", CHIP8_QUIRKS_SCHIP, "Blinky [Hans Christian Egeberg, 1991]"},
+    {"f4169141735d8d60e51409ca7e73f4adedcefef2", CHIP8_QUIRKS_SCHIP, "Blinky [Hans Christian Egeberg] (alt)"},
+    {"6f6509f38220e057a7e32ebb22dd353c1078e3e7", CHIP8_QUIRKS_SCHIP, "Blitz [David Winter]"},
+    {"5c28a5f85289c9d859f95fd5eadbdcb1c30bb08b", CHIP8_QUIRKS_SCHIP, "Space Invaders [David Winter]"},
+    {"f100197f0f2f05b4f3c8c31ab9c2c3930d3e9571", CHIP8_QUIRKS_SCHIP, "Space Invaders [David Winter] (alt)"},
+};
+
+static inline uint32_t chip8_sha1_rol(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+static void chip8_sha1_block(uint32_t *h, const uint8_t *block)
+{
+    uint32_t w[80];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++)
+    {
+        w[i] = chip8_sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t t = chip8_sha1_rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = chip8_sha1_rol(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void chip8_sha1(const void *data, size_t len, uint8_t digest[20])
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    size_t done = 0;
+
+    for (; len - done >= 64; done += 64)
+    {
+        chip8_sha1_block(h, bytes + done);
+    }
+
+    // the tail, a 1 bit, zeroes and the length in bits, over one or two blocks
+    uint8_t tail[128];
+    size_t rest = len - done;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, bytes + done, rest);
+    tail[rest] = 0x80;
+    for (int i = 0; i < 8; i++)
+    {
+        tail[tail_len - 1 - i] = bits >> (8 * i);
+    }
+
+    for (size_t i = 0; i < tail_len; i += 64)
+    {
+        chip8_sha1_block(h, tail + i);
+    }
+
+    for (int i = 0; i < 20; i++)
+    {
+        digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+int chip8_romdb_lookup(const uint8_t *rom, size_t len)
+{
+    uint8_t digest[20];
+    char hex[41];
+
+    chip8_sha1(rom, len, digest);
+    for (int i = 0; i < 20; i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(chip8_romdb) / sizeof(chip8_romdb[0]); i++)
+    {
+        if (strcmp(chip8_romdb[i].sha1, hex) == 0)
+        {
+            return chip8_romdb[i].quirks;
+        }
+    }
+
+    return -1;
+}
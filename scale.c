@@ -0,0 +1,388 @@
+#include "chip8.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// The display is one bit per pixel, so Scale2x and Scale3x run a whole
+// row at a time as bitwise logic on the row and its neighbours, and
+// nearest scaling only widens each bit into a run of bits. Turning the
+// final rows of bits into 32-bit pixels is the one step that touches
+// every output pixel, so that is where the SIMD kernels are. Repeated
+// rows are copied rather than expanded again.
+
+// widest row of bits once scaled, in words
+const int SCALE_WIDE_WORDS = VIDEO_MAX_WIDTH * CHIP8_SCALE_MAX_FACTOR / 64;
+
+static const char *const scale_filter_names[] = {"nearest", "scale2x", "scale3x"};
+static const char *const scale_kernel_names[] = {"scalar", "sse2", "avx2"};
+
+// output pixels per display pixel the filter makes on its own
+static int scale_filter_factor(int filter)
+{
+    return filter == CHIP8_SCALE_SCALE2X ? 2 : filter == CHIP8_SCALE_SCALE3X ? 3 : 1;
+}
+
+static int scale_kernel_supported(int kernel)
+{
+#if defined(__x86_64__)
+    // SSE2 is part of x86-64 itself
+    if (kernel == CHIP8_SCALE_KERNEL_AVX2)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    return kernel == CHIP8_SCALE_KERNEL_SCALAR || kernel == CHIP8_SCALE_KERNEL_SSE2;
+#else
+    return kernel == CHIP8_SCALE_KERNEL_SCALAR;
+#endif
+}
+
+int chip8_scaler_init(struct chip8_scaler *scaler, int filter, int factor, int scanlines)
+{
+    memset(scaler, 0, sizeof(*scaler));
+
+    if (filter < CHIP8_SCALE_NEAREST || filter > CHIP8_SCALE_SCALE3X)
+    {
+        fprintf(stderr, "Unknown scale filter %d\n", filter);
+        return -1;
+    }
+
+    int filter_factor = scale_filter_factor(filter);
+    if (factor < 1 || factor > CHIP8_SCALE_MAX_FACTOR || factor % filter_factor != 0)
+    {
+        fprintf(stderr, "%s needs a scale factor that is a multiple of %d up to %d, not %d\n",
+                scale_filter_names[filter], filter_factor, CHIP8_SCALE_MAX_FACTOR, factor);
+        return -1;
+    }
+
+    scaler->filter = filter;
+    scaler->factor = factor;
+    scaler->scanlines = scanlines;
+
+    // the same colors as chip8_expand_framebuffer()
+    scaler->on_color = 0xFFFFFFFF;
+    scaler->off_color = 0;
+
+    scaler->kernel = CHIP8_SCALE_KERNEL_AVX2;
+    while (!scale_kernel_supported(scaler->kernel))
+    {
+        scaler->kernel--;
+    }
+
+    return 0;
+}
+
+// Forces a kernel, for comparing them. Returns -1 if this CPU can't run it.
+int chip8_scaler_set_kernel(struct chip8_scaler *scaler, int kernel)
+{
+    if (kernel < CHIP8_SCALE_KERNEL_SCALAR || kernel > CHIP8_SCALE_KERNEL_AVX2 || !scale_kernel_supported(kernel))
+    {
+        return -1;
+    }
+
+    scaler->kernel = kernel;
+    return 0;
+}
+
+// Largest factor the filter can use that keeps width by height inside
+// max_width by max_height, or the filter's smallest if none does
+int chip8_scale_fit(int filter, int width, int height, int max_width, int max_height)
+{
+    int filter_factor = scale_filter_factor(filter);
+    int factor = max_width / width < max_height / height ? max_width / width : max_height / height;
+
+    if (factor > CHIP8_SCALE_MAX_FACTOR)
+    {
+        factor = CHIP8_SCALE_MAX_FACTOR;
+    }
+    factor -= factor % filter_factor;
+
+    return factor > 0 ? factor : filter_factor;
+}
+
+int chip8_parse_scale_filter(const char *name)
+{
+    for (int filter = 0; filter < (int)(sizeof(scale_filter_names) / sizeof(scale_filter_names[0])); filter++)
+    {
+        if (strcmp(name, scale_filter_names[filter]) == 0)
+        {
+            return filter;
+        }
+    }
+
+    return -1;
+}
+
+const char *chip8_scale_filter_name(int filter)
+{
+    return filter >= CHIP8_SCALE_NEAREST && filter <= CHIP8_SCALE_SCALE3X ? scale_filter_names[filter] : "unknown";
+}
+
+const char *chip8_scale_kernel_name(int kernel)
+{
+    return kernel >= CHIP8_SCALE_KERNEL_SCALAR && kernel <= CHIP8_SCALE_KERNEL_AVX2 ? scale_kernel_names[kernel] : "unknown";
+}
+
+// Row bits shifted so pixel x lines up with x - 1 or x + 1, the edge
+// pixel standing in for the one past it as Scale2x/3x do at the border
+static void scale_left_neighbours(const uint64_t *row, int words, uint64_t *out)
+{
+    uint64_t carry = row[0] & 0x8000000000000000ull;
+    for (int w = 0; w < words; w++)
+    {
+        out[w] = (row[w] >> 1) | carry;
+        carry = row[w] << 63;
+    }
+}
+
+static void scale_right_neighbours(const uint64_t *row, int words, uint64_t *out)
+{
+    uint64_t carry = row[words - 1] & 1;
+    for (int w = words - 1; w >= 0; w--)
+    {
+        out[w] = (row[w] << 1) | carry;
+        carry = row[w] >> 63;
+    }
+}
+
+// the bits of mask from a, the rest from b
+static inline uint64_t scale_pick(uint64_t mask, uint64_t a, uint64_t b)
+{
+    return (mask & a) | (~mask & b);
+}
+
+// Filters display row y into f by f sub-pixels per pixel, out[s * f + j]
+// being column j of sub-row s for the whole row. The Scale2x/3x rules are
+// applied to all 64 pixels of a word at once, with the neighbours named
+//   A B C
+//   D E F
+//   G H I
+static void scale_filter_row(const uint64_t *vid, const uint64_t *vid_right, int width, int height, int filter, int y, uint64_t out[9][2])
+{
+    int words = width / 64;
+    int up = y > 0 ? y - 1 : y;
+    int down = y + 1 < height ? y + 1 : y;
+
+    uint64_t rb[2] = {vid[up], vid_right[up]};
+    uint64_t re[2] = {vid[y], vid_right[y]};
+    uint64_t rh[2] = {vid[down], vid_right[down]};
+
+    if (filter == CHIP8_SCALE_NEAREST)
+    {
+        memcpy(out[0], re, sizeof(re));
+        return;
+    }
+
+    uint64_t ra[2], rc[2], rd[2], rf[2], rg[2], ri[2];
+    scale_left_neighbours(rb, words, ra);
+    scale_right_neighbours(rb, words, rc);
+    scale_left_neighbours(re, words, rd);
+    scale_right_neighbours(re, words, rf);
+    scale_left_neighbours(rh, words, rg);
+    scale_right_neighbours(rh, words, ri);
+
+    for (int w = 0; w < words; w++)
+    {
+        uint64_t a = ra[w], b = rb[w], c = rc[w];
+        uint64_t d = rd[w], e = re[w], f = rf[w];
+        uint64_t g = rg[w], h = rh[w], i = ri[w];
+
+        // the corner rules both filters share, D==B && B!=F && D!=H etc.
+        uint64_t db = ~(d ^ b) & (b ^ f) & (d ^ h);
+        uint64_t bf = ~(b ^ f) & (b ^ d) & (f ^ h);
+        uint64_t dh = ~(d ^ h) & (d ^ b) & (h ^ f);
+        uint64_t hf = ~(h ^ f) & (d ^ h) & (b ^ f);
+
+        if (filter == CHIP8_SCALE_SCALE2X)
+        {
+            out[0][w] = scale_pick(db, d, e);
+            out[1][w] = scale_pick(bf, f, e);
+            out[2][w] = scale_pick(dh, d, e);
+            out[3][w] = scale_pick(hf, f, e);
+            continue;
+        }
+
+        out[0][w] = scale_pick(db, d, e);
+        out[1][w] = scale_pick((db & (e ^ c)) | (bf & (e ^ a)), b, e);
+        out[2][w] = scale_pick(bf, f, e);
+        out[3][w] = scale_pick((db & (e ^ g)) | (dh & (e ^ a)), d, e);
+        out[4][w] = e;
+        out[5][w] = scale_pick((bf & (e ^ i)) | (hf & (e ^ c)), f, e);
+        out[6][w] = scale_pick(dh, d, e);
+        out[7][w] = scale_pick((dh & (e ^ i)) | (hf & (e ^ g)), h, e);
+        out[8][w] = scale_pick(hf, f, e);
+    }
+}
+
+// sets len bits from bit start, counted from the MSB of out[0]
+static inline void scale_set_run(uint64_t *out, int start, int len)
+{
+    while (len > 0)
+    {
+        int bit = start % 64;
+        int take = len < 64 - bit ? len : 64 - bit;
+
+        out[start / 64] |= (~0ull << (64 - take)) >> bit;
+        start += take;
+        len -= take;
+    }
+}
+
+// One output row of bits from the f columns of a sub-row: column j of
+// pixel x becomes the n bits from (x * f + j) * n. Only set pixels are
+// visited, and most of a CHIP-8 display is clear.
+static void scale_widen(const uint64_t (*cols)[2], int f, int width, int n, uint64_t *out)
+{
+    if (f == 1 && n == 1)
+    {
+        memcpy(out, cols[0], width / 8);
+        return;
+    }
+
+    memset(out, 0, width * f * n / 8);
+    for (int j = 0; j < f; j++)
+    {
+        for (int w = 0; w < width / 64; w++)
+        {
+            uint64_t bits = cols[j][w];
+            while (bits != 0)
+            {
+                int lead = __builtin_clzll(bits);
+                bits &= ~(0x8000000000000000ull >> lead);
+
+                scale_set_run(out, ((w * 64 + lead) * f + j) * n, n);
+            }
+        }
+    }
+}
+
+// Bits to pixels, 64 per word with the MSB leftmost. The kernels must all
+// write the same pixels; chip8-emu-headless --bench-scaler checks they do.
+static void scale_expand_scalar(const uint64_t *bits, int words, uint32_t on, uint32_t off, uint32_t *out)
+{
+    for (int w = 0; w < words; w++)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            out[i] = (bits[w] >> (63 - i)) & 1 ? on : off;
+        }
+        out += 64;
+    }
+}
+
+#if defined(__x86_64__)
+
+// a nibble at a time: broadcast, test each lane's bit, blend the colors
+static void scale_expand_sse2(const uint64_t *bits, int words, uint32_t on, uint32_t off, uint32_t *out)
+{
+    const __m128i lane_bits = _mm_setr_epi32(8, 4, 2, 1);
+    const __m128i on_v = _mm_set1_epi32(on);
+    const __m128i off_v = _mm_set1_epi32(off);
+
+    for (int w = 0; w < words; w++)
+    {
+        for (int shift = 60; shift >= 0; shift -= 4)
+        {
+            __m128i nibble = _mm_set1_epi32((bits[w] >> shift) & 0xF);
+            __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(nibble, lane_bits), lane_bits);
+
+            _mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_and_si128(mask, on_v), _mm_andnot_si128(mask, off_v)));
+            out += 4;
+        }
+    }
+}
+
+// the same a byte at a time, built for AVX2 whatever the compiler flags
+// and only called once the CPU says it has it
+__attribute__((target("avx2"))) static void scale_expand_avx2(const uint64_t *bits, int words, uint32_t on, uint32_t off, uint32_t *out)
+{
+    const __m256i lane_bits = _mm256_setr_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+    const __m256i on_v = _mm256_set1_epi32(on);
+    const __m256i off_v = _mm256_set1_epi32(off);
+
+    for (int w = 0; w < words; w++)
+    {
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            __m256i byte = _mm256_set1_epi32((bits[w] >> shift) & 0xFF);
+            __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(byte, lane_bits), lane_bits);
+
+            _mm256_storeu_si256((__m256i *)out, _mm256_blendv_epi8(off_v, on_v, mask));
+            out += 8;
+        }
+    }
+}
+
+#endif
+
+static void scale_expand(int kernel, const uint64_t *bits, int words, uint32_t on, uint32_t off, uint32_t *out)
+{
+    switch (kernel)
+    {
+#if defined(__x86_64__)
+    case CHIP8_SCALE_KERNEL_AVX2:
+        scale_expand_avx2(bits, words, on, off, out);
+        break;
+    case CHIP8_SCALE_KERNEL_SSE2:
+        scale_expand_sse2(bits, words, on, off, out);
+        break;
+#endif
+    default:
+        scale_expand_scalar(bits, words, on, off, out);
+        break;
+    }
+}
+
+// half brightness, alpha kept, for RGBA8888
+static uint32_t scale_dim(uint32_t color)
+{
+    return ((color >> 1) & 0x7F7F7F00) | (color & 0xFF);
+}
+
+// Writes a width by height display laid out like chip8_data's vid and
+// vid_right as width * factor by height * factor RGBA8888 pixels, rows
+// pitch bytes apart, e.g. straight into a locked texture
+void chip8_scale_display(const struct chip8_scaler *scaler, const uint64_t *vid, const uint64_t *vid_right, int width, int height,
+                         void *pixels, int pitch)
+{
+    int f = scale_filter_factor(scaler->filter);
+    int n = scaler->factor / f;
+    int out_width = width * scaler->factor;
+    int out_words = out_width / 64;
+
+    uint64_t cols[9][2];
+    uint64_t wide[SCALE_WIDE_WORDS];
+    uint8_t *out_row = (uint8_t *)pixels;
+
+    for (int y = 0; y < height; y++)
+    {
+        scale_filter_row(vid, vid_right, width, height, scaler->filter, y, cols);
+
+        for (int s = 0; s < f; s++)
+        {
+            scale_widen(cols + s * f, f, width, n, wide);
+
+            for (int k = 0; k < n; k++)
+            {
+                if (scaler->scanlines && scaler->factor > 1 && s == f - 1 && k == n - 1)
+                {
+                    scale_expand(scaler->kernel, wide, out_words, scale_dim(scaler->on_color), scale_dim(scaler->off_color), (uint32_t *)out_row);
+                }
+                else if (k == 0)
+                {
+                    scale_expand(scaler->kernel, wide, out_words, scaler->on_color, scaler->off_color, (uint32_t *)out_row);
+                }
+                else
+                {
+                    memcpy(out_row, out_row - pitch, out_width * sizeof(uint32_t));
+                }
+
+                out_row += pitch;
+            }
+        }
+    }
+}
+
+void chip8_scale(const struct chip8_scaler *scaler, const struct chip8_data *chip, void *pixels, int pitch)
+{
+    chip8_scale_display(scaler, chip->vid, chip->vid_right, chip->vid_width, chip->vid_height, pixels, pitch);
+}
@@ -0,0 +1,58 @@
+#include "chip8.h"
+#include <errno.h>
+
+// Frame deadlines are counted from a fixed start so oversleeping one frame
+// doesn't push back the ones after it. Returns the current frame's.
+long long chip8_sched_deadline(const struct chip8_sched *sched)
+{
+    return sched->start + (long long)((sched->frames + 1) * 1000000000ull / sched->hz);
+}
+
+void chip8_sched_init(struct chip8_sched *sched, unsigned int hz)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->hz = hz;
+    sched->start = time_nanos();
+}
+
+// Sleeps until the current frame's deadline. Returns 1 if the frame's work
+// already ran past it.
+int chip8_sched_wait(struct chip8_sched *sched)
+{
+    long long deadline = chip8_sched_deadline(sched);
+    long long now = time_nanos();
+
+    sched->total_frames++;
+
+    if (now > deadline)
+    {
+        sched->late_frames++;
+        if (now - deadline > sched->max_late_ns)
+        {
+            sched->max_late_ns = now - deadline;
+        }
+
+        // behind schedule: restart the count from here rather than
+        // running the missed frames back to back
+        sched->start = now;
+        sched->frames = 0;
+        return 1;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ll;
+    ts.tv_nsec = deadline % 1000000000ll;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+
+    sched->frames++;
+    return 0;
+}
+
+void chip8_sched_report(const struct chip8_sched *sched, FILE *out)
+{
+    fprintf(out, "frames=%llu late_frames=%llu max_late_ms=%.3f\n",
+            sched->total_frames, sched->late_frames, sched->max_late_ns / 1e6);
+}
@@ -0,0 +1,140 @@
+#include "chip8.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A state file is a chip8_state_header followed by the first
+// CHIP8_STATE_SIZE bytes of struct chip8_data, exactly as they sit in
+// memory, so loading one is a validate and a memcpy.
+
+const char CHIP8_STATE_MAGIC[8] = {'C', 'H', 'I', 'P', '8', 'S', 'T', '\0'};
+
+// bump whenever the fields before fault_jmp change
+const uint32_t CHIP8_STATE_VERSION = 4;
+
+int chip8_state_save(const struct chip8_data *chip, const char *filename)
+{
+    struct chip8_state_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_STATE_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_STATE_VERSION;
+    header.size = CHIP8_STATE_SIZE;
+    header.checksum = chip8_hash(chip, CHIP8_STATE_SIZE);
+
+    // written beside the target and renamed over it, so a crash midway
+    // never leaves a torn state behind
+    size_t tmp_len = strlen(filename) + 5;
+    char *tmp_filename = (char *)malloc(tmp_len);
+    snprintf(tmp_filename, tmp_len, "%s.tmp", filename);
+
+    FILE *state_file = fopen(tmp_filename, "wb");
+    if (state_file == NULL)
+    {
+        fprintf(stderr, "Could not create state file '%s'\n", tmp_filename);
+        free(tmp_filename);
+        return -1;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, state_file) == 1 &&
+             fwrite(chip, CHIP8_STATE_SIZE, 1, state_file) == 1;
+    ok &= fclose(state_file) == 0;
+    ok = ok && rename(tmp_filename, filename) == 0;
+
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write state file '%s'\n", filename);
+        remove(tmp_filename);
+    }
+
+    free(tmp_filename);
+    return ok ? 0 : -1;
+}
+
+// The checksum only catches damage, anyone editing a state can redo it.
+// Returns what in a payload the core can't run from, or NULL.
+static const char *chip8_state_check(const struct chip8_data *state)
+{
+    if (state->sp > 16)
+    {
+        return "stack pointer";
+    }
+    if (state->ips == 0)
+    {
+        return "instruction rate";
+    }
+    if (state->quirks >= CHIP8_QUIRKS_COUNT)
+    {
+        return "quirk profile";
+    }
+
+    // 64x32, 64x64 or 128x64
+    if (!(state->vid_width == 64 && (state->vid_height == 32 || state->vid_height == 64)) &&
+        !(state->vid_width == 128 && state->vid_height == 64))
+    {
+        return "display mode";
+    }
+
+    return NULL;
+}
+
+int chip8_state_load(struct chip8_data *chip, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open state file '%s'\n", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != sizeof(struct chip8_state_header) + CHIP8_STATE_SIZE)
+    {
+        fprintf(stderr, "State file '%s' has the wrong size\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map state file '%s'\n", filename);
+        return -1;
+    }
+
+    const struct chip8_state_header *header = (const struct chip8_state_header *)map;
+    const uint8_t *payload = (const uint8_t *)map + sizeof(*header);
+    int status = -1;
+    const char *bad;
+
+    if (memcmp(header->magic, CHIP8_STATE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        fprintf(stderr, "'%s' is not a state file\n", filename);
+    }
+    else if (header->version != CHIP8_STATE_VERSION || header->size != CHIP8_STATE_SIZE)
+    {
+        fprintf(stderr, "State file '%s' is version %u, expected %u\n", filename, header->version, CHIP8_STATE_VERSION);
+    }
+    else if (header->checksum != chip8_hash(payload, CHIP8_STATE_SIZE))
+    {
+        fprintf(stderr, "State file '%s' is corrupt\n", filename);
+    }
+    else if ((bad = chip8_state_check((const struct chip8_data *)payload)) != NULL)
+    {
+        fprintf(stderr, "State file '%s' has an invalid %s\n", filename, bad);
+    }
+    else
+    {
+        memcpy(chip, payload, CHIP8_STATE_SIZE);
+
+        // memory was replaced wholesale, nothing cached from it still holds
+        chip8_bcache_flush(chip);
+        chip->vid_dirty = 1;
+        chip->status = CHIP8_OK;
+        status = 0;
+    }
+
+    munmap(map, st.st_size);
+    return status;
+}
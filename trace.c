@@ -0,0 +1,393 @@
+#include "chip8.h"
+
+// With chip->trace set, chip8_run() runs the switch interpreter with one
+// chip8_trace_entry written per instruction: the pc before it, then the
+// opcode and what it left behind once it returns. An entry is 10 bytes of
+// stores of values the instruction just touched, so a trace of the last
+// few thousand frames can stay on for a whole run. Instructions
+// chip8_unpark() skips rather than executes leave no entries.
+//
+// A trace file is a chip8_trace_header followed by its entries, oldest
+// first, as they sit in the ring.
+
+const char CHIP8_TRACE_MAGIC[8] = {'C', 'H', '8', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t CHIP8_TRACE_VERSION = 1;
+
+int chip8_trace_init(struct chip8_trace *trace, unsigned int entries, const char *fault_filename)
+{
+    memset(trace, 0, sizeof(*trace));
+
+    uint64_t size = 1;
+    while (size < entries)
+    {
+        size <<= 1;
+    }
+
+    trace->ring = (struct chip8_trace_entry *)calloc(size, sizeof(struct chip8_trace_entry));
+    if (trace->ring == NULL)
+    {
+        fprintf(stderr, "Could not allocate a trace of %llu entries\n", (unsigned long long)size);
+        return -1;
+    }
+
+    trace->mask = size - 1;
+    trace->fault_filename = fault_filename;
+    return 0;
+}
+
+void chip8_trace_free(struct chip8_trace *trace)
+{
+    free(trace->ring);
+    trace->ring = NULL;
+}
+
+// Fills in the rest of an entry whose pc is set. Byte loads only: a wide
+// load of the registers right after the handler's byte stores to them
+// stalls on store forwarding and cost more than the rest of the entry.
+static inline void chip8_trace_fill(struct chip8_trace_entry *entry, const struct chip8_data *chip)
+{
+    entry->opcode = chip->opcode;
+    entry->idx = chip->idx;
+    entry->vx = chip->regs[(chip->opcode >> 8) & 0xF];
+    entry->vf = chip->regs[0xF];
+    entry->sp = chip->sp;
+    entry->delay = chip->delTime;
+}
+
+template <unsigned int Q>
+void chip8_run_trace(struct chip8_data *chip, unsigned long long cycles)
+{
+    // kept in locals, the handlers' stores through chip would otherwise
+    // make the compiler reload them every instruction
+    struct chip8_trace *trace = chip->trace;
+    struct chip8_trace_entry *ring = trace->ring;
+    uint64_t mask = trace->mask;
+    uint64_t head = trace->head;
+
+    while (cycles-- > 0)
+    {
+        struct chip8_trace_entry *entry = &ring[head & mask];
+
+        entry->pc = chip->pc;
+        chip8_cycle<Q>(chip);
+        chip8_trace_fill(entry, chip);
+        __atomic_store_n(&trace->head, ++head, __ATOMIC_RELEASE);
+
+        if (chip->parked)
+        {
+            cycles -= chip8_unpark(chip, cycles);
+        }
+    }
+}
+
+// Called by chip8_fault() from inside the faulting instruction: publishes
+// its entry and saves the trace if the owner asked for it
+void chip8_trace_fault(struct chip8_data *chip)
+{
+    struct chip8_trace *trace = chip->trace;
+
+    chip8_trace_fill(&trace->ring[trace->head & trace->mask], chip);
+    __atomic_store_n(&trace->head, trace->head + 1, __ATOMIC_RELEASE);
+    if (trace->fault_filename != NULL)
+    {
+        chip8_trace_save(trace, chip, trace->fault_filename);
+    }
+}
+
+// Copies the entries still in the ring to entries, which has room for all
+// of them, oldest first. Safe from any thread while the machine runs.
+// Returns how many were copied and sets first to the index of the oldest.
+size_t chip8_trace_snapshot(const struct chip8_trace *trace, struct chip8_trace_entry *entries, uint64_t *first)
+{
+    uint64_t size = trace->mask + 1;
+    uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > size ? head - size : 0;
+
+    for (uint64_t i = start; i < head; i++)
+    {
+        entries[i - start] = trace->ring[i & trace->mask];
+    }
+
+    // the writer may have lapped the copy, and the slot of the entry it is
+    // filling in right now holds the oldest one
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&trace->head, __ATOMIC_RELAXED);
+    uint64_t valid = now >= size ? now - size + 1 : 0;
+    uint64_t skip = valid > start ? valid - start : 0;
+    if (skip > head - start)
+    {
+        skip = head - start;
+    }
+
+    memmove(entries, entries + skip, (head - start - skip) * sizeof(*entries));
+    *first = start + skip;
+    return head - start - skip;
+}
+
+int chip8_trace_save(const struct chip8_trace *trace, const struct chip8_data *chip, const char *filename)
+{
+    struct chip8_trace_entry *entries = (struct chip8_trace_entry *)malloc((trace->mask + 1) * sizeof(*entries));
+    if (entries == NULL)
+    {
+        fprintf(stderr, "Could not allocate a copy of the trace\n");
+        return -1;
+    }
+
+    uint64_t first;
+    size_t count = chip8_trace_snapshot(trace, entries, &first);
+
+    struct chip8_trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHIP8_TRACE_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_TRACE_VERSION;
+    header.entry_size = sizeof(struct chip8_trace_entry);
+    header.total = first + count;
+    header.count = count;
+    header.status = chip->status;
+    header.quirks = chip->quirks;
+
+    FILE *trace_file = fopen(filename, "wb");
+    if (trace_file == NULL)
+    {
+        fprintf(stderr, "Could not create trace file '%s'\n", filename);
+        free(entries);
+        return -1;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, trace_file) == 1 &&
+             fwrite(entries, sizeof(*entries), count, trace_file) == count;
+    ok &= fclose(trace_file) == 0;
+    free(entries);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write trace file '%s'\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+int chip8_trace_load(const char *filename, struct chip8_trace_header *header, struct chip8_trace_entry **entries)
+{
+    *entries = NULL;
+
+    FILE *trace_file = fopen(filename, "rb");
+    if (trace_file == NULL)
+    {
+        fprintf(stderr, "Could not open trace file '%s'\n", filename);
+        return -1;
+    }
+
+    if (fread(header, sizeof(*header), 1, trace_file) != 1 ||
+        memcmp(header->magic, CHIP8_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CHIP8_TRACE_VERSION || header->entry_size != sizeof(struct chip8_trace_entry))
+    {
+        fprintf(stderr, "'%s' is not a version %u trace file\n", filename, CHIP8_TRACE_VERSION);
+        fclose(trace_file);
+        return -1;
+    }
+
+    *entries = (struct chip8_trace_entry *)malloc((header->count + 1) * sizeof(**entries));
+    if (*entries == NULL || fread(*entries, sizeof(**entries), header->count, trace_file) != header->count)
+    {
+        fprintf(stderr, "Trace file '%s' is truncated\n", filename);
+        free(*entries);
+        *entries = NULL;
+        fclose(trace_file);
+        return -1;
+    }
+
+    fclose(trace_file);
+    return 0;
+}
+
+// Bit n set for each Vn the opcode writes under the CHIP8_QUIRKS_* profile
+unsigned int chip8_insn_writes(uint16_t opcode, int quirks)
+{
+    struct chip8_insn in;
+    chip8_decode(opcode, &in);
+
+    unsigned int vx = 1u << in.x;
+    unsigned int vf = 1u << 0xF;
+
+    switch (in.op)
+    {
+    case CHIP8_OP_6xkk:
+    case CHIP8_OP_7xkk:
+    case CHIP8_OP_8xy0:
+    case CHIP8_OP_Cxkk:
+    case CHIP8_OP_Fx07:
+    case CHIP8_OP_Fx0A:
+        return vx;
+    case CHIP8_OP_8xy1:
+    case CHIP8_OP_8xy2:
+    case CHIP8_OP_8xy3:
+        return (chip8_quirk_bits(quirks) & CHIP8_QUIRK_VF_RESET) ? vx | vf : vx;
+    case CHIP8_OP_8xy4:
+    case CHIP8_OP_8xy5:
+    case CHIP8_OP_8xy6:
+    case CHIP8_OP_8xy7:
+    case CHIP8_OP_8xyE:
+        return vx | vf;
+    case CHIP8_OP_Dxyn:
+        return vf;
+    case CHIP8_OP_Fx65:
+    case CHIP8_OP_Fx85:
+        return (vx << 1) - 1;
+    default:
+        return 0;
+    }
+}
+
+// Writes the opcode as assembly in the mnemonics of Cowgod's reference,
+// with the SUPER-CHIP additions. Bnnn reads as the CHIP8_QUIRKS_* profile
+// runs it. Opcodes with no instruction come out as a data word.
+void chip8_disassemble(uint16_t opcode, int quirks, char *text, size_t len)
+{
+    struct chip8_insn in;
+    chip8_decode(opcode, &in);
+
+    switch (in.op)
+    {
+    case CHIP8_OP_0E00:
+        snprintf(text, len, "CLS");
+        break;
+    case CHIP8_OP_00EE:
+        snprintf(text, len, "RET");
+        break;
+    case CHIP8_OP_1nnn:
+        snprintf(text, len, "JP 0x%03X", in.nnn);
+        break;
+    case CHIP8_OP_2nnn:
+        snprintf(text, len, "CALL 0x%03X", in.nnn);
+        break;
+    case CHIP8_OP_3xkk:
+        snprintf(text, len, "SE V%X, 0x%02X", in.x, in.kk);
+        break;
+    case CHIP8_OP_4xkk:
+        snprintf(text, len, "SNE V%X, 0x%02X", in.x, in.kk);
+        break;
+    case CHIP8_OP_5xy0:
+        snprintf(text, len, "SE V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_6xkk:
+        snprintf(text, len, "LD V%X, 0x%02X", in.x, in.kk);
+        break;
+    case CHIP8_OP_7xkk:
+        snprintf(text, len, "ADD V%X, 0x%02X", in.x, in.kk);
+        break;
+    case CHIP8_OP_8xy0:
+        snprintf(text, len, "LD V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy1:
+        snprintf(text, len, "OR V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy2:
+        snprintf(text, len, "AND V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy3:
+        snprintf(text, len, "XOR V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy4:
+        snprintf(text, len, "ADD V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy5:
+        snprintf(text, len, "SUB V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy6:
+        snprintf(text, len, "SHR V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xy7:
+        snprintf(text, len, "SUBN V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_8xyE:
+        snprintf(text, len, "SHL V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_9xy0:
+        snprintf(text, len, "SNE V%X, V%X", in.x, in.y);
+        break;
+    case CHIP8_OP_Annn:
+        snprintf(text, len, "LD I, 0x%03X", in.nnn);
+        break;
+    case CHIP8_OP_Bnnn:
+        if (chip8_quirk_bits(quirks) & CHIP8_QUIRK_JUMP_VX)
+        {
+            snprintf(text, len, "JP V%X, 0x%03X", in.x, in.nnn);
+        }
+        else
+        {
+            snprintf(text, len, "JP V0, 0x%03X", in.nnn);
+        }
+        break;
+    case CHIP8_OP_Cxkk:
+        snprintf(text, len, "RND V%X, 0x%02X", in.x, in.kk);
+        break;
+    case CHIP8_OP_Dxyn:
+        snprintf(text, len, "DRW V%X, V%X, %u", in.x, in.y, in.n);
+        break;
+    case CHIP8_OP_Ex9E:
+        snprintf(text, len, "SKP V%X", in.x);
+        break;
+    case CHIP8_OP_ExA1:
+        snprintf(text, len, "SKNP V%X", in.x);
+        break;
+    case CHIP8_OP_Fx07:
+        snprintf(text, len, "LD V%X, DT", in.x);
+        break;
+    case CHIP8_OP_Fx0A:
+        snprintf(text, len, "LD V%X, K", in.x);
+        break;
+    case CHIP8_OP_Fx15:
+        snprintf(text, len, "LD DT, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx18:
+        snprintf(text, len, "LD ST, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx1E:
+        snprintf(text, len, "ADD I, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx29:
+        snprintf(text, len, "LD F, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx30:
+        snprintf(text, len, "LD HF, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx33:
+        snprintf(text, len, "LD B, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx55:
+        snprintf(text, len, "LD [I], V%X", in.x);
+        break;
+    case CHIP8_OP_Fx65:
+        snprintf(text, len, "LD V%X, [I]", in.x);
+        break;
+    case CHIP8_OP_Fx75:
+        snprintf(text, len, "LD R, V%X", in.x);
+        break;
+    case CHIP8_OP_Fx85:
+        snprintf(text, len, "LD V%X, R", in.x);
+        break;
+    case CHIP8_OP_00Cn:
+        snprintf(text, len, "SCD %u", in.n);
+        break;
+    case CHIP8_OP_00FB:
+        snprintf(text, len, "SCR");
+        break;
+    case CHIP8_OP_00FC:
+        snprintf(text, len, "SCL");
+        break;
+    case CHIP8_OP_00FD:
+        snprintf(text, len, "EXIT");
+        break;
+    case CHIP8_OP_00FE:
+        snprintf(text, len, "LOW");
+        break;
+    case CHIP8_OP_00FF:
+        snprintf(text, len, "HIGH");
+        break;
+    default:
+        snprintf(text, len, "DW 0x%04X", opcode);
+        break;
+    }
+}
@@ -0,0 +1,214 @@
+#include "chip8.h"
+#include <getopt.h>
+#include <strings.h>
+
+// Offline reader for the trace files chip8-emu -t and chip8-emu-headless
+// --trace write: decodes and disassembles the entries, keeping those that
+// match every filter given.
+
+static void tracedump_usage()
+{
+    fprintf(stderr, "Usage: chip8-tracedump [-p addr[-addr]] [-m mnemonic] [-r reg] [-i addr] [-n count] [-c] <trace_file>\n");
+    fprintf(stderr, "  -p entries fetched from this address or range\n");
+    fprintf(stderr, "  -m entries whose instruction is this mnemonic, e.g. DRW or CALL\n");
+    fprintf(stderr, "  -r entries that wrote this V register, 0-F\n");
+    fprintf(stderr, "  -i entries that left I at this address\n");
+    fprintf(stderr, "  -n only the last count entries that match\n");
+    fprintf(stderr, "  -c print the number of entries that match instead\n");
+}
+
+struct tracedump_filter
+{
+    unsigned int pc_lo;
+    unsigned int pc_hi;
+    const char *mnemonic;
+    int reg;
+    int idx;
+};
+
+static int tracedump_match(const struct tracedump_filter *filter, const struct chip8_trace_entry *entry, int quirks,
+                           const char *text)
+{
+    if (entry->pc < filter->pc_lo || entry->pc > filter->pc_hi)
+    {
+        return 0;
+    }
+
+    if (filter->reg >= 0 && !(chip8_insn_writes(entry->opcode, quirks) & (1 << filter->reg)))
+    {
+        return 0;
+    }
+
+    if (filter->idx >= 0 && entry->idx != filter->idx)
+    {
+        return 0;
+    }
+
+    if (filter->mnemonic != NULL)
+    {
+        size_t len = strlen(filter->mnemonic);
+        if (strncasecmp(text, filter->mnemonic, len) != 0 || (text[len] != ' ' && text[len] != '\0'))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// <index> <pc> <opcode> <assembly> then the registers it wrote and the
+// rest of what the entry holds
+static void tracedump_print(uint64_t index, const struct chip8_trace_entry *entry, int quirks, const char *text)
+{
+    unsigned int writes = chip8_insn_writes(entry->opcode, quirks);
+    int x = (entry->opcode >> 8) & 0xF;
+    char changes[128];
+    int len = 0;
+
+    changes[0] = '\0';
+    for (int reg = 0; reg < 16; reg++)
+    {
+        if (!(writes & (1 << reg)))
+        {
+            continue;
+        }
+
+        // the rest of the registers an Fx65 loads only show that it did
+        if (reg == x)
+        {
+            len += snprintf(changes + len, sizeof(changes) - len, "V%X=%02X ", reg, entry->vx);
+        }
+        else if (reg == 0xF)
+        {
+            len += snprintf(changes + len, sizeof(changes) - len, "VF=%02X ", entry->vf);
+        }
+        else
+        {
+            len += snprintf(changes + len, sizeof(changes) - len, "V%X ", reg);
+        }
+    }
+
+    printf("%10llu  %03X  %04X  %-18s %-24sI=%03X SP=%u DT=%02X\n", (unsigned long long)index, entry->pc, entry->opcode, text,
+           changes, entry->idx, entry->sp, entry->delay);
+}
+
+int main(int argc, char **argv)
+{
+    struct tracedump_filter filter;
+    filter.pc_lo = 0;
+    filter.pc_hi = 0xFFFF;
+    filter.mnemonic = NULL;
+    filter.reg = -1;
+    filter.idx = -1;
+    unsigned long long last = 0;
+    int count_only = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:m:r:i:n:c")) != -1)
+    {
+        char *end;
+
+        switch (opt)
+        {
+        case 'p':
+            filter.pc_lo = strtoul(optarg, &end, 16);
+            filter.pc_hi = *end == '-' ? strtoul(end + 1, &end, 16) : filter.pc_lo;
+            if (*end != '\0' || filter.pc_hi < filter.pc_lo)
+            {
+                fprintf(stderr, "Invalid address range '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            filter.mnemonic = optarg;
+            break;
+        case 'r':
+            filter.reg = strtol(optarg, &end, 16);
+            if (*end != '\0' || end == optarg || filter.reg < 0 || filter.reg > 0xF)
+            {
+                fprintf(stderr, "Invalid register '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            filter.idx = strtol(optarg, &end, 16);
+            if (*end != '\0' || end == optarg)
+            {
+                fprintf(stderr, "Invalid address '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            last = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            count_only = 1;
+            break;
+        default:
+            tracedump_usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        tracedump_usage();
+        return 1;
+    }
+
+    struct chip8_trace_header header;
+    struct chip8_trace_entry *entries;
+    if (chip8_trace_load(argv[optind], &header, &entries) < 0)
+    {
+        return 1;
+    }
+
+    uint64_t first = header.total - header.count;
+    if (!count_only)
+    {
+        printf("# last %llu of %llu instructions, quirks %s, %s\n", (unsigned long long)header.count,
+               (unsigned long long)header.total, chip8_quirks_name(header.quirks), chip8_status_name(header.status));
+    }
+
+    // matches are found newest first so -n can stop early, then printed in
+    // the order they ran
+    uint64_t *matches = (uint64_t *)malloc((header.count + 1) * sizeof(uint64_t));
+    uint64_t num_matches = 0;
+    char text[32];
+
+    for (uint64_t i = header.count; i-- > 0;)
+    {
+        chip8_disassemble(entries[i].opcode, header.quirks, text, sizeof(text));
+        if (tracedump_match(&filter, &entries[i], header.quirks, text))
+        {
+            matches[num_matches++] = i;
+            if (num_matches == last)
+            {
+                break;
+            }
+        }
+    }
+
+    if (count_only)
+    {
+        printf("%llu\n", (unsigned long long)num_matches);
+    }
+    else
+    {
+        for (uint64_t m = num_matches; m-- > 0;)
+        {
+            uint64_t i = matches[m];
+
+            chip8_disassemble(entries[i].opcode, header.quirks, text, sizeof(text));
+            tracedump_print(first + i, &entries[i], header.quirks, text);
+            if (header.status != CHIP8_OK && i == header.count - 1)
+            {
+                printf("%10s  ^ %s\n", "", chip8_status_name(header.status));
+            }
+        }
+    }
+
+    free(matches);
+    free(entries);
+    return 0;
+}
@@ -1,9 +1,14 @@
-#include "chip8.h"
+#include "platform.h"
 
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *texture;
 
+// rewind runs for as long as its key is held
+int rewind_held;
+
+SDL_AudioDeviceID audio_device;
+
 void platform_init(const char *title, int window_width, int window_height, int texture_width, int texture_height)
 {
     SDL_Init(SDL_INIT_VIDEO);
@@ -13,243 +18,251 @@ void platform_init(const char *title, int window_width, int window_height, int t
     texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, texture_width, texture_height);
 }
 
-void platform_update(void *buffer, int pitch)
+// Swaps in a texture for a new display mode, stretched to the same window
+void platform_resize(int texture_width, int texture_height)
 {
-    SDL_UpdateTexture(texture, NULL, buffer, pitch);
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    SDL_DestroyTexture(texture);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, texture_width, texture_height);
 }
 
-int process_input(uint8_t *keys)
+// Runs on SDL's audio thread
+static void platform_audio_callback(void *userdata, Uint8 *stream, int len)
 {
-    int quit = 0;
-
-    SDL_Event event;
+    chip8_audio_render((struct chip8_audio *)userdata, (int16_t *)stream, len / sizeof(int16_t));
+}
 
-    while (SDL_PollEvent(&event))
+// Opens the output device and initialises audio with the format it
+// actually got. Returns -1 after printing why if there is no device.
+int platform_audio_open(struct chip8_audio *audio, unsigned int sample_rate, unsigned int buffer_samples)
+{
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+
+    memset(&want, 0, sizeof(want));
+    want.freq = sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = buffer_samples;
+    want.callback = platform_audio_callback;
+    want.userdata = audio;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0 ||
+        (audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE)) == 0)
     {
-        switch (event.type)
-        {
-        case SDL_QUIT:
-        {
-            quit = 1;
-        }
-        break;
-
-        case SDL_KEYDOWN:
-        {
-            switch (event.key.keysym.sym)
-            {
-            case SDLK_ESCAPE:
-            {
-                quit = 1;
-            }
-            break;
-
-            case SDLK_x:
-            {
-                keys[0] = 1;
-            }
-            break;
+        fprintf(stderr, "Could not open audio device: %s\n", SDL_GetError());
+        return -1;
+    }
 
-            case SDLK_1:
-            {
-                keys[1] = 1;
-            }
-            break;
+    // devices open paused, so the callback can't see a half set up audio
+    if (chip8_audio_init(audio, have.freq, have.samples) < 0)
+    {
+        platform_audio_close();
+        return -1;
+    }
 
-            case SDLK_2:
-            {
-                keys[2] = 1;
-            }
-            break;
+    SDL_PauseAudioDevice(audio_device, 0);
+    return 0;
+}
 
-            case SDLK_3:
-            {
-                keys[3] = 1;
-            }
-            break;
+void platform_audio_close()
+{
+    if (audio_device != 0)
+    {
+        SDL_CloseAudioDevice(audio_device);
+        audio_device = 0;
+    }
+}
 
-            case SDLK_q:
-            {
-                keys[4] = 1;
-            }
-            break;
+// Redraws the window from the last uploaded frame
+void platform_present()
+{
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
 
-            case SDLK_w:
-            {
-                keys[5] = 1;
-            }
-            break;
+void platform_update(void *buffer, int pitch)
+{
+    SDL_UpdateTexture(texture, NULL, buffer, pitch);
+    platform_present();
+}
 
-            case SDLK_e:
-            {
-                keys[6] = 1;
-            }
-            break;
+// Hands out the texture's own pixels so a frame can be drawn straight
+// into them, platform_unlock() shows it. Every pixel must be written.
+void platform_lock(void **pixels, int *pitch)
+{
+    SDL_LockTexture(texture, NULL, pixels, pitch);
+}
 
-            case SDLK_a:
-            {
-                keys[7] = 1;
-            }
-            break;
+void platform_unlock()
+{
+    SDL_UnlockTexture(texture);
+    platform_present();
+}
 
-            case SDLK_s:
-            {
-                keys[8] = 1;
-            }
-            break;
+// Host key behind each CHIP-8 key, replaced by platform_load_keymap()
+SDL_Keycode keymap[16] = {
+    SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+    SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+    SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+    SDLK_4, SDLK_r, SDLK_f, SDLK_v,
+};
+
+// one bit per CHIP-8 key held, changed with atomics so it can be read
+// from any thread whenever the machine wants a snapshot
+uint16_t key_bitmap;
+
+// Reads "<chip-8 key> <SDL key name>" lines, e.g. "A Z" or "5 Up"; blank
+// lines and lines starting with # are skipped. Keys not listed keep their
+// defaults. Returns -1 after printing why on any bad line.
+int platform_load_keymap(const char *filename)
+{
+    FILE *keymap_file = fopen(filename, "r");
+    if (keymap_file == NULL)
+    {
+        fprintf(stderr, "Could not open keymap '%s'\n", filename);
+        return -1;
+    }
 
-            case SDLK_d:
-            {
-                keys[9] = 1;
-            }
-            break;
+    char line[256];
+    int line_num = 0;
+    int status = 0;
 
-            case SDLK_z:
-            {
-                keys[0xA] = 1;
-            }
-            break;
+    while (status == 0 && fgets(line, sizeof(line), keymap_file) != NULL)
+    {
+        unsigned int key;
+        char name[64];
 
-            case SDLK_c:
-            {
-                keys[0xB] = 1;
-            }
-            break;
+        line_num++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0' || line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
 
-            case SDLK_4:
-            {
-                keys[0xC] = 1;
-            }
-            break;
+        SDL_Keycode sym = SDLK_UNKNOWN;
+        if (sscanf(line, " %x %63[^\n]", &key, name) == 2 && key < 16)
+        {
+            sym = SDL_GetKeyFromName(name);
+        }
 
-            case SDLK_r:
-            {
-                keys[0xD] = 1;
-            }
+        if (sym == SDLK_UNKNOWN)
+        {
+            fprintf(stderr, "%s:%d: expected a key 0-F and an SDL key name\n", filename, line_num);
+            status = -1;
             break;
+        }
 
-            case SDLK_f:
-            {
-                keys[0xE] = 1;
-            }
-            break;
+        keymap[key] = sym;
+    }
 
-            case SDLK_v:
-            {
-                keys[0xF] = 1;
-            }
-            break;
-            }
-        }
-        break;
+    fclose(keymap_file);
+    return status;
+}
 
-        case SDL_KEYUP:
+static int platform_key_index(SDL_Keycode sym)
+{
+    for (int key = 0; key < 16; key++)
+    {
+        if (keymap[key] == sym)
         {
-            switch (event.key.keysym.sym)
-            {
-            case SDLK_x:
-            {
-                keys[0] = 0;
-            }
-            break;
-
-            case SDLK_1:
-            {
-                keys[1] = 0;
-            }
-            break;
+            return key;
+        }
+    }
 
-            case SDLK_2:
-            {
-                keys[2] = 0;
-            }
-            break;
+    return -1;
+}
 
-            case SDLK_3:
-            {
-                keys[3] = 0;
-            }
-            break;
+// Handles one event, adding any PLATFORM_* request it makes
+static int platform_handle_event(const SDL_Event *event)
+{
+    int key;
 
-            case SDLK_q:
-            {
-                keys[4] = 0;
-            }
-            break;
+    switch (event->type)
+    {
+    case SDL_QUIT:
+        return PLATFORM_QUIT;
 
-            case SDLK_w:
-            {
-                keys[5] = 0;
-            }
-            break;
+    case SDL_WINDOWEVENT:
+        // the emulator only presents on change, so the window system
+        // has to ask for anything it lost
+        if (event->window.event == SDL_WINDOWEVENT_EXPOSED)
+        {
+            platform_present();
+        }
+        return 0;
 
-            case SDLK_e:
-            {
-                keys[6] = 0;
-            }
-            break;
+    case SDL_KEYDOWN:
+        switch (event->key.keysym.sym)
+        {
+        case SDLK_ESCAPE:
+            return PLATFORM_QUIT;
+        case SDLK_F5:
+            return PLATFORM_SAVE_STATE;
+        case SDLK_F8:
+            return PLATFORM_SAVE_TRACE;
+        case SDLK_F9:
+            return PLATFORM_LOAD_STATE;
+        case SDLK_BACKSPACE:
+            rewind_held = 1;
+            return 0;
+        }
 
-            case SDLK_a:
-            {
-                keys[7] = 0;
-            }
-            break;
+        key = platform_key_index(event->key.keysym.sym);
+        if (key >= 0)
+        {
+            __atomic_fetch_or(&key_bitmap, 1u << key, __ATOMIC_RELEASE);
+        }
+        return 0;
 
-            case SDLK_s:
-            {
-                keys[8] = 0;
-            }
-            break;
+    case SDL_KEYUP:
+        if (event->key.keysym.sym == SDLK_BACKSPACE)
+        {
+            rewind_held = 0;
+            return 0;
+        }
 
-            case SDLK_d:
-            {
-                keys[9] = 0;
-            }
-            break;
+        key = platform_key_index(event->key.keysym.sym);
+        if (key >= 0)
+        {
+            __atomic_fetch_and(&key_bitmap, ~(1u << key), __ATOMIC_RELEASE);
+        }
+        return 0;
+    }
 
-            case SDLK_z:
-            {
-                keys[0xA] = 0;
-            }
-            break;
+    return 0;
+}
 
-            case SDLK_c:
-            {
-                keys[0xB] = 0;
-            }
-            break;
+// Sleeps in the event queue until deadline (time_nanos()), handling input
+// the moment it arrives, then snapshots the held keys into keys. Returns
+// the PLATFORM_* requests the user made.
+int process_input(uint8_t *keys, long long deadline)
+{
+    int requests = 0;
+    SDL_Event event;
 
-            case SDLK_4:
-            {
-                keys[0xC] = 0;
-            }
+    for (;;)
+    {
+        long long wait_ms = (deadline - time_nanos()) / 1000000;
+        int got = wait_ms > 0 ? SDL_WaitEventTimeout(&event, wait_ms) : SDL_PollEvent(&event);
+        if (!got)
+        {
             break;
+        }
 
-            case SDLK_r:
-            {
-                keys[0xD] = 0;
-            }
-            break;
+        requests |= platform_handle_event(&event);
+    }
 
-            case SDLK_f:
-            {
-                keys[0xE] = 0;
-            }
-            break;
+    uint16_t held = __atomic_load_n(&key_bitmap, __ATOMIC_ACQUIRE);
+    for (int key = 0; key < 16; key++)
+    {
+        keys[key] = (held >> key) & 1;
+    }
 
-            case SDLK_v:
-            {
-                keys[0xF] = 0;
-            }
-            break;
-            }
-        }
-        break;
-        }
+    if (rewind_held)
+    {
+        requests |= PLATFORM_REWIND;
     }
 
-    return quit;
+    return requests;
 }